@@ -0,0 +1,441 @@
+/**
+ * @file bench.c
+ * @brief Micro-benchmarks for the shell's own overhead.
+ *
+ * Links against the shell objects (everything but main.o) and drives the
+ * internal interfaces directly, so the numbers measure tinyshell rather
+ * than the programs it runs.
+ *
+ * Usage: tinyshell-bench [-s scale] [name...]
+ *   -s scale  Multiply every iteration count (default 1).
+ *   name      Run only the named benchmarks; an unknown name exits 2.
+ *
+ * Output is tab-separated, one line per benchmark after a header line:
+ *     name  iterations  total_ns  ns_per_op  ops_per_sec
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "complete.h"
+#include "error.h"
+#include "options.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "prompt.h"
+#include "signal_setup.h"
+#include "zygote.h"
+
+#define LINE_MAX_LEN 4096
+
+/* Globals normally defined in main.c. */
+int exit_code = 0;
+int interactive = 0;
+
+typedef struct {
+	const char *name;
+	long iterations;              /* before scaling */
+	int (*run)(long iterations);  /* 0 on success */
+} bench_t;
+
+static long scale = 1;
+
+/* Representative command lines for the parser benchmark. */
+static const char *parse_lines[] = {
+	"ls -la /usr/bin",
+	"grep -n \"pattern with spaces\" file.txt | sort | uniq -c > out.txt",
+	"echo 'single quoted' \"double quoted\" plain\\ escaped",
+	"cat < in.txt | tr a-z A-Z | tee copy.txt 2> err.log &",
+	"cd ~/projects/tinyshell",
+	"make -j8 CFLAGS=-O2 all",
+};
+
+#define NUM_PARSE_LINES (sizeof(parse_lines) / sizeof(parse_lines[0]))
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+report(const char *name, long iterations, long long ns)
+{
+	double per_op = (double)ns / (double)iterations;
+
+	printf("%s\t%ld\t%lld\t%.1f\t%.1f\n", name, iterations, ns, per_op,
+	       per_op > 0 ? 1e9 / per_op : 0.0);
+	fflush(stdout);
+}
+
+/*
+ * Parse and run one line as the main loop would. The line is copied
+ * first, since parser_parse() tokenizes in place.
+ */
+static int
+run_line(const char *line)
+{
+	char buf[LINE_MAX_LEN];
+	Pipeline *pipeline;
+	int ret;
+
+	snprintf(buf, sizeof(buf), "%s", line);
+	pipeline = parser_parse(buf);
+	if (!pipeline)
+		return -1;
+
+	ret = execute_pipeline(pipeline);
+	parser_free_pipeline(pipeline);
+	return ret ? -1 : 0;
+}
+
+/* Point stdout at /dev/null; returns the saved descriptor or -1. */
+static int
+stdout_silence(void)
+{
+	int saved, null;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	null = open("/dev/null", O_WRONLY);
+	if (saved == -1 || null == -1 || dup2(null, STDOUT_FILENO) == -1) {
+		error_print(__func__, "redirect stdout", errno);
+		if (saved != -1)
+			close(saved);
+		if (null != -1)
+			close(null);
+		return -1;
+	}
+
+	close(null);
+	return saved;
+}
+
+static void
+stdout_restore(int saved)
+{
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}
+
+/* ------------------------------------------------------------------------- */
+/*                                Benchmarks                                 */
+/* ------------------------------------------------------------------------- */
+
+static int
+bench_parse(long iterations)
+{
+	char buf[LINE_MAX_LEN];
+	long long start;
+	long i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		Pipeline *pipeline;
+
+		snprintf(buf, sizeof(buf), "%s", parse_lines[i % NUM_PARSE_LINES]);
+		pipeline = parser_parse(buf);
+		if (!pipeline)
+			return -1;
+		parser_free_pipeline(pipeline);
+	}
+
+	report("parse", iterations, now_ns() - start);
+	return 0;
+}
+
+/*
+ * Parse a line with a pattern over /usr/bin: one pass over the
+ * directory, then sorting the matches into the argv.
+ */
+static int
+bench_glob(long iterations)
+{
+	char buf[LINE_MAX_LEN];
+	long long start;
+	long i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		Pipeline *pipeline;
+
+		snprintf(buf, sizeof(buf), "%s", "ls /usr/bin/*");
+		pipeline = parser_parse(buf);
+		if (!pipeline)
+			return -1;
+		parser_free_pipeline(pipeline);
+	}
+
+	report("glob", iterations, now_ns() - start);
+	return 0;
+}
+
+static int
+bench_fork_exec(long iterations)
+{
+	long long start;
+	long i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (run_line("/bin/true"))
+			return -1;
+	}
+
+	report("fork_exec", iterations, now_ns() - start);
+	return 0;
+}
+
+static int
+bench_zygote_exec(long iterations)
+{
+	long long start;
+	long i;
+	int ret = 0;
+
+	if (options_set("zygote", 1))
+		return -1;
+
+	start = now_ns();
+	for (i = 0; i < iterations && !ret; i++)
+		ret = run_line("/bin/true");
+
+	options_set("zygote", 0);
+	zygote_stop();
+	if (ret)
+		return -1;
+
+	report("zygote_exec", iterations, now_ns() - start);
+	return 0;
+}
+
+static int
+bench_pipeline_n(long iterations, int stages)
+{
+	char line[LINE_MAX_LEN];
+	char name[32];
+	size_t off = 0;
+	long long start;
+	long i;
+
+	for (int k = 0; k < stages; k++)
+		off += (size_t)snprintf(line + off, sizeof(line) - off, "%s/bin/true",
+		                        k ? " | " : "");
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (run_line(line))
+			return -1;
+	}
+
+	snprintf(name, sizeof(name), "pipeline_%d", stages);
+	report(name, iterations, now_ns() - start);
+	return 0;
+}
+
+static int
+bench_pipeline_4(long iterations)
+{
+	return bench_pipeline_n(iterations, 4);
+}
+
+static int
+bench_pipeline_16(long iterations)
+{
+	return bench_pipeline_n(iterations, 16);
+}
+
+static int
+bench_prompt(long iterations)
+{
+	long long start;
+	long i;
+	int saved;
+
+	saved = stdout_silence();
+	if (saved == -1)
+		return -1;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (prompt_print((unsigned int)(i & 0xff))) {
+			stdout_restore(saved);
+			return -1;
+		}
+	}
+	start = now_ns() - start;
+
+	stdout_restore(saved);
+	report("prompt", iterations, start);
+	return 0;
+}
+
+/*
+ * Start iterations background jobs at once, then reap them all through
+ * the child event descriptor. Measures launch plus job-table churn.
+ */
+static int
+bench_jobs(long iterations)
+{
+	struct pollfd pfd;
+	long long start;
+	long i;
+
+	pfd.fd = signal_child_fd();
+	pfd.events = POLLIN;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (run_line("/bin/true &"))
+			return -1;
+	}
+
+	while (pipeline_job_count() > 0) {
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			error_print(__func__, "poll", errno);
+			return -1;
+		}
+		pipeline_notify_jobs();
+	}
+
+	report("jobs", iterations, now_ns() - start);
+	return 0;
+}
+
+/*
+ * Complete a one-letter command over and over. The first call builds
+ * the executable index; the rest only stat the $PATH directories.
+ */
+static int
+bench_complete(long iterations)
+{
+	long long start;
+	long i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		completion c;
+
+		if (complete_word("g", 1, &c))
+			return -1;
+		complete_free(&c);
+	}
+
+	report("complete", iterations, now_ns() - start);
+	return 0;
+}
+
+static const bench_t benches[] = {
+	{ "parse",       200000, bench_parse },
+	{ "glob",        2000,   bench_glob },
+	{ "fork_exec",   500,    bench_fork_exec },
+	{ "zygote_exec", 500,    bench_zygote_exec },
+	{ "pipeline_4",  200,    bench_pipeline_4 },
+	{ "pipeline_16", 50,     bench_pipeline_16 },
+	{ "prompt",      200000, bench_prompt },
+	{ "jobs",        500,    bench_jobs },
+	{ "complete",    20000,  bench_complete },
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+#define USAGE "usage: tinyshell-bench [-s scale] [name...]"
+
+/* ------------------------------------------------------------------------- */
+/*                                   Main                                    */
+/* ------------------------------------------------------------------------- */
+
+static int
+selected(const char *name, int argc, char *argv[])
+{
+	if (argc == 0)
+		return 1;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], name))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+known(const char *name)
+{
+	for (size_t i = 0; i < NUM_BENCHES; i++) {
+		if (!strcmp(benches[i].name, name))
+			return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int first = 1;
+	int failed = 0;
+	char *end;
+
+	error_set_name(argv[0]);
+	pipeline_zygote_helper(argc, argv);
+
+	if (argc > 2 && !strcmp(argv[1], "-s")) {
+		errno = 0;
+		scale = strtol(argv[2], &end, 10);
+		if (errno || end == argv[2] || *end || scale <= 0) {
+			error_print(NULL, USAGE, 0);
+			return 2;
+		}
+		first = 3;
+	}
+
+	/* a misspelt name would otherwise run nothing and still succeed */
+	for (int i = first; i < argc; i++) {
+		if (!known(argv[i])) {
+			char msg[64];
+
+			snprintf(msg, sizeof(msg), "%.40s: no such benchmark", argv[i]);
+			error_print(NULL, msg, 0);
+			error_print(NULL, USAGE, 0);
+			return 2;
+		}
+	}
+
+	/* The prompt needs these; keep runs reproducible under env -i. */
+	setenv("USER", "bench", 0);
+	setenv("HOME", "/", 0);
+
+	if (signal_setup(0))
+		return 1;
+
+	printf("name\titerations\ttotal_ns\tns_per_op\tops_per_sec\n");
+
+	for (size_t i = 0; i < NUM_BENCHES; i++) {
+		if (!selected(benches[i].name, argc - first, argv + first))
+			continue;
+
+		if (benches[i].run(benches[i].iterations * scale)) {
+			error_print(benches[i].name, "benchmark failed", 0);
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file arena.c
+ * @brief Implementation of the bump-pointer arena allocator.
+ *
+ * An arena is a chain of blocks, newest first. Allocations are carved
+ * from the newest block; when it runs out, a new block at least twice
+ * as large is pushed onto the chain. Resetting keeps only one block,
+ * sized to everything the arena held, so steady-state use settles on
+ * a single block and stops calling malloc() altogether.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_MIN 8192
+
+/* Strictest alignment needed by any object we allocate. */
+typedef union {
+	long double ld;
+	long long ll;
+	void *p;
+	void (*fp)(void);
+} arena_align_t;
+
+#define ARENA_ALIGN sizeof(arena_align_t)
+
+typedef struct arena_block arena_block;
+struct arena_block {
+	arena_block *next;
+	size_t size;               /* usable bytes in data[] */
+	size_t used;
+	arena_align_t data[];      /* flexible array, aligned for any type */
+};
+
+struct Arena {
+	arena_block *head;         /* block currently allocated from */
+	size_t capacity;           /* sum of all block sizes */
+};
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+static arena_block*
+arena_block_new(size_t size)
+{
+	arena_block *b;
+
+	b = malloc(sizeof(*b) + size);
+	if (!b)
+		return NULL;
+
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+static void
+arena_free_blocks(arena_block *b)
+{
+	while (b) {
+		arena_block *next = b->next;
+		free(b);
+		b = next;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Create an empty arena.
+ */
+Arena*
+arena_create(void)
+{
+	Arena *a;
+
+	a = malloc(sizeof(*a));
+	if (!a)
+		return NULL;
+
+	a->head = NULL;
+	a->capacity = 0;
+	return a;
+}
+
+/**
+ * @brief Allocate memory from an arena.
+ */
+void*
+arena_alloc(Arena *a, size_t size)
+{
+	arena_block *b = a->head;
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+	if (!b || b->size - b->used < size) {
+		size_t bsize = b ? b->size * 2 : ARENA_BLOCK_MIN;
+
+		while (bsize < size)
+			bsize *= 2;
+
+		b = arena_block_new(bsize);
+		if (!b)
+			return NULL;
+
+		b->next = a->head;
+		a->head = b;
+		a->capacity += bsize;
+	}
+
+	ptr = (char *)b->data + b->used;
+	b->used += size;
+	return ptr;
+}
+
+/**
+ * @brief Duplicate a string into an arena.
+ */
+char*
+arena_strdup(Arena *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *copy;
+
+	copy = arena_alloc(a, len);
+	if (copy)
+		memcpy(copy, s, len);
+	return copy;
+}
+
+/**
+ * @brief Release every allocation made from an arena.
+ */
+void
+arena_reset(Arena *a)
+{
+	arena_block *merged;
+
+	if (!a->head)
+		return;
+
+	/* Common case: a single block, just rewind it. */
+	if (!a->head->next) {
+		a->head->used = 0;
+		return;
+	}
+
+	/* Merge the chain into one block big enough for the whole cycle. */
+	merged = arena_block_new(a->capacity);
+	if (!merged) {
+		/* Keep the newest (largest) block and drop the rest. */
+		arena_free_blocks(a->head->next);
+		a->head->next = NULL;
+		a->head->used = 0;
+		a->capacity = a->head->size;
+		return;
+	}
+
+	arena_free_blocks(a->head);
+	a->head = merged;
+}
+
+/**
+ * @brief Free an arena and all of its blocks.
+ */
+void
+arena_destroy(Arena *a)
+{
+	if (!a)
+		return;
+
+	arena_free_blocks(a->head);
+	free(a);
+}
@@ -0,0 +1,65 @@
+/**
+ * @file arena.h
+ * @brief Bump-pointer arena allocator.
+ *
+ * An arena hands out memory by advancing a pointer through large
+ * blocks and releases everything at once with arena_reset(). Used by
+ * the parser so that a whole Command tree is freed in a single step.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct Arena Arena;
+
+/**
+ * @brief Create an empty arena.
+ *
+ * No block is allocated until the first arena_alloc().
+ *
+ * @return  New arena, or NULL on allocation failure.
+ */
+Arena *arena_create(void);
+
+/**
+ * @brief Allocate memory from an arena.
+ *
+ * The returned memory is suitably aligned for any object type and stays
+ * valid until the next arena_reset() or arena_destroy().
+ *
+ * @param a     Arena to allocate from.
+ * @param size  Number of bytes.
+ * @return      Pointer to the memory, or NULL on allocation failure.
+ */
+void *arena_alloc(Arena *a, size_t size);
+
+/**
+ * @brief Duplicate a string into an arena.
+ *
+ * @param a  Arena to allocate from.
+ * @param s  Null-terminated string.
+ * @return   Copy of s, or NULL on allocation failure.
+ */
+char *arena_strdup(Arena *a, const char *s);
+
+/**
+ * @brief Release every allocation made from an arena.
+ *
+ * The memory is kept for reuse. If the previous cycle needed more than
+ * one block, they are merged into a single block of the combined size
+ * so that the next cycle of the same size does not allocate.
+ *
+ * @param a  Arena to reset.
+ */
+void arena_reset(Arena *a);
+
+/**
+ * @brief Free an arena and all of its blocks.
+ *
+ * @param a  Arena to destroy (may be NULL).
+ */
+void arena_destroy(Arena *a);
+
+#endif /* ARENA_H */
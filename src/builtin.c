@@ -3,10 +3,20 @@
  * @brief Implementation of shell builtin commands.
  *
  * Builtins are commands that affect shell state and cannot be
- * executed as external processes. Currently implements:
+ * executed as external processes, plus in-process versions of hot
+ * utilities (coreutils.c). Currently implements:
  *
  *   cd <dir>   - Change working directory
  *   exit <n>   - Exit the shell with optional status
+ *   hash       - Inspect or reset the command path cache
+ *   set        - Inspect or change shell options
+ *   export     - Set environment variables
+ *   unset      - Remove environment variables
+ *   enable     - Turn builtins on and off
+ *   echo, printf, pwd, true, false, test, [, cat, tee
+ *
+ * All of them, plus jobs/fg/bg from pipeline.c, are dispatched through
+ * one sorted table that also tells the executor how each may be run.
  *
  * Return conventions for builtin_exec():
  *   -1  Error during builtin execution
@@ -26,8 +36,15 @@
 #include <sys/stat.h>
 
 #include "builtin.h"
+#include "coreutils.h"
 #include "error.h"
+#include "history.h"
+#include "options.h"
+#include "pathcache.h"
+#include "pipeline.h"
+#include "prompt.h"
 
+extern char **environ;
 extern int exit_code;
 
 /**
@@ -172,6 +189,10 @@ builtin_cd(Command *cmd)
 		return -1;
 	}
 
+	/* entries found through relative PATH elements are now stale */
+	pathcache_chdir();
+	prompt_set_cwd(cwd);
+
 	exit_code = 0;
 	return 0;
 }
@@ -222,6 +243,469 @@ builtin_exit(Command *cmd)
 	return -1;
 }
 
+/**
+ * @brief Handle the builtin `hash` command.
+ *
+ * Behavior:
+ *   hash             -> list cached command paths with hit counts
+ *   hash -r          -> forget all cached paths
+ *   hash -d <name>   -> forget the cached path of name
+ *   hash <name>...   -> resolve and cache each name
+ *
+ * Options combine, and -r applies before the names: `hash -r ls`
+ * forgets everything, then caches ls.
+ *
+ * @param cmd  Command structure with argv and argc.
+ * @return     0 on success, -1 on failure.
+ */
+static int
+builtin_hash(Command *cmd)
+{
+	char path[PATH_MAX];
+	int clear = 0;
+	int forget = 0;
+	int ret = 0;
+	int i = 1;
+
+	for (; i < cmd->argc && cmd->argv[i][0] == '-' && cmd->argv[i][1]; i++) {
+		const char *flag = cmd->argv[i];
+
+		if (!strcmp(flag, "--")) {
+			i++;
+			break;
+		}
+		for (int k = 1; flag[k]; k++) {
+			if (flag[k] == 'r') {
+				clear = 1;
+			} else if (flag[k] == 'd') {
+				forget = 1;
+			} else {
+				error_print("hash", flag, EINVAL);
+				exit_code = 2;
+				return -1;
+			}
+		}
+	}
+
+	if (forget && i == cmd->argc) {
+		error_print("hash", "-d: option requires an argument", 0);
+		exit_code = 1;
+		return -1;
+	}
+
+	if (clear)
+		pathcache_clear();
+	else if (i == cmd->argc && !pathcache_print())
+		printf("hash: hash table empty\n");
+
+	for (; i < cmd->argc; i++) {
+		if (forget) {
+			if (pathcache_remove(cmd->argv[i])) {
+				error_print("hash", cmd->argv[i], ENOENT);
+				ret = -1;
+			}
+			continue;
+		}
+		if (builtin_is(cmd->argv[i]))
+			continue;
+		if (pathcache_lookup(cmd->argv[i], path)) {
+			error_print("hash", cmd->argv[i], ENOENT);
+			ret = -1;
+		}
+	}
+
+	exit_code = ret ? 1 : 0;
+	return ret;
+}
+
+/**
+ * @brief Handle the builtin `set` command.
+ *
+ * Behavior:
+ *   set -o          -> list options and their state
+ *   set -o <name>   -> enable option
+ *   set +o <name>   -> disable option
+ *   set -b / set +b -> same as set -o notify / set +o notify
+ *
+ * @param cmd  Command structure with argv and argc.
+ * @return     0 on success, -1 on failure.
+ */
+static int
+builtin_set(Command *cmd)
+{
+	int ret = 0;
+	int i = 1;
+
+	if (cmd->argc == 1) {
+		options_print();
+		exit_code = 0;
+		return 0;
+	}
+
+	while (i < cmd->argc) {
+		const char *flag = cmd->argv[i];
+		int on;
+
+		if (!strcmp(flag, "-b") || !strcmp(flag, "+b")) {
+			if (options_set("notify", flag[0] == '-'))
+				ret = -1;
+			i++;
+			continue;
+		}
+
+		if (!strcmp(flag, "-o"))
+			on = 1;
+		else if (!strcmp(flag, "+o"))
+			on = 0;
+		else {
+			error_print("set", flag, EINVAL);
+			exit_code = 2;
+			return -1;
+		}
+
+		if (++i >= cmd->argc) {
+			options_print();
+			break;
+		}
+
+		if (options_set(cmd->argv[i++], on))
+			ret = -1;
+	}
+
+	exit_code = ret ? 1 : 0;
+	return ret;
+}
+
+/**
+ * @brief Check that a string is a valid environment variable name.
+ *
+ * @param s    Candidate name.
+ * @param len  Number of characters of s to check.
+ * @return     1 if valid, 0 otherwise.
+ */
+static int
+valid_name(const char *s, size_t len)
+{
+	if (!len || !(s[0] == '_' || (s[0] >= 'A' && s[0] <= 'Z') ||
+	              (s[0] >= 'a' && s[0] <= 'z')))
+		return 0;
+
+	for (size_t i = 1; i < len; i++) {
+		char c = s[i];
+		if (!(c == '_' || (c >= 'A' && c <= 'Z') ||
+		      (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Invalidate caches that depend on an environment variable.
+ *
+ * PATH needs no hook: the command hash table compares $PATH itself.
+ *
+ * @param name  Name of the variable that changed.
+ * @param len   Length of the name.
+ */
+static void
+env_changed(const char *name, size_t len)
+{
+	if (len == 4 && (!strncmp(name, "HOME", 4) || !strncmp(name, "USER", 4)))
+		prompt_invalidate();
+}
+
+/**
+ * @brief Handle the builtin `export` command.
+ *
+ * Behavior:
+ *   export                -> list the environment
+ *   export NAME=value...  -> set variables in the environment
+ *   export NAME...        -> accepted; every variable is already exported
+ *
+ * @param cmd  Command structure with argv and argc.
+ * @return     0 on success, -1 on failure.
+ */
+static int
+builtin_export(Command *cmd)
+{
+	int ret = 0;
+
+	if (cmd->argc == 1) {
+		for (char **e = environ; *e; e++)
+			printf("export %s\n", *e);
+		exit_code = 0;
+		return 0;
+	}
+
+	for (int i = 1; i < cmd->argc; i++) {
+		char *arg = cmd->argv[i];
+		char *eq = strchr(arg, '=');
+		size_t len = eq ? (size_t)(eq - arg) : strlen(arg);
+
+		if (!valid_name(arg, len)) {
+			error_print("export", "not a valid identifier", 0);
+			ret = -1;
+			continue;
+		}
+
+		if (!eq)
+			continue;
+
+		*eq = '\0';
+		if (setenv(arg, eq + 1, 1)) {
+			error_print("export", arg, errno);
+			ret = -1;
+		} else {
+			env_changed(arg, len);
+		}
+		*eq = '=';
+	}
+
+	exit_code = ret ? 1 : 0;
+	return ret;
+}
+
+/**
+ * @brief Handle the builtin `unset` command.
+ *
+ * Behavior:
+ *   unset NAME...   -> remove variables from the environment
+ *
+ * @param cmd  Command structure with argv and argc.
+ * @return     0 on success, -1 on failure.
+ */
+static int
+builtin_unset(Command *cmd)
+{
+	int ret = 0;
+
+	for (int i = 1; i < cmd->argc; i++) {
+		const char *name = cmd->argv[i];
+		size_t len = strlen(name);
+
+		if (!valid_name(name, len)) {
+			error_print("unset", "not a valid identifier", 0);
+			ret = -1;
+			continue;
+		}
+
+		if (unsetenv(name)) {
+			error_print("unset", name, errno);
+			ret = -1;
+			continue;
+		}
+		env_changed(name, len);
+	}
+
+	exit_code = ret ? 1 : 0;
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Builtin Table                                */
+/* ------------------------------------------------------------------------- */
+
+static int builtin_enable(Command *cmd);
+
+/* Entry flags beyond the public BUILTIN_* classification bits. */
+#define BUILTIN_LISTING 0x100  /* forkless in its listing form only */
+
+typedef struct {
+	const char *name;
+	int (*handler)(Command *cmd);
+	unsigned int flags;
+	int (*supports)(const Command *cmd); /* NULL: every invocation */
+	int enabled;             /* cleared by `enable -n name` */
+} builtin_entry;
+
+/*
+ * The registry. Keep it sorted by name in strcmp() order: lookups are a
+ * binary search.
+ */
+static builtin_entry builtins[] = {
+	{ "[",      builtin_test,   BUILTIN_FORKLESS,                  NULL, 1 },
+	{ "bg",     builtin_bg,     BUILTIN_PARENT,                    NULL, 1 },
+	{ "cat",    builtin_cat,    BUILTIN_FORKLESS | BUILTIN_READS_STDIN,
+	                            builtin_cat_supports,                    1 },
+	{ "cd",     builtin_cd,     BUILTIN_PARENT,                    NULL, 1 },
+	{ "echo",   builtin_echo,   BUILTIN_FORKLESS,                  NULL, 1 },
+	{ "enable", builtin_enable, BUILTIN_PARENT,                    NULL, 1 },
+	{ "exit",   builtin_exit,   BUILTIN_PARENT,                    NULL, 1 },
+	{ "export", builtin_export, BUILTIN_PARENT | BUILTIN_LISTING,  NULL, 1 },
+	{ "false",  builtin_false,  BUILTIN_FORKLESS,                  NULL, 1 },
+	{ "fg",     builtin_fg,     BUILTIN_PARENT,                    NULL, 1 },
+	{ "hash",   builtin_hash,   BUILTIN_PARENT | BUILTIN_LISTING,  NULL, 1 },
+	{ "history", builtin_history, BUILTIN_FORKLESS,                NULL, 1 },
+	{ "jobs",   builtin_jobs,   BUILTIN_PARENT | BUILTIN_FORKLESS, NULL, 1 },
+	{ "parallel", builtin_parallel, BUILTIN_READS_STDIN,           NULL, 1 },
+	{ "printf", builtin_printf, BUILTIN_FORKLESS,                  NULL, 1 },
+	{ "pwd",    builtin_pwd,    BUILTIN_FORKLESS,                  NULL, 1 },
+	{ "set",    builtin_set,    BUILTIN_PARENT | BUILTIN_LISTING,  NULL, 1 },
+	{ "tee",    builtin_tee,    BUILTIN_FORKLESS | BUILTIN_READS_STDIN,
+	                            builtin_tee_supports,                    1 },
+	{ "test",   builtin_test,   BUILTIN_FORKLESS,                  NULL, 1 },
+	{ "true",   builtin_true,   BUILTIN_FORKLESS,                  NULL, 1 },
+	{ "unset",  builtin_unset,  BUILTIN_PARENT,                    NULL, 1 },
+	{ "wait",   builtin_wait,   BUILTIN_PARENT,                    NULL, 1 },
+};
+
+#define NUM_BUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+/**
+ * @brief Find a builtin by name, enabled or not.
+ */
+static builtin_entry*
+builtin_find(const char *name)
+{
+	size_t lo = 0;
+	size_t hi = NUM_BUILTINS;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(name, builtins[mid].name);
+
+		if (!cmp)
+			return &builtins[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Find the builtin that runs a command.
+ *
+ * NULL if there is none, it is disabled, or the invocation uses
+ * options only the external utility of the same name understands.
+ */
+static builtin_entry*
+builtin_for(const Command *cmd)
+{
+	builtin_entry *b = builtin_find(cmd->argv[0]);
+
+	if (!b || !b->enabled || (b->supports && !b->supports(cmd)))
+		return NULL;
+	return b;
+}
+
+/**
+ * @brief Handle the builtin `enable` command.
+ *
+ * Behavior:
+ *   enable              -> list enabled builtins
+ *   enable -n           -> list disabled builtins
+ *   enable <name>...    -> enable builtins
+ *   enable -n <name>... -> disable builtins; the names are then looked
+ *                          up in PATH like any other command
+ *
+ * @param cmd  Command structure with argv and argc.
+ * @return     0 on success, -1 on failure.
+ */
+static int
+builtin_enable(Command *cmd)
+{
+	int on = 1;
+	int ret = 0;
+	int i = 1;
+
+	if (i < cmd->argc && !strcmp(cmd->argv[i], "-n")) {
+		on = 0;
+		i++;
+	}
+
+	if (i == cmd->argc) {
+		for (size_t k = 0; k < NUM_BUILTINS; k++) {
+			if (builtins[k].enabled == on)
+				printf("enable %s%s\n", on ? "" : "-n ", builtins[k].name);
+		}
+		exit_code = 0;
+		return 0;
+	}
+
+	for (; i < cmd->argc; i++) {
+		builtin_entry *b = builtin_find(cmd->argv[i]);
+
+		if (!b) {
+			char msg[256];
+
+			snprintf(msg, sizeof(msg), "%s: not a shell builtin", cmd->argv[i]);
+			error_print("enable", msg, 0);
+			ret = -1;
+			continue;
+		}
+		b->enabled = on;
+	}
+
+	exit_code = ret ? 1 : 0;
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Report the enabled builtins whose names start with prefix.
+ */
+void
+builtin_complete(const char *prefix, pathcache_name_fn fn, void *arg)
+{
+	size_t plen = strlen(prefix);
+
+	for (size_t k = 0; k < NUM_BUILTINS; k++) {
+		if (builtins[k].enabled && !strncmp(builtins[k].name, prefix, plen))
+			fn(builtins[k].name, arg);
+	}
+}
+
+/**
+ * Check whether a name refers to an enabled builtin handled by
+ * builtin_exec().
+ *
+ * @param name  Command name.
+ * @return      1 if name is a builtin, 0 otherwise.
+ */
+int
+builtin_is(const char *name)
+{
+	builtin_entry *b = builtin_find(name);
+
+	return b && b->enabled;
+}
+
+/**
+ * Classify a command for the executor: whether it is a builtin, whether
+ * it must run in the shell and whether it may run there as a pipeline
+ * stage. Builtins marked BUILTIN_LISTING are forkless only in the forms
+ * that print and leave shell state alone.
+ *
+ * @param cmd  Command or pipeline stage.
+ * @return     BUILTIN_* flags, 0 if not an enabled builtin.
+ */
+unsigned int
+builtin_classify(const Command *cmd)
+{
+	builtin_entry *b = builtin_for(cmd);
+	unsigned int flags;
+
+	if (!b)
+		return 0;
+
+	flags = BUILTIN_FOUND | (b->flags & (BUILTIN_PARENT | BUILTIN_FORKLESS |
+	                                     BUILTIN_READS_STDIN));
+
+	/* listing forms of state-changing builtins */
+	if ((b->flags & BUILTIN_LISTING) &&
+	    (cmd->argc == 1 ||
+	     (!strcmp(b->name, "set") && cmd->argc == 2 &&
+	      !strcmp(cmd->argv[1], "-o"))))
+		flags |= BUILTIN_FORKLESS;
+
+	return flags;
+}
+
 /**
  * Execute a builtin command if applicable.
  *
@@ -233,11 +717,10 @@ builtin_exit(Command *cmd)
 int
 builtin_exec(Command *cmd)
 {
-	if (!strcmp(cmd->argv[0], "exit"))
-		return builtin_exit(cmd);
+	builtin_entry *b = builtin_for(cmd);
 
-	if (!strcmp(cmd->argv[0], "cd"))
-		return builtin_cd(cmd);
+	if (!b)
+		return 1;
 
-	return 1;
+	return b->handler(cmd);
 }
@@ -2,14 +2,23 @@
  * @file builtin.h
  * @brief Interface for shell builtin commands.
  *
- * Provides execution of builtin commands (cd, exit) that must run
- * in the shell process rather than forked children.
+ * Every builtin, including the job control ones in pipeline.c, is
+ * registered in a single table in builtin.c. Each entry records how the
+ * builtin may be run, so the executor can classify a pipeline stage
+ * with one lookup and pick an execution strategy from the flags.
  */
 
 #ifndef BUILTIN_H
 #define BUILTIN_H
 
 #include "parser.h"
+#include "pathcache.h"
+
+/* Classification flags returned by builtin_classify(). */
+#define BUILTIN_FOUND       0x1  /* an enabled builtin */
+#define BUILTIN_PARENT      0x2  /* changes shell state: runs in the shell alone */
+#define BUILTIN_FORKLESS    0x4  /* may run in the shell as a pipeline stage */
+#define BUILTIN_READS_STDIN 0x8  /* consumes stdin (cat, tee) */
 
 /**
  * @brief Execute a builtin command if applicable.
@@ -26,4 +35,41 @@
  */
 int builtin_exec(Command *cmd);
 
+/**
+ * @brief Check whether a name refers to a builtin.
+ *
+ * Used by the executor to skip the PATH lookup for builtins.
+ *
+ * @param name  Command name (argv[0]).
+ * @return      1 if name is a builtin, 0 otherwise.
+ */
+int builtin_is(const char *name);
+
+/**
+ * @brief Report the enabled builtins whose names start with prefix.
+ *
+ * Used by command completion, alongside pathcache_complete().
+ *
+ * @param prefix  Start of the names.
+ * @param fn      Called with each name, in sorted order.
+ * @param arg     Passed to fn.
+ */
+void builtin_complete(const char *prefix, pathcache_name_fn fn, void *arg);
+
+/**
+ * @brief Classify a command for the executor.
+ *
+ * BUILTIN_FORKLESS is set for invocations that leave shell state alone
+ * (echo, cat, `hash`, `set -o`, `export` without arguments, ...).
+ * Pipeline stages are separate processes, so anything that changes
+ * shell state must still run in a child there. BUILTIN_READS_STDIN
+ * stages additionally need their input to come from somewhere that is
+ * already running.
+ *
+ * @param cmd  Command or pipeline stage.
+ * @return     BUILTIN_* flags, 0 if cmd is not an enabled builtin (or
+ *             uses options only the external utility supports).
+ */
+unsigned int builtin_classify(const Command *cmd);
+
 #endif /* BUILTIN_H */
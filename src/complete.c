@@ -0,0 +1,252 @@
+/**
+ * @file complete.c
+ * @brief Command and file name completion.
+ *
+ * The line is scanned up to the cursor with the parser's quoting rules
+ * to find the word being completed and whether it is in command
+ * position. Candidates are gathered into an arena and sorted once; the
+ * caller works out the common prefix and what to insert.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "builtin.h"
+#include "error.h"
+#include "pathcache.h"
+
+/* Characters that end a word outside quotes */
+#define WORD_BREAKS " \t|<>&"
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Add the candidate head + name + tail.
+ */
+static int
+add_match(completion *c, const char *head, size_t hlen, const char *name,
+          const char *tail)
+{
+	size_t nlen = strlen(name);
+	size_t tlen = strlen(tail);
+	char *s;
+
+	if (c->nmatches == c->cap) {
+		size_t ncap = c->cap ? c->cap * 2 : 64;
+		char **nm = realloc(c->matches, ncap * sizeof(*nm));
+
+		if (!nm) {
+			error_print("complete", "realloc", errno);
+			return -1;
+		}
+		c->matches = nm;
+		c->cap = ncap;
+	}
+
+	s = arena_alloc(c->arena, hlen + nlen + tlen + 1);
+	if (!s) {
+		error_print("complete", "malloc", errno);
+		return -1;
+	}
+	memcpy(s, head, hlen);
+	memcpy(s + hlen, name, nlen);
+	memcpy(s + hlen + nlen, tail, tlen + 1);
+
+	c->matches[c->nmatches++] = s;
+	return 0;
+}
+
+/* pathcache_name_fn for commands */
+static void
+add_command(const char *name, void *arg)
+{
+	add_match(arg, "", 0, name, "");
+}
+
+static int
+match_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Sort the candidates and drop duplicates.
+ */
+static void
+sort_matches(completion *c)
+{
+	size_t n = 0;
+
+	if (!c->nmatches)
+		return;
+
+	qsort(c->matches, c->nmatches, sizeof(*c->matches), match_cmp);
+	for (size_t i = 1; i < c->nmatches; i++) {
+		if (strcmp(c->matches[i], c->matches[n]))
+			c->matches[++n] = c->matches[i];
+	}
+	c->nmatches = n + 1;
+}
+
+/**
+ * @brief Complete a file name.
+ *
+ * The directory part of the word is kept as typed; a leading "~/" is
+ * read from $HOME.
+ */
+static int
+complete_file(completion *c)
+{
+	const char *word = c->word;
+	const char *slash = strrchr(word, '/');
+	const char *base = slash ? slash + 1 : word;
+	size_t hlen = (size_t)(base - word);
+	size_t blen = strlen(base);
+	char *dir;
+	DIR *dp;
+	struct dirent *de;
+	int ret = 0;
+
+	if (!slash) {
+		dir = arena_strdup(c->arena, ".");
+	} else if (word[0] == '~' && word[1] == '/') {
+		const char *home = getenv("HOME");
+		size_t len;
+
+		if (!home)
+			return 0;
+		len = strlen(home);
+		dir = arena_alloc(c->arena, len + hlen);
+		if (dir) {
+			memcpy(dir, home, len);
+			memcpy(dir + len, word + 1, hlen - 1);
+			dir[len + hlen - 1] = '\0';
+		}
+	} else {
+		dir = arena_alloc(c->arena, hlen + 1);
+		if (dir) {
+			memcpy(dir, word, hlen);
+			dir[hlen] = '\0';
+		}
+	}
+	if (!dir) {
+		error_print(__func__, "malloc", errno);
+		return -1;
+	}
+
+	dp = opendir(dir);
+	if (!dp)
+		return 0;
+
+	while (!ret && (de = readdir(dp))) {
+		struct stat st;
+		const char *name = de->d_name;
+
+		if (strncmp(name, base, blen))
+			continue;
+		if (name[0] == '.' && (base[0] != '.' || !name[1] ||
+		                       (name[1] == '.' && !name[2])))
+			continue;
+
+		ret = add_match(c, word, hlen, name,
+		                !fstatat(dirfd(dp), name, &st, 0) && S_ISDIR(st.st_mode) ? "/" : "");
+	}
+	closedir(dp);
+
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Collect the completions of the word that ends at the cursor.
+ */
+int
+complete_word(const char *line, size_t pos, completion *c)
+{
+	char *w;
+	size_t wlen = 0;
+	int words = 0;           /* words before this one in the stage */
+	int redirect = 0;        /* the word is the target of < or > */
+	int quoted = 0;          /* the word so far had quotes */
+	char quote = 0;
+
+	memset(c, 0, sizeof(*c));
+	c->arena = arena_create();
+	w = c->arena ? arena_alloc(c->arena, pos + 1) : NULL;
+	if (!w) {
+		error_print(__func__, "malloc", errno);
+		complete_free(c);
+		return -1;
+	}
+
+	for (size_t i = 0; i < pos; i++) {
+		char ch = line[i];
+
+		if (!quote && strchr(WORD_BREAKS, ch)) {
+			if (wlen || quoted) {
+				/* `time` is a reserved word ahead of the command */
+				int reserved = !quoted && !words && wlen == 4 && !memcmp(w, "time", 4);
+
+				if (!redirect && !reserved)
+					words++;
+				redirect = 0;
+			}
+			if (ch == '|')
+				words = redirect = 0;
+			else if (ch == '<' || ch == '>')
+				redirect = 1;
+			wlen = 0;
+			quoted = 0;
+			c->start = i + 1;
+			continue;
+		}
+
+		if (ch == quote) {
+			quote = 0;
+		} else if (!quote && (ch == '\'' || ch == '"')) {
+			quote = ch;
+			quoted = 1;
+		} else if (ch == '\\' && quote != '\'' && i + 1 < pos) {
+			w[wlen++] = line[++i];
+		} else {
+			w[wlen++] = ch;
+		}
+	}
+	w[wlen] = '\0';
+	c->word = w;
+	c->quote = quote;
+
+	if (!words && !redirect && !strchr(w, '/')) {
+		builtin_complete(w, add_command, c);
+		pathcache_complete(w, add_command, c);
+	} else if (complete_file(c)) {
+		complete_free(c);
+		return -1;
+	}
+
+	sort_matches(c);
+	return 0;
+}
+
+/**
+ * Release the candidates.
+ */
+void
+complete_free(completion *c)
+{
+	free(c->matches);
+	arena_destroy(c->arena);
+	memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,49 @@
+/**
+ * @file complete.h
+ * @brief Command and file name completion for the line editor.
+ *
+ * The word before the cursor is completed as a command when it is the
+ * first word of a pipeline stage (builtins and the executables of the
+ * $PATH index in pathcache.c), and as a file name otherwise or when it
+ * contains a '/'.
+ */
+
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+/*
+ * Candidates for the word before the cursor.
+ */
+typedef struct {
+	size_t start;            /* offset of the word in the line */
+	char *word;              /* the word, quotes and backslashes removed */
+	char quote;              /* quote left open before the cursor, or 0 */
+	char **matches;          /* full words, sorted, without duplicates;
+	                            directories end with '/' */
+	size_t nmatches;
+	size_t cap;
+	Arena *arena;
+} completion;
+
+/**
+ * @brief Collect the completions of the word that ends at the cursor.
+ *
+ * @param line  The line being edited.
+ * @param pos   Cursor offset in line.
+ * @param c     Output: the candidates; release with complete_free().
+ * @return      0 on success, -1 on allocation failure.
+ */
+int complete_word(const char *line, size_t pos, completion *c);
+
+/**
+ * @brief Release the candidates.
+ *
+ * @param c  Result of complete_word().
+ */
+void complete_free(completion *c);
+
+#endif /* COMPLETE_H */
@@ -0,0 +1,1133 @@
+/**
+ * @file coreutils.c
+ * @brief In-process echo, printf, pwd, true, false, test, cat and tee.
+ *
+ * Output goes through stdio and is flushed before returning, so a write
+ * error (e.g. EPIPE from a reader that quit) is reported by the builtin
+ * and reflected in its exit status, as with the external utilities.
+ * cat and tee bypass stdio and move data in the kernel (datamove.c).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "coreutils.h"
+#include "datamove.h"
+#include "error.h"
+
+extern int exit_code;
+
+/* Escape letters and the characters they stand for. */
+static const char escape_map[] = "a\ab\bf\fn\nr\rt\tv\v\\\\";
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Report "util: arg: msg".
+ */
+static void
+arg_error(const char *util, const char *arg, const char *msg)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf), "%s: %s", arg, msg);
+	error_print(util, buf, 0);
+}
+
+/**
+ * @brief Flush stdout and turn a write error into a failure status.
+ *
+ * @param util  Name of the utility, for the error message.
+ * @return      0 on success, -1 if the output could not be written.
+ */
+static int
+finish_output(const char *util)
+{
+	if (fflush(stdout) == 0 && !ferror(stdout))
+		return 0;
+
+	error_print(util, "write error", errno);
+	clearerr(stdout);
+	exit_code = 1;
+	return -1;
+}
+
+/**
+ * @brief Decode the escape sequence that follows a backslash.
+ *
+ * @param s           Characters after the backslash.
+ * @param zero_octal  Octal escapes are \0nnn (echo, %b) instead of \nnn
+ *                    (printf format strings).
+ * @param c           Output: the character, or -1 for \c (stop output).
+ * @return            Number of characters of s consumed. 0 means the
+ *                    sequence is unknown and *c is the backslash itself.
+ */
+static size_t
+escape_char(const char *s, int zero_octal, int *c)
+{
+	if (*s == 'c') {
+		*c = -1;
+		return 1;
+	}
+
+	for (const char *p = escape_map; *s && *p; p += 2) {
+		if (*p == *s) {
+			*c = (unsigned char)p[1];
+			return 1;
+		}
+	}
+
+	if (zero_octal ? *s == '0' : (*s >= '0' && *s <= '7')) {
+		size_t i = zero_octal ? 1 : 0;
+		int v = 0;
+
+		for (int n = 0; n < 3 && s[i] >= '0' && s[i] <= '7'; n++, i++)
+			v = v * 8 + (s[i] - '0');
+
+		*c = v & 0xff;
+		return i;
+	}
+
+	*c = '\\';
+	return 0;
+}
+
+/**
+ * @brief Expand the escapes of s into dst (at least strlen(s) + 1 bytes).
+ *
+ * @param stop  Set to 1 if a \c was found; the rest of s is dropped.
+ * @return      Number of bytes stored (dst may contain NUL bytes).
+ */
+static size_t
+unescape(const char *s, char *dst, int *stop)
+{
+	size_t len = 0;
+	int c;
+
+	while (*s) {
+		if (*s != '\\') {
+			dst[len++] = *s++;
+			continue;
+		}
+
+		s++;
+		s += escape_char(s, 1, &c);
+		if (c == -1) {
+			*stop = 1;
+			break;
+		}
+		dst[len++] = (char)c;
+	}
+
+	dst[len] = '\0';
+	return len;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                                   printf                                  */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+	char **args;
+	int nargs;
+	int next;      /* index of the next unused argument */
+	int stop;      /* \c seen: stop all output */
+	int error;     /* an argument was not a valid number */
+} printf_state;
+
+static const char*
+printf_arg(printf_state *st)
+{
+	return st->next < st->nargs ? st->args[st->next++] : NULL;
+}
+
+/* Characters may be given as 'c or "c, as in POSIX printf. */
+static int
+printf_char_const(const char *s, double *v)
+{
+	if (s[0] != '\'' && s[0] != '"')
+		return 0;
+
+	*v = (unsigned char)s[1];
+	return 1;
+}
+
+static long long
+printf_int(printf_state *st, const char *s)
+{
+	char *end;
+	double cv;
+	long long v;
+
+	if (!s || !*s)
+		return 0;
+	if (printf_char_const(s, &cv))
+		return (long long)cv;
+
+	errno = 0;
+	v = strtoll(s, &end, 0);
+	if (end == s || *end) {
+		arg_error("printf", s, "invalid number");
+		st->error = 1;
+	} else if (errno == ERANGE) {
+		arg_error("printf", s, strerror(ERANGE));
+		st->error = 1;
+	}
+	return v;
+}
+
+static unsigned long long
+printf_uint(printf_state *st, const char *s)
+{
+	char *end;
+	double cv;
+	unsigned long long v;
+
+	if (!s || !*s)
+		return 0;
+	if (printf_char_const(s, &cv))
+		return (unsigned long long)cv;
+
+	/* negative values wrap around, like the external printf */
+	s += strspn(s, " \t");
+	if (*s == '-')
+		return (unsigned long long)printf_int(st, s);
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (end == s || *end) {
+		arg_error("printf", s, "invalid number");
+		st->error = 1;
+	} else if (errno == ERANGE) {
+		arg_error("printf", s, strerror(ERANGE));
+		st->error = 1;
+	}
+	return v;
+}
+
+static double
+printf_float(printf_state *st, const char *s)
+{
+	char *end;
+	double v;
+
+	if (!s || !*s)
+		return 0;
+	if (printf_char_const(s, &v))
+		return v;
+
+	v = strtod(s, &end);
+	if (end == s || *end) {
+		arg_error("printf", s, "invalid number");
+		st->error = 1;
+	}
+	return v;
+}
+
+/*
+ * Print one %b argument: escapes expanded, then formatted like %s so
+ * width and precision apply.
+ */
+static void
+printf_b(printf_state *st, const char *spec, const char *arg)
+{
+	char *buf;
+
+	buf = malloc(strlen(arg) + 1);
+	if (!buf) {
+		error_print("printf", "malloc", errno);
+		st->error = 1;
+		return;
+	}
+
+	unescape(arg, buf, &st->stop);
+	printf(spec, buf);
+	free(buf);
+}
+
+/*
+ * Read a field width or precision at *p: digits, or '*' taking the value
+ * from the next argument. Returns 0 if there is none.
+ */
+static int
+printf_number(printf_state *st, const char **p, int *value)
+{
+	long v = 0;
+
+	if (**p == '*') {
+		(*p)++;
+		v = (long)printf_int(st, printf_arg(st));
+	} else if (**p >= '0' && **p <= '9') {
+		while (**p >= '0' && **p <= '9') {
+			if (v < INT_MAX / 10)
+				v = v * 10 + (**p - '0');
+			(*p)++;
+		}
+	} else {
+		return 0;
+	}
+
+	if (v > INT_MAX)
+		v = INT_MAX;
+	if (v < INT_MIN + 1)
+		v = INT_MIN + 1;
+	*value = (int)v;
+	return 1;
+}
+
+/*
+ * Print the format once, consuming arguments as conversions need them.
+ * Returns -1 on an invalid conversion.
+ */
+static int
+printf_once(printf_state *st, const char *fmt)
+{
+	const char *p = fmt;
+
+	while (*p && !st->stop) {
+		char spec[48];
+		char flags[8];
+		size_t nflags = 0;
+		int width = -1;
+		int prec = -1;
+		size_t n;
+		int c;
+
+		if (*p == '\\') {
+			p++;
+			p += escape_char(p, 0, &c);
+			if (c == -1)
+				st->stop = 1;
+			else
+				putchar(c);
+			continue;
+		}
+
+		if (*p != '%') {
+			putchar(*p++);
+			continue;
+		}
+
+		if (*++p == '%') {
+			putchar('%');
+			p++;
+			continue;
+		}
+
+		while (*p && strchr("-+ #0", *p)) {
+			if (nflags < sizeof(flags) - 2 && !memchr(flags, *p, nflags))
+				flags[nflags++] = *p;
+			p++;
+		}
+
+		if (printf_number(st, &p, &width) && width < 0) {
+			/* a negative '*' width means left alignment */
+			if (!memchr(flags, '-', nflags))
+				flags[nflags++] = '-';
+			width = -width;
+		}
+		flags[nflags] = '\0';
+
+		if (*p == '.') {
+			p++;
+			/* a negative '*' precision is taken as omitted */
+			if (!printf_number(st, &p, &prec))
+				prec = 0;
+		}
+
+		n = (size_t)snprintf(spec, sizeof(spec), "%%%s", flags);
+		if (width >= 0)
+			n += (size_t)snprintf(spec + n, sizeof(spec) - n, "%d", width);
+		if (prec >= 0)
+			n += (size_t)snprintf(spec + n, sizeof(spec) - n, ".%d", prec);
+
+		c = *p++;
+		switch (c) {
+		case 'd':
+		case 'i':
+			snprintf(spec + n, sizeof(spec) - n, "lld");
+			printf(spec, printf_int(st, printf_arg(st)));
+			break;
+
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			snprintf(spec + n, sizeof(spec) - n, "ll%c", c);
+			printf(spec, printf_uint(st, printf_arg(st)));
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			snprintf(spec + n, sizeof(spec) - n, "%c", c);
+			printf(spec, printf_float(st, printf_arg(st)));
+			break;
+
+		case 'c': {
+			const char *arg = printf_arg(st);
+
+			snprintf(spec + n, sizeof(spec) - n, "c");
+			if (arg && *arg)
+				printf(spec, *arg);
+			break;
+		}
+
+		case 's': {
+			const char *arg = printf_arg(st);
+
+			snprintf(spec + n, sizeof(spec) - n, "s");
+			printf(spec, arg ? arg : "");
+			break;
+		}
+
+		case 'b': {
+			const char *arg = printf_arg(st);
+
+			snprintf(spec + n, sizeof(spec) - n, "s");
+			printf_b(st, spec, arg ? arg : "");
+			break;
+		}
+
+		default: {
+			char conv[3] = { '%', (char)c, '\0' };
+
+			arg_error("printf", c ? conv : "%", "invalid format character");
+			return -1;
+		}
+		}
+	}
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                                    test                                   */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+	char **argv;
+	int argc;
+	int pos;
+	int error;
+	const char *name;   /* "test" or "[" */
+} test_state;
+
+static void
+test_fail(test_state *t, const char *arg, const char *msg)
+{
+	if (t->error)
+		return;
+
+	if (arg)
+		arg_error(t->name, arg, msg);
+	else
+		error_print(t->name, msg, 0);
+	t->error = 1;
+}
+
+static int
+test_is_unary(const char *op)
+{
+	return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghLnprSstuwxz", op[1]);
+}
+
+static int
+test_is_binary(const char *op)
+{
+	static const char *const ops[] = {
+		"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt",
+		"-ge", "-nt", "-ot", "-ef", "-a", "-o", NULL
+	};
+
+	for (int i = 0; ops[i]; i++) {
+		if (!strcmp(op, ops[i]))
+			return 1;
+	}
+	return 0;
+}
+
+static long long
+test_integer(test_state *t, const char *s)
+{
+	char *end;
+	long long v;
+
+	errno = 0;
+	v = strtoll(s, &end, 10);
+	end += strspn(end, " \t");
+	if (end == s || *end || errno)
+		test_fail(t, s, "integer expression expected");
+	return v;
+}
+
+static int
+test_unary(test_state *t, const char *op, const char *arg)
+{
+	struct stat st;
+
+	switch (op[1]) {
+	case 'n':
+		return *arg != '\0';
+	case 'z':
+		return *arg == '\0';
+	case 't':
+		return isatty((int)test_integer(t, arg));
+	case 'h':
+	case 'L':
+		return !lstat(arg, &st) && S_ISLNK(st.st_mode);
+	case 'r':
+		return !faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS);
+	case 'w':
+		return !faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS);
+	case 'x':
+		return !faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS);
+	}
+
+	if (stat(arg, &st))
+		return 0;
+
+	switch (op[1]) {
+	case 'b':
+		return S_ISBLK(st.st_mode);
+	case 'c':
+		return S_ISCHR(st.st_mode);
+	case 'd':
+		return S_ISDIR(st.st_mode);
+	case 'e':
+		return 1;
+	case 'f':
+		return S_ISREG(st.st_mode);
+	case 'g':
+		return (st.st_mode & S_ISGID) != 0;
+	case 'p':
+		return S_ISFIFO(st.st_mode);
+	case 'S':
+		return S_ISSOCK(st.st_mode);
+	case 's':
+		return st.st_size > 0;
+	case 'u':
+		return (st.st_mode & S_ISUID) != 0;
+	}
+	return 0;
+}
+
+/* Compare modification times: <0, 0, >0. A missing file is oldest. */
+static int
+test_mtime_cmp(const char *a, const char *b)
+{
+	struct stat sa, sb;
+	int ea = stat(a, &sa);
+	int eb = stat(b, &sb);
+
+	if (ea || eb)
+		return ea && eb ? 0 : (ea ? -1 : 1);
+	if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec)
+		return sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ? -1 : 1;
+	if (sa.st_mtim.tv_nsec != sb.st_mtim.tv_nsec)
+		return sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+static int
+test_binary(test_state *t, const char *a, const char *op, const char *b)
+{
+	struct stat sa, sb;
+
+	if (!strcmp(op, "=") || !strcmp(op, "=="))
+		return !strcmp(a, b);
+	if (!strcmp(op, "!="))
+		return strcmp(a, b) != 0;
+	if (!strcmp(op, "<"))
+		return strcmp(a, b) < 0;
+	if (!strcmp(op, ">"))
+		return strcmp(a, b) > 0;
+	if (!strcmp(op, "-a"))
+		return *a && *b;
+	if (!strcmp(op, "-o"))
+		return *a || *b;
+	if (!strcmp(op, "-nt"))
+		return !stat(a, &sa) && test_mtime_cmp(a, b) > 0;
+	if (!strcmp(op, "-ot"))
+		return !stat(b, &sb) && test_mtime_cmp(a, b) < 0;
+	if (!strcmp(op, "-ef"))
+		return !stat(a, &sa) && !stat(b, &sb) &&
+		       sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+
+	{
+		long long x = test_integer(t, a);
+		long long y = test_integer(t, b);
+
+		if (!strcmp(op, "-eq"))
+			return x == y;
+		if (!strcmp(op, "-ne"))
+			return x != y;
+		if (!strcmp(op, "-lt"))
+			return x < y;
+		if (!strcmp(op, "-le"))
+			return x <= y;
+		if (!strcmp(op, "-gt"))
+			return x > y;
+		return x >= y;
+	}
+}
+
+/*
+ * Recursive descent for expressions beyond the POSIX argument-count
+ * rules:
+ *   or      := and ( -o and )*
+ *   and     := not ( -a not )*
+ *   not     := ! not | primary
+ *   primary := ( or ) | unary-op arg | arg binary-op arg | arg
+ */
+static int test_or(test_state *t);
+
+static int
+test_primary(test_state *t)
+{
+	char **v = t->argv + t->pos;
+	int left = t->argc - t->pos;
+	int r;
+
+	if (left <= 0) {
+		test_fail(t, NULL, "argument expected");
+		return 0;
+	}
+
+	if (left >= 3 && test_is_binary(v[1]) && strcmp(v[1], "-a") &&
+	    strcmp(v[1], "-o")) {
+		t->pos += 3;
+		return test_binary(t, v[0], v[1], v[2]);
+	}
+
+	if (!strcmp(v[0], "(")) {
+		t->pos++;
+		r = test_or(t);
+		if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")"))
+			test_fail(t, NULL, "')' expected");
+		else
+			t->pos++;
+		return r;
+	}
+
+	if (left >= 2 && test_is_unary(v[0])) {
+		t->pos += 2;
+		return test_unary(t, v[0], v[1]);
+	}
+
+	t->pos++;
+	return *v[0] != '\0';
+}
+
+static int
+test_not(test_state *t)
+{
+	if (t->pos < t->argc && !strcmp(t->argv[t->pos], "!")) {
+		t->pos++;
+		return !test_not(t);
+	}
+	return test_primary(t);
+}
+
+static int
+test_and(test_state *t)
+{
+	int r = test_not(t);
+
+	while (!t->error && t->pos < t->argc && !strcmp(t->argv[t->pos], "-a")) {
+		int rhs;
+
+		t->pos++;
+		rhs = test_not(t);
+		r = r && rhs;
+	}
+	return r;
+}
+
+static int
+test_or(test_state *t)
+{
+	int r = test_and(t);
+
+	while (!t->error && t->pos < t->argc && !strcmp(t->argv[t->pos], "-o")) {
+		int rhs;
+
+		t->pos++;
+		rhs = test_and(t);
+		r = r || rhs;
+	}
+	return r;
+}
+
+/*
+ * Evaluate argv[0..argc) with the POSIX rules for up to four arguments,
+ * which resolve cases like `test -n` or `test ! = x` without ambiguity.
+ */
+static int
+test_eval(test_state *t, char **argv, int argc)
+{
+	int r;
+
+	switch (argc) {
+	case 0:
+		return 0;
+	case 1:
+		return *argv[0] != '\0';
+	case 2:
+		if (!strcmp(argv[0], "!"))
+			return *argv[1] == '\0';
+		if (test_is_unary(argv[0]))
+			return test_unary(t, argv[0], argv[1]);
+		break;
+	case 3:
+		if (test_is_binary(argv[1]))
+			return test_binary(t, argv[0], argv[1], argv[2]);
+		if (!strcmp(argv[0], "!"))
+			return !test_eval(t, argv + 1, 2);
+		if (!strcmp(argv[0], "(") && !strcmp(argv[2], ")"))
+			return *argv[1] != '\0';
+		break;
+	case 4:
+		if (!strcmp(argv[0], "!"))
+			return !test_eval(t, argv + 1, 3);
+		if (!strcmp(argv[0], "(") && !strcmp(argv[3], ")"))
+			return test_eval(t, argv + 1, 2);
+		break;
+	}
+
+	t->argv = argv;
+	t->argc = argc;
+	t->pos = 0;
+	r = test_or(t);
+	if (t->pos < t->argc)
+		test_fail(t, t->argv[t->pos], "unexpected argument");
+	return r;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                                cat and tee                                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Check that every option word is made of letters in opts.
+ *
+ * Used to hand invocations with options the builtin lacks to the
+ * external utility. Options may follow operands, as with getopt()
+ * argument permutation; "--" ends them.
+ */
+static int
+options_within(const Command *cmd, const char *opts)
+{
+	for (int i = 1; i < cmd->argc; i++) {
+		const char *a = cmd->argv[i];
+
+		if (!strcmp(a, "--"))
+			break;
+		if (a[0] == '-' && a[1] && a[1 + strspn(a + 1, opts)])
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Report a failed copy and set the exit status.
+ *
+ * A reader that went away or an interrupt stops the utility with the
+ * status the external one would have been killed with.
+ *
+ * @return  1 if the utility must stop, 0 if it may go on.
+ */
+static int
+move_failed(const char *util, const char *name, int *status)
+{
+	if (errno == EPIPE) {
+		*status = 128 + SIGPIPE;
+		return 1;
+	}
+	if (errno == EINTR) {
+		*status = 128 + SIGINT;
+		return 1;
+	}
+
+	arg_error(util, name, strerror(errno));
+	*status = 1;
+	return 0;
+}
+
+/**
+ * @brief Copy one cat operand ("-" is stdin) to stdout.
+ *
+ * @return  1 if cat must stop, 0 otherwise.
+ */
+static int
+cat_file(const char *name, int *status)
+{
+	struct stat in, out;
+	int fd = STDIN_FILENO;
+	int ret = 0;
+
+	if (strcmp(name, "-")) {
+		fd = open(name, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			arg_error("cat", name, strerror(errno));
+			*status = 1;
+			return 0;
+		}
+	}
+
+	/* `cat f >> f` would never reach end of file */
+	if (!fstat(fd, &in) && !fstat(STDOUT_FILENO, &out) &&
+	    S_ISREG(out.st_mode) && in.st_dev == out.st_dev &&
+	    in.st_ino == out.st_ino) {
+		arg_error("cat", name, "input file is output file");
+		*status = 1;
+	} else if (datamove_copy(fd, STDOUT_FILENO)) {
+		ret = move_failed("cat", name, status);
+	}
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief echo [-neE] [string...]
+ *
+ * Leading words made only of n, e and E are options: -n drops the
+ * trailing newline, -e enables backslash escapes, -E disables them.
+ */
+int
+builtin_echo(Command *cmd)
+{
+	int newline = 1;
+	int escapes = 0;
+	int stop = 0;
+	int first;
+	int i;
+
+	for (i = 1; i < cmd->argc; i++) {
+		const char *a = cmd->argv[i];
+
+		if (a[0] != '-' || !a[1] || a[1 + strspn(a + 1, "neE")])
+			break;
+
+		for (a++; *a; a++) {
+			if (*a == 'n')
+				newline = 0;
+			else
+				escapes = *a == 'e';
+		}
+	}
+
+	for (first = i; i < cmd->argc && !stop; i++) {
+		const char *s = cmd->argv[i];
+
+		if (i > first)
+			putchar(' ');
+
+		if (!escapes) {
+			fputs(s, stdout);
+			continue;
+		}
+
+		while (*s) {
+			int c;
+
+			if (*s != '\\') {
+				putchar(*s++);
+				continue;
+			}
+
+			s++;
+			s += escape_char(s, 1, &c);
+			if (c == -1) {
+				stop = 1;
+				break;
+			}
+			putchar(c);
+		}
+	}
+
+	if (newline && !stop)
+		putchar('\n');
+
+	exit_code = 0;
+	return finish_output("echo");
+}
+
+/**
+ * @brief printf format [argument...]
+ */
+int
+builtin_printf(Command *cmd)
+{
+	printf_state st;
+	const char *fmt;
+	int i = 1;
+
+	/* "--" ends options; printf itself takes none */
+	if (i < cmd->argc && !strcmp(cmd->argv[i], "--"))
+		i++;
+
+	if (i >= cmd->argc) {
+		error_print("printf", "usage: printf format [arguments]", 0);
+		exit_code = 2;
+		return -1;
+	}
+
+	fmt = cmd->argv[i++];
+	st.args = cmd->argv + i;
+	st.nargs = cmd->argc - i;
+	st.next = 0;
+	st.stop = 0;
+	st.error = 0;
+
+	/* reuse the format while it keeps consuming arguments */
+	for (;;) {
+		int before = st.next;
+
+		if (printf_once(&st, fmt)) {
+			finish_output("printf");
+			exit_code = 1;
+			return -1;
+		}
+
+		if (st.stop || st.next >= st.nargs || st.next == before)
+			break;
+	}
+
+	exit_code = st.error ? 1 : 0;
+	if (finish_output("printf"))
+		return -1;
+	return st.error ? -1 : 0;
+}
+
+/**
+ * @brief pwd [-L | -P]
+ *
+ * -L (default) prints $PWD when it is an absolute path naming the
+ * current directory; -P, or a stale $PWD, prints the getcwd() result.
+ */
+int
+builtin_pwd(Command *cmd)
+{
+	char cwd[PATH_MAX];
+	const char *pwd;
+	struct stat a, b;
+	int physical = 0;
+
+	for (int i = 1; i < cmd->argc; i++) {
+		if (!strcmp(cmd->argv[i], "-P")) {
+			physical = 1;
+		} else if (!strcmp(cmd->argv[i], "-L")) {
+			physical = 0;
+		} else {
+			error_print("pwd", "usage: pwd [-L | -P]", 0);
+			exit_code = 2;
+			return -1;
+		}
+	}
+
+	pwd = getenv("PWD");
+	if (physical || !pwd || pwd[0] != '/' || stat(pwd, &a) || stat(".", &b) ||
+	    a.st_dev != b.st_dev || a.st_ino != b.st_ino) {
+		if (!getcwd(cwd, sizeof(cwd))) {
+			error_print("pwd", "getcwd", errno);
+			exit_code = 1;
+			return -1;
+		}
+		pwd = cwd;
+	}
+
+	puts(pwd);
+	exit_code = 0;
+	return finish_output("pwd");
+}
+
+/**
+ * @brief true: set exit_code to 0.
+ */
+int
+builtin_true(Command *cmd)
+{
+	(void)cmd;
+	exit_code = 0;
+	return 0;
+}
+
+/**
+ * @brief false: set exit_code to 1.
+ */
+int
+builtin_false(Command *cmd)
+{
+	(void)cmd;
+	exit_code = 1;
+	return 0;
+}
+
+/**
+ * @brief test expression, or [ expression ]
+ */
+int
+builtin_test(Command *cmd)
+{
+	test_state t = { NULL, 0, 0, 0, cmd->argv[0] };
+	int argc = cmd->argc - 1;
+	int r;
+
+	if (!strcmp(cmd->argv[0], "[")) {
+		if (argc < 1 || strcmp(cmd->argv[argc], "]")) {
+			error_print("[", "missing ']'", 0);
+			exit_code = 2;
+			return -1;
+		}
+		argc--;
+	}
+
+	r = test_eval(&t, cmd->argv + 1, argc);
+	if (t.error) {
+		exit_code = 2;
+		return -1;
+	}
+
+	exit_code = r ? 0 : 1;
+	return 0;
+}
+
+/**
+ * @brief cat [-u] [file...]
+ */
+int
+builtin_cat(Command *cmd)
+{
+	int status = 0;
+	int operands = 0;
+	int opts = 1;
+
+	/* data goes straight to the descriptor, after anything buffered */
+	fflush(stdout);
+
+	for (int i = 1; i < cmd->argc; i++) {
+		const char *a = cmd->argv[i];
+
+		if (opts && a[0] == '-' && a[1]) {
+			opts = strcmp(a, "--");
+			continue;
+		}
+
+		operands++;
+		if (cat_file(a, &status))
+			break;
+	}
+
+	if (!operands)
+		cat_file("-", &status);
+
+	exit_code = status;
+	return status ? -1 : 0;
+}
+
+/**
+ * @brief Check whether `cat` only uses options the builtin supports.
+ */
+int
+builtin_cat_supports(const Command *cmd)
+{
+	return options_within(cmd, "u");
+}
+
+/**
+ * @brief tee [-a] [file...]
+ */
+int
+builtin_tee(Command *cmd)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	const char **names;
+	int *fds;
+	int nout = 1;
+	int status = 0;
+	int opts = 1;
+	int failed;
+	int i;
+
+	fds = malloc((size_t)cmd->argc * sizeof(*fds));
+	names = malloc((size_t)cmd->argc * sizeof(*names));
+	if (!fds || !names) {
+		error_print("tee", "malloc", errno);
+		free(fds);
+		free(names);
+		exit_code = 1;
+		return -1;
+	}
+
+	fds[0] = STDOUT_FILENO;
+	names[0] = "standard output";
+
+	for (i = 1; i < cmd->argc; i++) {
+		if (!strcmp(cmd->argv[i], "--"))
+			break;
+		if (cmd->argv[i][0] == '-' && cmd->argv[i][1])
+			flags = (flags & ~O_TRUNC) | O_APPEND;
+	}
+
+	for (i = 1; i < cmd->argc; i++) {
+		const char *a = cmd->argv[i];
+
+		if (opts && a[0] == '-' && a[1]) {
+			opts = strcmp(a, "--");
+			continue;
+		}
+
+		fds[nout] = open(a, flags, 0666);
+		if (fds[nout] == -1) {
+			arg_error("tee", a, strerror(errno));
+			status = 1;
+			continue;
+		}
+		names[nout++] = a;
+	}
+
+	fflush(stdout);
+	if (datamove_tee(STDIN_FILENO, fds, nout, &failed))
+		move_failed("tee", failed >= 0 ? names[failed] : "standard input",
+		            &status);
+
+	for (i = 1; i < nout; i++)
+		close(fds[i]);
+	free(fds);
+	free(names);
+
+	exit_code = status;
+	return status ? -1 : 0;
+}
+
+/**
+ * @brief Check whether `tee` only uses options the builtin supports.
+ */
+int
+builtin_tee_supports(const Command *cmd)
+{
+	return options_within(cmd, "a");
+}
@@ -0,0 +1,118 @@
+/**
+ * @file coreutils.h
+ * @brief In-process versions of common utilities.
+ *
+ * echo, printf, pwd, true, false, test/[, cat and tee run as builtins,
+ * so scripts do not pay for a PATH lookup and fork()/execve() on every
+ * call. They follow POSIX semantics (with the usual bash extensions for
+ * echo) and report their status through exit_code like every other
+ * builtin.
+ *
+ * Each handler returns 0 when the utility ran (whatever its exit status)
+ * and -1 on a usage or runtime error.
+ */
+
+#ifndef COREUTILS_H
+#define COREUTILS_H
+
+#include "parser.h"
+
+/**
+ * @brief echo [-neE] [string...]
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on write error.
+ */
+int builtin_echo(Command *cmd);
+
+/**
+ * @brief printf format [argument...]
+ *
+ * Supports the POSIX conversions (d i o u x X c s b %, plus the floating
+ * point ones), flags, field width and precision (including '*'). The
+ * format is reused until every argument is consumed.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on error.
+ */
+int builtin_printf(Command *cmd);
+
+/**
+ * @brief pwd [-L | -P]
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on error.
+ */
+int builtin_pwd(Command *cmd);
+
+/**
+ * @brief true: set exit_code to 0.
+ *
+ * @param cmd  Command (ignored).
+ * @return     0.
+ */
+int builtin_true(Command *cmd);
+
+/**
+ * @brief false: set exit_code to 1.
+ *
+ * @param cmd  Command (ignored).
+ * @return     0.
+ */
+int builtin_false(Command *cmd);
+
+/**
+ * @brief test expression, or [ expression ]
+ *
+ * Up to four arguments are evaluated with the POSIX argument-count
+ * rules; longer expressions are parsed with !, -a, -o and parentheses.
+ * exit_code is 0 (true), 1 (false) or 2 (error).
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on a syntax error.
+ */
+int builtin_test(Command *cmd);
+
+/**
+ * @brief cat [-u] [file...]
+ *
+ * Copies each file ("-" or no operand: stdin) to stdout with
+ * datamove_copy(), so no data passes through userspace when the
+ * descriptors allow it. -u is accepted and ignored: output is never
+ * buffered.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on error.
+ */
+int builtin_cat(Command *cmd);
+
+/**
+ * @brief Check whether a cat invocation only uses supported options.
+ *
+ * Others (-n, -A, ...) are left to the external cat.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     1 if builtin_cat() can run it, 0 otherwise.
+ */
+int builtin_cat_supports(const Command *cmd);
+
+/**
+ * @brief tee [-a] [file...]
+ *
+ * Copies stdin to stdout and every file (appending with -a) with
+ * datamove_tee(). Stops at the first write error.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on error.
+ */
+int builtin_tee(Command *cmd);
+
+/**
+ * @brief Check whether a tee invocation only uses supported options.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     1 if builtin_tee() can run it, 0 otherwise.
+ */
+int builtin_tee_supports(const Command *cmd);
+
+#endif /* COREUTILS_H */
@@ -0,0 +1,358 @@
+/**
+ * @file datamove.c
+ * @brief Zero-copy data movement for the cat and tee builtins.
+ *
+ * Each copy picks the cheapest kernel interface the two descriptors
+ * allow and steps down to the next one when the kernel refuses it
+ * (copy_file_range() -> sendfile() -> read()/write(), or splice() ->
+ * read()/write()). A refusal is reported before any data is moved, so
+ * switching methods mid-stream loses nothing.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* splice(), tee(), copy_file_range() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "datamove.h"
+
+/* Bytes requested per zero-copy call. */
+#define MOVE_CHUNK (1 << 20)
+
+/* Buffer for the read()/write() fallback; also the tee(2) round size. */
+#define BUF_SIZE (64 * 1024)
+
+static char buf[BUF_SIZE];
+
+typedef enum {
+	MOVE_COPY_RANGE,         /* regular file -> regular file */
+	MOVE_SENDFILE,           /* regular file -> anything */
+	MOVE_SPLICE,             /* pipe <-> pipe or regular file */
+	MOVE_RW                  /* read()/write() through buf */
+} move_method;
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Check whether errno means "not supported on these descriptors".
+ *
+ * copy_file_range() fails with EBADF on O_APPEND outputs and EXDEV
+ * across file systems; splice() and sendfile() use EINVAL.
+ */
+static int
+unsupported(int err)
+{
+	return err == EINVAL || err == ENOSYS || err == EXDEV ||
+	       err == EBADF || err == EOPNOTSUPP;
+}
+
+/**
+ * @brief write() all of a buffer.
+ *
+ * @return  0 on success, -1 on error (including EINTR).
+ */
+static int
+write_all(int fd, const char *p, size_t n)
+{
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+
+		if (w < 0)
+			return -1;
+		p += w;
+		n -= (size_t)w;
+	}
+	return 0;
+}
+
+/**
+ * @brief Read exactly n bytes (n <= BUF_SIZE) into buf.
+ *
+ * Only used on pipes known to hold at least n bytes.
+ */
+static int
+read_full(int fd, size_t n)
+{
+	size_t off = 0;
+
+	while (off < n) {
+		ssize_t r = read(fd, buf + off, n - off);
+
+		if (r <= 0) {
+			if (r == 0)
+				errno = EIO;
+			return -1;
+		}
+		off += (size_t)r;
+	}
+	return 0;
+}
+
+/**
+ * @brief Pick the first method to try for a pair of descriptors.
+ */
+static move_method
+move_pick(int in_fd, int out_fd)
+{
+	struct stat in_st, out_st;
+
+	if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1)
+		return MOVE_RW;
+
+	if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode))
+		return MOVE_COPY_RANGE;
+
+	/*
+	 * Terminals and sockets are left to read()/write(): splice() from a
+	 * terminal fills whole pages and so holds back a line until the next
+	 * one arrives.
+	 */
+	if ((S_ISFIFO(in_st.st_mode) &&
+	     (S_ISFIFO(out_st.st_mode) || S_ISREG(out_st.st_mode))) ||
+	    (S_ISFIFO(out_st.st_mode) && S_ISREG(in_st.st_mode)))
+		return MOVE_SPLICE;
+	if (S_ISREG(in_st.st_mode))
+		return MOVE_SENDFILE;
+	return MOVE_RW;
+}
+
+/**
+ * @brief Move one chunk with *m, stepping down to a slower method (and
+ *        updating *m) while the kernel refuses the current one.
+ *
+ * @return  Bytes moved, 0 at end of input, -1 on error.
+ */
+static ssize_t
+move_chunk(move_method *m, int in_fd, int out_fd)
+{
+	ssize_t n;
+
+	for (;;) {
+		switch (*m) {
+		case MOVE_COPY_RANGE:
+			n = copy_file_range(in_fd, NULL, out_fd, NULL, MOVE_CHUNK, 0);
+			break;
+		case MOVE_SENDFILE:
+			n = sendfile(out_fd, in_fd, NULL, MOVE_CHUNK);
+			break;
+		case MOVE_SPLICE:
+			n = splice(in_fd, NULL, out_fd, NULL, MOVE_CHUNK, SPLICE_F_MOVE);
+			break;
+		default:
+			n = read(in_fd, buf, BUF_SIZE);
+			if (n > 0 && write_all(out_fd, buf, (size_t)n))
+				return -1;
+			return n;
+		}
+
+		if (n >= 0 || !unsupported(errno))
+			return n;
+		*m = (*m == MOVE_COPY_RANGE) ? MOVE_SENDFILE : MOVE_RW;
+	}
+}
+
+/**
+ * @brief Move exactly n bytes out of the pipe from into to.
+ */
+static int
+drain(int from, int to, size_t n)
+{
+	while (n > 0) {
+		ssize_t w = splice(from, NULL, to, NULL, n, SPLICE_F_MOVE);
+
+		if (w < 0 && unsupported(errno)) {
+			/* to does not take splice(): copy the rest by hand */
+			size_t len = n < BUF_SIZE ? n : BUF_SIZE;
+
+			if (read_full(from, len) || write_all(to, buf, len))
+				return -1;
+			w = (ssize_t)len;
+		} else if (w <= 0) {
+			if (w == 0)
+				errno = EIO;
+			return -1;
+		}
+		n -= (size_t)w;
+	}
+	return 0;
+}
+
+/**
+ * @brief Deliver one tee(2) round: n bytes at the head of in_fd, already
+ *        duplicated into out_fds[0], go to out_fds[1..nout-1].
+ *
+ * Middle outputs get a tee(2) copy through the empty scratch pipe; the
+ * last one consumes the data from in_fd. Should tee(2) copy less than
+ * n bytes, the round is finished from a buffer instead.
+ */
+static int
+tee_round(int in_fd, const int *out_fds, int nout, const int scratch[2],
+          size_t n, int *failed)
+{
+	int k;
+
+	for (k = 1; k < nout - 1; k++) {
+		ssize_t m = tee(in_fd, scratch[1], n, 0);
+
+		if (m < 0)
+			m = 0;
+		if (drain(scratch[0], out_fds[k], (size_t)m)) {
+			*failed = k;
+			return -1;
+		}
+		if ((size_t)m == n)
+			continue;
+
+		/* partial copy: take the round out of in_fd into buf */
+		if (read_full(in_fd, n)) {
+			*failed = -1;
+			return -1;
+		}
+		if (write_all(out_fds[k], buf + m, n - (size_t)m)) {
+			*failed = k;
+			return -1;
+		}
+		for (k++; k < nout; k++) {
+			if (write_all(out_fds[k], buf, n)) {
+				*failed = k;
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	if (drain(in_fd, out_fds[nout - 1], n)) {
+		*failed = nout - 1;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Fan out with tee(2); in_fd and out_fds[0] are pipes.
+ *
+ * @return  0 at end of input, 1 if tee(2) is not usable (nothing was
+ *          moved), -1 on error.
+ */
+static int
+tee_pipes(int in_fd, const int *out_fds, int nout, int *failed)
+{
+	int scratch[2] = { -1, -1 };
+	int first = 1;
+	int ret = -1;
+
+	if (nout > 2 && pipe2(scratch, O_CLOEXEC) == -1)
+		return 1;
+
+	for (;;) {
+		ssize_t n = tee(in_fd, out_fds[0], BUF_SIZE, 0);
+
+		if (n == 0) {
+			ret = 0;
+			break;
+		}
+		if (n < 0) {
+			if (first && unsupported(errno))
+				ret = 1;
+			else
+				*failed = 0;
+			break;
+		}
+		first = 0;
+
+		if (tee_round(in_fd, out_fds, nout, scratch, (size_t)n, failed))
+			break;
+	}
+
+	if (scratch[0] != -1) {
+		close(scratch[0]);
+		close(scratch[1]);
+	}
+	return ret;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Copy everything from in_fd to out_fd until end of file.
+ */
+int
+datamove_copy(int in_fd, int out_fd)
+{
+	move_method m = move_pick(in_fd, out_fd);
+	int moved = 0;
+
+	for (;;) {
+		ssize_t n = move_chunk(&m, in_fd, out_fd);
+
+		if (n < 0)
+			return -1;
+		if (n > 0) {
+			moved = 1;
+			continue;
+		}
+
+		/*
+		 * Files in /proc and /sys report size 0 and may look empty
+		 * to the zero-copy calls: make sure with a plain read().
+		 */
+		if (!moved && m != MOVE_RW) {
+			m = MOVE_RW;
+			continue;
+		}
+		return 0;
+	}
+}
+
+/**
+ * Copy everything from in_fd to each of out_fds until end of file.
+ */
+int
+datamove_tee(int in_fd, const int *out_fds, int nout, int *failed)
+{
+	struct stat in_st, out_st;
+
+	*failed = -1;
+
+	if (nout == 1) {
+		if (datamove_copy(in_fd, out_fds[0]) == 0)
+			return 0;
+		if (errno != EINTR)
+			*failed = 0;
+		return -1;
+	}
+
+	if (fstat(in_fd, &in_st) == 0 && fstat(out_fds[0], &out_st) == 0 &&
+	    S_ISFIFO(in_st.st_mode) && S_ISFIFO(out_st.st_mode)) {
+		int ret = tee_pipes(in_fd, out_fds, nout, failed);
+
+		if (ret != 1) {
+			if (ret && errno == EINTR)
+				*failed = -1;
+			return ret;
+		}
+	}
+
+	for (;;) {
+		ssize_t n = read(in_fd, buf, BUF_SIZE);
+
+		if (n <= 0)
+			return n == 0 ? 0 : -1;
+
+		for (int k = 0; k < nout; k++) {
+			if (write_all(out_fds[k], buf, (size_t)n)) {
+				if (errno != EINTR)
+					*failed = k;
+				return -1;
+			}
+		}
+	}
+}
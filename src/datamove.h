@@ -0,0 +1,46 @@
+/**
+ * @file datamove.h
+ * @brief Kernel-side data movement between file descriptors.
+ *
+ * Copies data without bouncing it through a userspace buffer where the
+ * kernel allows it: copy_file_range() between regular files, splice()
+ * when either end is a pipe and sendfile() from a regular file to
+ * anything else. tee(2) duplicates pipe contents for fan-out. Every
+ * path falls back to read()/write() when the descriptors do not
+ * support the faster call (terminals, O_APPEND files, ...).
+ *
+ * File offsets are used and advanced like read()/write() would, so a
+ * descriptor shared with other processes stays consistent.
+ */
+
+#ifndef DATAMOVE_H
+#define DATAMOVE_H
+
+/**
+ * @brief Copy everything from in_fd to out_fd until end of file.
+ *
+ * @param in_fd   Source descriptor.
+ * @param out_fd  Destination descriptor.
+ * @return        0 at end of input, -1 on error with errno set (EPIPE
+ *                if the reader went away, EINTR if a signal
+ *                interrupted the copy).
+ */
+int datamove_copy(int in_fd, int out_fd);
+
+/**
+ * @brief Copy everything from in_fd to each of out_fds until end of file.
+ *
+ * With in_fd and out_fds[0] both pipes the data is duplicated with
+ * tee(2) and spliced into the other outputs; otherwise it is read once
+ * into a buffer and written to every output.
+ *
+ * @param in_fd    Source descriptor.
+ * @param out_fds  Destination descriptors.
+ * @param nout     Number of destinations (at least 1).
+ * @param failed   Output: index of the destination that failed, or -1
+ *                 if the error was on the input side.
+ * @return         0 at end of input, -1 on error with errno set.
+ */
+int datamove_tee(int in_fd, const int *out_fds, int nout, int *failed);
+
+#endif /* DATAMOVE_H */
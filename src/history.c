@@ -0,0 +1,460 @@
+/**
+ * @file history.c
+ * @brief Append-only command history.
+ *
+ * The index is an array of pointers to the start of every entry, all
+ * in the session arena: the file is read into it once at startup, and
+ * the entries of this session are added after. Every entry ends with a
+ * newline, so the file contents never need to be split up or
+ * NUL-terminated. The snapshot is a private copy rather than a mapping:
+ * another shell or the user may truncate or rewrite the file at any
+ * time, and touching a mapped page past the new end would raise SIGBUS.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* memmem() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "arena.h"
+#include "error.h"
+
+extern int exit_code;
+
+#define INDEX_INIT 1024
+
+static const char **entries = NULL;
+static size_t nentries = 0;
+static size_t cap = 0;
+
+static char *snap = NULL;      /* the file as it was at startup */
+static size_t snap_len = 0;
+static Arena *session = NULL;  /* the snapshot and the entries added since */
+static int fd = -1;            /* O_APPEND, -1 without a file */
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Length of an entry, up to its newline.
+ */
+static size_t
+entry_len(const char *s)
+{
+	size_t n = 0;
+
+	while (s[n] != '\n')
+		n++;
+	return n;
+}
+
+/**
+ * @brief Append a pointer to the index, growing it as needed.
+ */
+static int
+index_push(const char *s)
+{
+	if (nentries == cap) {
+		size_t ncap = cap ? cap * 2 : INDEX_INIT;
+		const char **nidx = realloc(entries, ncap * sizeof(*nidx));
+
+		if (!nidx) {
+			error_print(__func__, "realloc", errno);
+			return -1;
+		}
+		entries = nidx;
+		cap = ncap;
+	}
+
+	entries[nentries++] = s;
+	return 0;
+}
+
+/**
+ * @brief Index every complete, non-empty line of the snapshot.
+ *
+ * An unterminated last line is a write still in progress in another
+ * shell and is skipped.
+ */
+static void
+index_snapshot(void)
+{
+	const char *p = snap;
+	const char *end = snap + snap_len;
+
+	while (p < end) {
+		const char *nl = memchr(p, '\n', (size_t)(end - p));
+
+		if (!nl)
+			break;
+		if (nl > p && index_push(p))
+			break;
+		p = nl + 1;
+	}
+}
+
+static int
+is_blank(const char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+	return *s == '\0';
+}
+
+/*
+ * Output buffer for history_expand().
+ */
+typedef struct {
+	char *s;
+	size_t len;
+	size_t cap;
+} strbuf;
+
+static int
+strbuf_add(strbuf *b, const char *s, size_t n)
+{
+	if (b->len + n + 1 > b->cap) {
+		size_t ncap = b->cap ? b->cap : 128;
+		char *ns;
+
+		while (b->len + n + 1 > ncap)
+			ncap *= 2;
+		ns = realloc(b->s, ncap);
+		if (!ns) {
+			error_print("history", "realloc", errno);
+			return -1;
+		}
+		b->s = ns;
+		b->cap = ncap;
+	}
+
+	memcpy(b->s + b->len, s, n);
+	b->len += n;
+	b->s[b->len] = '\0';
+	return 0;
+}
+
+/**
+ * @brief Characters that end a `!prefix` reference.
+ */
+static int
+ends_prefix(char c)
+{
+	return c == '\0' || strchr(" \t\n;&|<>()'\"", c) != NULL;
+}
+
+/**
+ * @brief Resolve the reference at s (just after the '!').
+ *
+ * @param s     Text after the '!'.
+ * @param used  Output: characters of s that belong to the reference, 0
+ *              if s does not start a reference.
+ * @return      Entry index, or HISTORY_NONE.
+ */
+static size_t
+resolve_event(const char *s, size_t *used)
+{
+	char *end;
+	long v;
+
+	if (*s == '!') {
+		*used = 1;
+		return nentries ? nentries - 1 : HISTORY_NONE;
+	}
+
+	if ((*s >= '0' && *s <= '9') || (*s == '-' && s[1] >= '0' && s[1] <= '9')) {
+		errno = 0;
+		v = strtol(s, &end, 10);
+		*used = (size_t)(end - s);
+		if (errno)
+			return HISTORY_NONE;
+		if (v < 0)
+			return (size_t)-v <= nentries ? nentries - (size_t)-v : HISTORY_NONE;
+		return v >= 1 && (size_t)v <= nentries ? (size_t)v - 1 : HISTORY_NONE;
+	}
+
+	for (*used = 0; !ends_prefix(s[*used]); (*used)++)
+		;
+	for (size_t i = nentries; *used && i-- > 0; ) {
+		if (!strncmp(entries[i], s, *used))
+			return i;
+	}
+	return HISTORY_NONE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Load the history file and open it for appending.
+ */
+int
+history_open(const char *path)
+{
+	struct stat st;
+
+	session = arena_create();
+	if (!session) {
+		error_print(__func__, "arena_create", errno);
+		return -1;
+	}
+	if (!path)
+		return 0;
+
+	fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		error_print(path, strerror(errno), 0);
+		return -1;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		error_print(__func__, "fstat", errno);
+		return 0;
+	}
+	if (st.st_size <= 0)
+		return 0;
+
+	snap = arena_alloc(session, (size_t)st.st_size);
+	if (!snap) {
+		error_print(__func__, "malloc", errno);
+		return 0;
+	}
+
+	/* the file may shrink meanwhile: keep whatever was read */
+	while (snap_len < (size_t)st.st_size) {
+		ssize_t r = pread(fd, snap + snap_len, (size_t)st.st_size - snap_len,
+		                  (off_t)snap_len);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			error_print(__func__, "read", errno);
+		if (r <= 0)
+			break;
+		snap_len += (size_t)r;
+	}
+
+	index_snapshot();
+	return 0;
+}
+
+/**
+ * Release the snapshot, the index and the file.
+ */
+void
+history_close(void)
+{
+	if (fd != -1)
+		close(fd);
+	arena_destroy(session);
+	free(entries);
+
+	snap = NULL;
+	snap_len = 0;
+	fd = -1;
+	session = NULL;
+	entries = NULL;
+	nentries = cap = 0;
+}
+
+/**
+ * Append a command line to the history and the file.
+ */
+void
+history_add(const char *line)
+{
+	size_t len = strlen(line);
+	char *s;
+
+	if (is_blank(line) || strchr(line, '\n'))
+		return;
+	if (nentries && entry_len(entries[nentries - 1]) == len &&
+	    !memcmp(entries[nentries - 1], line, len))
+		return;
+
+	s = session ? arena_alloc(session, len + 1) : NULL;
+	if (!s)
+		return;
+	memcpy(s, line, len);
+	s[len] = '\n';
+
+	if (index_push(s))
+		return;
+
+	/* one write() per entry: O_APPEND keeps concurrent shells intact */
+	if (fd != -1 && write(fd, s, len + 1) != (ssize_t)(len + 1)) {
+		error_print(__func__, "write", errno);
+		close(fd);
+		fd = -1;
+	}
+}
+
+/**
+ * Number of entries.
+ */
+size_t
+history_count(void)
+{
+	return nentries;
+}
+
+/**
+ * Get an entry.
+ */
+const char*
+history_get(size_t i, size_t *len)
+{
+	*len = entry_len(entries[i]);
+	return entries[i];
+}
+
+/**
+ * Find the newest entry before another one that contains a string.
+ */
+size_t
+history_search(const char *needle, size_t before)
+{
+	size_t nlen = strlen(needle);
+
+	if (before > nentries)
+		before = nentries;
+
+	while (before-- > 0) {
+		const char *s = entries[before];
+
+		if (memmem(s, entry_len(s), needle, nlen))
+			return before;
+	}
+	return HISTORY_NONE;
+}
+
+/**
+ * Expand history references in a command line.
+ */
+int
+history_expand(const char *line, char **out)
+{
+	strbuf b = { NULL, 0, 0 };
+	const char *p = line;
+	const char *copied = line;  /* start of the text not yet copied */
+	int squote = 0;
+	int dquote = 0;
+	int expanded = 0;
+
+	if (!strchr(line, '!'))
+		return 0;
+
+	for (; *p; p++) {
+		size_t used;
+		size_t ev;
+		const char *s;
+		size_t len;
+
+		if (*p == '\\' && !squote) {
+			if (p[1])
+				p++;
+			continue;
+		}
+		if (*p == '\'' && !dquote) {
+			squote = !squote;
+			continue;
+		}
+		if (*p == '"' && !squote) {
+			dquote = !dquote;
+			continue;
+		}
+		if (*p != '!' || squote || strchr(" \t=(", p[1]) || !p[1])
+			continue;
+
+		ev = resolve_event(p + 1, &used);
+		if (!used)
+			continue;
+		if (ev == HISTORY_NONE) {
+			char ref[64];
+
+			snprintf(ref, sizeof(ref), "!%.*s",
+			         (int)(used < 40 ? used : 40), p + 1);
+			error_print(ref, "event not found", 0);
+			free(b.s);
+			exit_code = 1;
+			return -1;
+		}
+
+		s = history_get(ev, &len);
+		if (strbuf_add(&b, copied, (size_t)(p - copied)) ||
+		    strbuf_add(&b, s, len)) {
+			free(b.s);
+			return -1;
+		}
+		p += used;
+		copied = p + 1;
+		expanded = 1;
+	}
+
+	if (!expanded)
+		return 0;
+	if (strbuf_add(&b, copied, strlen(copied))) {
+		free(b.s);
+		return -1;
+	}
+
+	*out = b.s;
+	return 1;
+}
+
+/**
+ * @brief Handle the builtin `history [n]` command.
+ */
+int
+builtin_history(Command *cmd)
+{
+	size_t first = 0;
+
+	if (cmd->argc > 2) {
+		error_print("history", "usage: history [n]", 0);
+		exit_code = 2;
+		return -1;
+	}
+
+	if (cmd->argc == 2) {
+		char *end;
+		long n;
+
+		errno = 0;
+		n = strtol(cmd->argv[1], &end, 10);
+		if (errno || end == cmd->argv[1] || *end || n < 0) {
+			error_print("history", "usage: history [n]", 0);
+			exit_code = 2;
+			return -1;
+		}
+		if ((size_t)n < nentries)
+			first = nentries - (size_t)n;
+	}
+
+	for (size_t i = first; i < nentries; i++) {
+		size_t len = entry_len(entries[i]);
+
+		printf("%5zu  %.*s\n", i + 1, (int)(len > INT_MAX ? INT_MAX : len),
+		       entries[i]);
+	}
+
+	if (fflush(stdout) || ferror(stdout)) {
+		error_print("history", "write error", errno);
+		clearerr(stdout);
+		exit_code = 1;
+		return -1;
+	}
+
+	exit_code = 0;
+	return 0;
+}
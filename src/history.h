@@ -0,0 +1,99 @@
+/**
+ * @file history.h
+ * @brief Persistent command history.
+ *
+ * Interactive shells keep their history in an append-only file
+ * ($HISTFILE, default ~/.tinyshell_history), one command per line. The
+ * file is read once at startup and indexed in memory, so opening a
+ * history of a million entries costs one pass over its contents; each new
+ * command is appended with a single O_APPEND write(), which lets any
+ * number of concurrent shells share the file without rewriting it.
+ * Commands entered by other shells show up in the next session.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+#include "parser.h"
+
+/* Returned by history_search() when nothing matches. */
+#define HISTORY_NONE ((size_t)-1)
+
+/**
+ * @brief Load the history file and open it for appending.
+ *
+ * @param path  History file; created if missing. NULL keeps the
+ *              history for the session only.
+ * @return      0 on success, -1 if the file cannot be used (history
+ *              then lasts for the session only).
+ */
+int history_open(const char *path);
+
+/**
+ * @brief Release the snapshot, the index and the file.
+ */
+void history_close(void);
+
+/**
+ * @brief Append a command line to the history and the file.
+ *
+ * Blank lines and repeats of the previous entry are not recorded.
+ *
+ * @param line  Command line, without the newline.
+ */
+void history_add(const char *line);
+
+/**
+ * @brief Number of entries.
+ *
+ * @return Entry count; entries are numbered from 0 in these calls and
+ *         from 1 in `history` and `!n`.
+ */
+size_t history_count(void);
+
+/**
+ * @brief Get an entry.
+ *
+ * @param i    Entry index, less than history_count().
+ * @param len  Output: length of the entry. Entries are not
+ *             NUL-terminated.
+ * @return     Start of the entry.
+ */
+const char *history_get(size_t i, size_t *len);
+
+/**
+ * @brief Find the newest entry before another one that contains a string.
+ *
+ * @param needle  String to look for.
+ * @param before  Search entries below this index only.
+ * @return        Index of the match, or HISTORY_NONE.
+ */
+size_t history_search(const char *needle, size_t before);
+
+/**
+ * @brief Expand history references in a command line.
+ *
+ * Handles `!!` (previous command), `!n` (entry n), `!-n` (n-th
+ * previous) and `!prefix` (newest command starting with prefix).
+ * References inside single quotes or after a backslash are left alone,
+ * as is a `!` followed by a blank, `=` or `(`.
+ *
+ * @param line  Command line.
+ * @param out   Output: the expanded line (malloc()ed) if the return
+ *              value is 1.
+ * @return      0 if line has no references, 1 if it was expanded, -1
+ *              if a reference did not match (reported).
+ */
+int history_expand(const char *line, char **out);
+
+/**
+ * @brief history [n]: list all entries, or the last n.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on a usage error.
+ */
+int builtin_history(Command *cmd);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,378 @@
+/**
+ * @file input.c
+ * @brief Implementation of the shell line reader.
+ *
+ * Two kinds of sources are handled:
+ *
+ *   - Memory sources (mapped script files and -c strings): the whole
+ *     input is addressable, lines are split in place by overwriting the
+ *     newline with a NUL.
+ *   - Descriptor sources (stdin, pipes, terminals): data is read in
+ *     large chunks into a buffer that doubles whenever a single line
+ *     does not fit, so line length is only bounded by memory.
+ *
+ * Commands share the shell's stdin, so `tinyshell < script` must not
+ * hold on to input past the current line. A seekable stdin is still
+ * read in chunks, and input_sync() moves the file offset back to the
+ * end of the line before a command runs; the read-ahead is kept and
+ * reused only if nothing moved the offset meanwhile. A pipe cannot seek
+ * back and is read one byte at a time, as other shells do. Terminals
+ * deliver a line per read anyway.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "error.h"
+
+#define INPUT_CHUNK 65536
+
+struct InputReader {
+	int fd;          /* descriptor source, -1 for memory sources */
+	int owns_fd;     /* close fd in input_close() */
+	char *buf;       /* input data */
+	size_t cap;      /* allocated size of buf (descriptor sources) */
+	size_t start;    /* first unconsumed byte */
+	size_t end;      /* one past the last valid byte */
+	int eof;         /* no more data will arrive */
+	int bytewise;    /* shared unseekable fd: never read past a newline */
+	int seekable;    /* shared seekable fd: input_sync() seeks back */
+	off_t synced;    /* offset after input_sync(), -1 if not synced */
+	size_t map_len;  /* length of the mapping, 0 if buf is not mapped */
+	char *tail;      /* copy of an unterminated last line of a mapping */
+};
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+static InputReader*
+input_new(void)
+{
+	InputReader *in;
+
+	in = calloc(1, sizeof(*in));
+	if (!in)
+		return NULL;
+
+	in->fd = -1;
+	in->synced = -1;
+	return in;
+}
+
+/**
+ * @brief Return the unterminated remainder of a memory source.
+ *
+ * The byte after the data is used as terminator when it is addressable:
+ * -c strings are allocated with room for it, and mappings that do not
+ * end on a page boundary have zero-filled, privately writable slack.
+ * Otherwise the line is copied out.
+ */
+static char*
+input_last_line(InputReader *in)
+{
+	char *line = in->buf + in->start;
+	size_t len = in->end - in->start;
+	long page;
+
+	in->start = in->end;
+	in->eof = 1;
+
+	if (!in->map_len) {
+		line[len] = '\0';
+		return line;
+	}
+
+	page = sysconf(_SC_PAGESIZE);
+	if (page > 0 && in->map_len % (size_t)page) {
+		line[len] = '\0';
+		return line;
+	}
+
+	free(in->tail);
+	in->tail = malloc(len + 1);
+	if (!in->tail) {
+		error_print(__func__, "malloc", errno);
+		return NULL;
+	}
+
+	memcpy(in->tail, line, len);
+	in->tail[len] = '\0';
+	return in->tail;
+}
+
+/**
+ * @brief Read more data from a descriptor source.
+ *
+ * Compacts consumed bytes away and grows the buffer when it is full.
+ *
+ * @return  1 if data was added, 0 on end of file, -1 on error.
+ */
+static int
+input_fill(InputReader *in)
+{
+	ssize_t n;
+
+	if (in->start > 0) {
+		memmove(in->buf, in->buf + in->start, in->end - in->start);
+		in->end -= in->start;
+		in->start = 0;
+	}
+
+	/* keep one byte spare for the terminator of an unterminated line */
+	if (in->cap - in->end < 2) {
+		size_t ncap = in->cap ? in->cap * 2 : INPUT_CHUNK;
+		char *nbuf = realloc(in->buf, ncap);
+
+		if (!nbuf) {
+			error_print(__func__, "realloc", errno);
+			return -1;
+		}
+		in->buf = nbuf;
+		in->cap = ncap;
+	}
+
+	n = read(in->fd, in->buf + in->end, in->bytewise ? 1 : in->cap - in->end - 1);
+	if (n < 0)
+		return -1;
+	if (n == 0)
+		return 0;
+
+	in->end += (size_t)n;
+	return 1;
+}
+
+/**
+ * @brief Take back the read-ahead of a synced seekable source.
+ *
+ * If a command read from the descriptor, the buffered bytes are stale
+ * and reading continues from where it left the offset.
+ */
+static void
+input_resume(InputReader *in)
+{
+	off_t off = lseek(in->fd, 0, SEEK_CUR);
+
+	if (off != in->synced ||
+	    lseek(in->fd, (off_t)(in->end - in->start), SEEK_CUR) == -1)
+		in->end = in->start;
+	in->synced = -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Create a reader over an open file descriptor.
+ */
+InputReader*
+input_from_fd(int fd)
+{
+	InputReader *in = input_new();
+
+	if (!in)
+		return NULL;
+
+	in->fd = fd;
+	if (!isatty(fd)) {
+		in->seekable = lseek(fd, 0, SEEK_CUR) != -1;
+		in->bytewise = !in->seekable;
+	}
+	return in;
+}
+
+/**
+ * @brief Create a reader over a script file.
+ */
+InputReader*
+input_from_file(const char *path)
+{
+	InputReader *in;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	in = input_new();
+	if (!in) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		/* Not mappable (or empty): read it like any descriptor. */
+		in->fd = fd;
+		in->owns_fd = 1;
+		return in;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+	           MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		free(in);
+		return NULL;
+	}
+
+	in->buf = map;
+	in->end = (size_t)st.st_size;
+	in->map_len = (size_t)st.st_size;
+	return in;
+}
+
+/**
+ * @brief Create a reader over a copy of a string.
+ */
+InputReader*
+input_from_string(const char *s)
+{
+	InputReader *in = input_new();
+
+	if (!in)
+		return NULL;
+
+	in->end = strlen(s);
+	in->buf = malloc(in->end + 1);
+	if (!in->buf) {
+		free(in);
+		return NULL;
+	}
+
+	memcpy(in->buf, s, in->end + 1);
+	return in;
+}
+
+/**
+ * @brief Read the next line.
+ */
+char*
+input_getline(InputReader *in)
+{
+	size_t scanned;
+
+	if (in->synced != -1)
+		input_resume(in);
+	scanned = in->start;
+
+	for (;;) {
+		char *nl = NULL;
+
+		if (in->end > scanned)
+			nl = memchr(in->buf + scanned, '\n', in->end - scanned);
+
+		if (nl) {
+			char *line = in->buf + in->start;
+
+			*nl = '\0';
+			in->start = (size_t)(nl - in->buf) + 1;
+			return line;
+		}
+
+		if (in->fd == -1 || in->eof) {
+			if (in->start == in->end) {
+				in->eof = 1;
+				return NULL;
+			}
+			return input_last_line(in);
+		}
+
+		/* only the bytes after the ones already scanned can hold '\n' */
+		scanned = in->end - in->start;
+		switch (input_fill(in)) {
+		case 1:
+			break;
+		case 0:
+			in->eof = 1;
+			break;
+		default:
+			if (errno == EINTR)
+				return NULL;
+			error_print(__func__, "read", errno);
+			in->eof = 1;
+			return NULL;
+		}
+		scanned += in->start;
+	}
+}
+
+/**
+ * @brief Check whether the next line can be returned without reading.
+ */
+int
+input_buffered(const InputReader *in)
+{
+	if (in->fd == -1 || in->eof)
+		return 1;
+
+	return in->end > in->start &&
+	       memchr(in->buf + in->start, '\n', in->end - in->start) != NULL;
+}
+
+/**
+ * @brief Hand the unread input back to the descriptor.
+ */
+void
+input_sync(InputReader *in)
+{
+	off_t off;
+
+	if (!in->seekable || in->synced != -1 || in->eof)
+		return;
+
+	off = lseek(in->fd, -(off_t)(in->end - in->start), SEEK_CUR);
+	if (off == -1)
+		return;
+	in->synced = off;
+}
+
+/**
+ * @brief Check whether the reader reached end of input.
+ */
+int
+input_eof(const InputReader *in)
+{
+	return in->eof;
+}
+
+/**
+ * @brief Drop any partially read line.
+ */
+void
+input_discard(InputReader *in)
+{
+	in->start = in->end;
+}
+
+/**
+ * @brief Release a reader and its buffers.
+ */
+void
+input_close(InputReader *in)
+{
+	if (!in)
+		return;
+
+	if (in->map_len)
+		munmap(in->buf, in->map_len);
+	else
+		free(in->buf);
+
+	if (in->owns_fd)
+		close(in->fd);
+
+	free(in->tail);
+	free(in);
+}
@@ -0,0 +1,109 @@
+/**
+ * @file input.h
+ * @brief Line reader for shell input.
+ *
+ * Reads command lines of arbitrary length from a file descriptor, a
+ * script file or an in-memory string (-c). Script files are mapped
+ * into memory when possible; other descriptors are read through a
+ * large growable buffer.
+ *
+ * A reader over the shell's stdin leaves the input after the current
+ * line to the commands it runs: see input_sync().
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+typedef struct InputReader InputReader;
+
+/**
+ * @brief Create a reader over an open file descriptor.
+ *
+ * The descriptor is not closed by input_close(). Unless it is a
+ * terminal, it is taken to be shared with the commands: a pipe is read
+ * one byte at a time so that nothing past a line is consumed, a
+ * seekable file in chunks that input_sync() hands back.
+ *
+ * @param fd  Descriptor to read from (e.g. STDIN_FILENO).
+ * @return    New reader, or NULL on allocation failure.
+ */
+InputReader *input_from_fd(int fd);
+
+/**
+ * @brief Create a reader over a script file.
+ *
+ * Regular files are mapped with mmap(); anything else falls back to
+ * buffered reads.
+ *
+ * @param path  Path of the script.
+ * @return      New reader, or NULL on failure (errno is set).
+ */
+InputReader *input_from_file(const char *path);
+
+/**
+ * @brief Create a reader over a copy of a string.
+ *
+ * @param s  Null-terminated input, may contain several lines.
+ * @return   New reader, or NULL on allocation failure.
+ */
+InputReader *input_from_string(const char *s);
+
+/**
+ * @brief Read the next line.
+ *
+ * The trailing newline is replaced by a NUL. The returned buffer is
+ * writable and stays valid until the next call on the same reader.
+ *
+ * @param in  Reader.
+ * @return    The line, or NULL on end of input or if the read was
+ *            interrupted (errno == EINTR, input_eof() returns 0).
+ */
+char *input_getline(InputReader *in);
+
+/**
+ * @brief Check whether the next line can be returned without reading.
+ *
+ * An event loop must not wait for its descriptor to become readable
+ * while a complete line is already buffered (e.g. after a paste of
+ * several lines).
+ *
+ * @param in  Reader.
+ * @return    Non-zero if input_getline() will not block.
+ */
+int input_buffered(const InputReader *in);
+
+/**
+ * @brief Give the input after the last line back to the descriptor.
+ *
+ * Called before running a command read from a seekable stdin, so the
+ * command reads what follows its line. The file offset is moved back;
+ * the next input_getline() reuses the buffered data if the offset did
+ * not change meanwhile. Does nothing for other sources.
+ *
+ * @param in  Reader.
+ */
+void input_sync(InputReader *in);
+
+/**
+ * @brief Check whether the reader reached end of input.
+ *
+ * @param in  Reader.
+ * @return    Non-zero if no more lines will be returned.
+ */
+int input_eof(const InputReader *in);
+
+/**
+ * @brief Drop any partially read line (e.g. after Ctrl-C).
+ *
+ * @param in  Reader.
+ */
+void input_discard(InputReader *in);
+
+/**
+ * @brief Release a reader and its buffers.
+ *
+ * @param in  Reader (may be NULL).
+ */
+void input_close(InputReader *in);
+
+#endif /* INPUT_H */
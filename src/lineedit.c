@@ -0,0 +1,912 @@
+/**
+ * @file lineedit.c
+ * @brief Non-canonical terminal line editor with history search.
+ *
+ * The line may wrap over several terminal rows. Every change redraws
+ * it from the end of the prompt: the cursor goes back to the prompt's
+ * row, the old text is cleared to the end of the screen and the new
+ * text is written, followed by the cursor movement to the edit point,
+ * all staged in one buffer and sent with a single write(). Keys that
+ * arrive together (typing ahead, pastes) are applied before one redraw.
+ *
+ * Tab completes the word before the cursor (complete.c).
+ *
+ * Widths count UTF-8 sequences as one column each.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "lineedit.h"
+#include "complete.h"
+#include "error.h"
+#include "history.h"
+#include "prompt.h"
+
+extern int exit_code;
+
+#define KEYS_SIZE    4096
+#define SEARCH_MAX   256
+#define ESC_PARAM    16
+#define KEY_CTRL(c)  ((c) & 0x1f)
+#define KEY_DEL      0x7f
+#define KEY_ESC      0x1b
+#define LIST_ASK     100       /* ask before listing more completions */
+
+/* Where we are in an escape sequence (arrow keys, Home, Delete, ...). */
+typedef enum {
+	ESC_NONE,
+	ESC_START,               /* after ESC */
+	ESC_CSI,                 /* after ESC [ */
+	ESC_SS3                  /* after ESC O */
+} esc_state;
+
+static struct termios cooked;  /* terminal mode to restore */
+static int raw = 0;            /* terminal in editing mode */
+static int active = 0;         /* an unfinished line is on screen */
+
+/* The line, NUL-terminated; pos is the cursor as a byte offset */
+static char *buf = NULL;
+static size_t len = 0;
+static size_t pos = 0;
+static size_t cap = 0;
+
+static size_t cur_row = 0;     /* terminal rows from the prompt's row to the cursor */
+
+/* Keys read but not processed yet */
+static unsigned char keys[KEYS_SIZE];
+static size_t key_start = 0;
+static size_t key_end = 0;
+
+static esc_state esc = ESC_NONE;
+static char esc_param[ESC_PARAM];
+static size_t esc_len = 0;
+
+/* History browsing: the entry shown, history_count() for the own line */
+static size_t hist_pos = 0;
+static char *draft = NULL;     /* the own line while browsing */
+static size_t draft_len = 0;
+
+/* Reverse incremental search */
+static int searching = 0;
+static char query[SEARCH_MAX];
+static size_t qlen = 0;
+static size_t match = HISTORY_NONE;
+static size_t match_off = 0;
+static int failed = 0;         /* the query has no (further) match */
+
+/* Completion */
+static int tabs = 0;           /* consecutive Tab presses */
+static int asking = 0;         /* waiting for y/n before listing */
+static completion listing;     /* the candidates asked about */
+
+/* Output staged for the next write() */
+static char *out = NULL;
+static size_t out_len = 0;
+static size_t out_cap = 0;
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+static void
+out_add(const char *s, size_t n)
+{
+	if (out_len + n > out_cap) {
+		size_t ncap = out_cap ? out_cap : 256;
+		char *nout;
+
+		while (out_len + n > ncap)
+			ncap *= 2;
+		nout = realloc(out, ncap);
+		if (!nout)
+			return;
+		out = nout;
+		out_cap = ncap;
+	}
+
+	memcpy(out + out_len, s, n);
+	out_len += n;
+}
+
+static void
+out_str(const char *s)
+{
+	out_add(s, strlen(s));
+}
+
+/**
+ * @brief Stage a cursor movement ("\x1b[<n><dir>"), if n is not 0.
+ */
+static void
+out_move(size_t n, char dir)
+{
+	char seq[32];
+	int k;
+
+	if (!n)
+		return;
+	k = snprintf(seq, sizeof(seq), "\x1b[%zu%c", n, dir);
+	if (k > 0)
+		out_add(seq, (size_t)k);
+}
+
+static void
+out_flush(void)
+{
+	size_t off = 0;
+
+	while (off < out_len) {
+		ssize_t w = write(STDOUT_FILENO, out + off, out_len - off);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		off += (size_t)w;
+	}
+	out_len = 0;
+}
+
+/**
+ * @brief Columns taken by n bytes of UTF-8 text.
+ */
+static size_t
+text_width(const char *s, size_t n)
+{
+	size_t w = 0;
+
+	for (size_t i = 0; i < n; i++)
+		w += ((unsigned char)s[i] & 0xC0) != 0x80;
+	return w;
+}
+
+static size_t
+term_columns(void)
+{
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+		return 80;
+	return ws.ws_col;
+}
+
+/**
+ * @brief Make room for n more bytes (and the NUL) in buf.
+ */
+static int
+reserve(size_t n)
+{
+	if (len + n + 1 > cap) {
+		size_t ncap = cap ? cap : 128;
+		char *nbuf;
+
+		while (len + n + 1 > ncap)
+			ncap *= 2;
+		nbuf = realloc(buf, ncap);
+		if (!nbuf) {
+			error_print(__func__, "realloc", errno);
+			return -1;
+		}
+		buf = nbuf;
+		cap = ncap;
+	}
+	return 0;
+}
+
+static void
+set_line(const char *s, size_t n)
+{
+	len = 0;
+	if (reserve(n))
+		n = 0;
+	memcpy(buf, s, n);
+	len = pos = n;
+	buf[len] = '\0';
+}
+
+static void
+insert(unsigned char c)
+{
+	if (reserve(1))
+		return;
+	memmove(buf + pos + 1, buf + pos, len - pos + 1);
+	buf[pos++] = (char)c;
+	len++;
+}
+
+/* Delete the bytes [from, to) */
+static void
+delete_range(size_t from, size_t to)
+{
+	if (from >= to)
+		return;
+	memmove(buf + from, buf + to, len - to + 1);
+	len -= to - from;
+	pos = from;
+}
+
+static int
+is_cont(size_t i)
+{
+	return ((unsigned char)buf[i] & 0xC0) == 0x80;
+}
+
+static size_t
+prev_char(size_t p)
+{
+	if (p == 0)
+		return 0;
+	for (p--; p > 0 && is_cont(p); p--)
+		;
+	return p;
+}
+
+static size_t
+next_char(size_t p)
+{
+	if (p >= len)
+		return len;
+	for (p++; p < len && is_cont(p); p++)
+		;
+	return p;
+}
+
+static size_t
+word_left(size_t p)
+{
+	while (p > 0 && buf[p - 1] == ' ')
+		p--;
+	while (p > 0 && buf[p - 1] != ' ')
+		p--;
+	return p;
+}
+
+static size_t
+word_right(size_t p)
+{
+	while (p < len && buf[p] == ' ')
+		p++;
+	while (p < len && buf[p] != ' ')
+		p++;
+	return p;
+}
+
+/**
+ * @brief Redraw the line (or the search) after the prompt.
+ */
+static void
+refresh(void)
+{
+	char head[SEARCH_MAX + 32];
+	const char *text = buf;
+	size_t tlen = len;
+	size_t tpos = pos;
+	size_t hlen = 0;
+	size_t columns = term_columns();
+	size_t start = prompt_width();
+	size_t end_col, cur_col, end_row, row;
+
+	if (searching) {
+		int k = snprintf(head, sizeof(head), "(%sreverse-i-search)`%.*s': ",
+		                 failed ? "failed " : "", (int)qlen, query);
+
+		hlen = k > 0 ? (size_t)k : 0;
+		if (hlen >= sizeof(head))
+			hlen = sizeof(head) - 1;
+		if (match != HISTORY_NONE) {
+			text = history_get(match, &tlen);
+			tpos = match_off;
+		}
+	}
+
+	end_col = start + text_width(head, hlen) + text_width(text, tlen);
+	cur_col = start + text_width(head, hlen) + text_width(text, tpos);
+
+	out_move(cur_row, 'A');
+	out_str("\r");
+	out_move(start, 'C');
+	out_str("\x1b[J");
+	out_add(head, hlen);
+	out_add(text, tlen);
+
+	/* a full last row leaves the cursor in the margin: start the next one */
+	if (end_col && end_col % columns == 0)
+		out_str("\n");
+
+	end_row = end_col / columns;
+	row = cur_col / columns;
+	out_move(end_row - row, 'A');
+	out_str("\r");
+	out_move(cur_col % columns, 'C');
+	cur_row = row;
+
+	out_flush();
+}
+
+/**
+ * @brief Move the cursor from the edit point to the end of the line.
+ */
+static void
+move_to_end(void)
+{
+	size_t columns = term_columns();
+	size_t end_col = prompt_width() + text_width(buf, len);
+
+	if (end_col && end_col % columns == 0)
+		end_col--;
+	out_move(end_col / columns - cur_row, 'B');
+	cur_row = end_col / columns;
+}
+
+/**
+ * @brief Show entry hist_pos + dir, keeping the own line as a draft.
+ */
+static void
+history_move(int dir)
+{
+	size_t n = history_count();
+	const char *s;
+	size_t l;
+
+	if ((dir < 0 && hist_pos == 0) || (dir > 0 && hist_pos >= n))
+		return;
+
+	if (hist_pos == n) {
+		char *copy = malloc(len + 1);
+
+		if (!copy) {
+			error_print(__func__, "malloc", errno);
+			return;
+		}
+		memcpy(copy, buf, len + 1);
+		free(draft);
+		draft = copy;
+		draft_len = len;
+	}
+
+	hist_pos = dir < 0 ? hist_pos - 1 : hist_pos + 1;
+	if (hist_pos == n) {
+		set_line(draft, draft_len);
+	} else {
+		s = history_get(hist_pos, &l);
+		set_line(s, l);
+	}
+}
+
+/**
+ * @brief Search for the query in entries below before.
+ *
+ * A failed search keeps the previous match on screen.
+ */
+static void
+search_from(size_t before)
+{
+	size_t m, l;
+	const char *s;
+
+	query[qlen] = '\0';
+	failed = 0;
+	if (!qlen) {
+		match = HISTORY_NONE;
+		return;
+	}
+
+	m = history_search(query, before);
+	if (m == HISTORY_NONE) {
+		failed = 1;
+		return;
+	}
+
+	match = m;
+	s = history_get(m, &l);
+	for (match_off = 0; match_off + qlen <= l; match_off++) {
+		if (!memcmp(s + match_off, query, qlen))
+			break;
+	}
+}
+
+/**
+ * @brief Leave the search with the match as the line.
+ */
+static void
+search_accept(void)
+{
+	searching = 0;
+	if (match != HISTORY_NONE) {
+		size_t l;
+		const char *s = history_get(match, &l);
+
+		set_line(s, l);
+		pos = match_off;
+		hist_pos = match;
+	}
+}
+
+/**
+ * @brief Insert completed text, quoted to survive the parser.
+ */
+static void
+insert_text(const char *s, size_t n, char quote)
+{
+	for (size_t i = 0; i < n; i++) {
+		if ((!quote && strchr(" \t\\'\"|<>&", s[i])) ||
+		    (quote == '"' && (s[i] == '"' || s[i] == '\\')))
+			insert('\\');
+		insert((unsigned char)s[i]);
+	}
+}
+
+/**
+ * @brief Print the candidates in columns below the line, then a fresh
+ *        prompt; the line is drawn again after it.
+ */
+static void
+show_list(const completion *c)
+{
+	const char *slash = strrchr(c->word, '/');
+	size_t skip = slash ? (size_t)(slash - c->word) + 1 : 0;
+	size_t columns = term_columns();
+	size_t width = 0;
+	size_t ncols, rows;
+
+	for (size_t i = 0; i < c->nmatches; i++) {
+		size_t w = text_width(c->matches[i] + skip, strlen(c->matches[i] + skip));
+
+		if (w > width)
+			width = w;
+	}
+	width += 2;
+	ncols = columns / width ? columns / width : 1;
+	rows = (c->nmatches + ncols - 1) / ncols;
+
+	for (size_t r = 0; r < rows; r++) {
+		for (size_t col = 0; col < ncols; col++) {
+			size_t i = col * rows + r;
+			const char *name;
+			size_t w;
+
+			if (i >= c->nmatches)
+				break;
+			name = c->matches[i] + skip;
+			out_str(name);
+			if (i + rows >= c->nmatches)
+				break;
+			for (w = text_width(name, strlen(name)); w < width; w++)
+				out_add(" ", 1);
+		}
+		out_str("\n");
+	}
+
+	out_flush();
+	prompt_reprint(exit_code);
+	cur_row = 0;
+}
+
+/**
+ * @brief Complete the word before the cursor.
+ *
+ * Inserts what all candidates have in common, and a space (closing an
+ * open quote) after a unique one. With nothing to add, the first Tab
+ * rings the bell and the second lists the candidates.
+ */
+static void
+complete_key(void)
+{
+	completion c;
+	size_t typed, common, last;
+
+	if (complete_word(buf, pos, &c))
+		return;
+	if (!c.nmatches) {
+		out_str("\a");
+		complete_free(&c);
+		return;
+	}
+
+	typed = strlen(c.word);
+	last = c.nmatches - 1;
+	for (common = typed; c.matches[0][common] &&
+	     c.matches[0][common] == c.matches[last][common]; common++)
+		;
+
+	if (common > typed)
+		insert_text(c.matches[0] + typed, common - typed, c.quote);
+
+	if (c.nmatches == 1) {
+		if (common && c.matches[0][common - 1] != '/') {
+			if (c.quote)
+				insert((unsigned char)c.quote);
+			insert(' ');
+		}
+	} else if (common == typed) {
+		if (tabs < 2) {
+			out_str("\a");
+		} else if (c.nmatches > LIST_ASK) {
+			char msg[64];
+
+			move_to_end();
+			snprintf(msg, sizeof(msg), "\nDisplay all %zu possibilities? (y or n)",
+			         c.nmatches);
+			out_str(msg);
+			out_flush();
+			listing = c;
+			asking = 1;
+			return;
+		} else {
+			move_to_end();
+			out_str("\n");
+			show_list(&c);
+		}
+	}
+
+	complete_free(&c);
+}
+
+static int
+finish(void)
+{
+	pos = len;
+	refresh();
+	move_to_end();
+	out_str("\n");
+	out_flush();
+	active = 0;
+	return LINEEDIT_DONE;
+}
+
+/**
+ * @brief Handle a key while searching.
+ *
+ * @return  A LINEEDIT_* result, or -1 if the search ended and the key
+ *          must be handled as a normal key.
+ */
+static int
+search_key(unsigned char c)
+{
+	switch (c) {
+	case KEY_CTRL('R'):
+		if (qlen)
+			search_from(match == HISTORY_NONE ? history_count() : match);
+		return LINEEDIT_MORE;
+	case KEY_CTRL('G'):
+		searching = 0;
+		return LINEEDIT_MORE;
+	case KEY_CTRL('H'):
+	case KEY_DEL:
+		while (qlen > 0 && ((unsigned char)query[--qlen] & 0xC0) == 0x80)
+			;
+		match = HISTORY_NONE;
+		search_from(history_count());
+		return LINEEDIT_MORE;
+	case '\n':
+	case '\r':
+		search_accept();
+		return finish();
+	default:
+		if (c >= 0x20) {
+			if (qlen < SEARCH_MAX - 1) {
+				query[qlen++] = (char)c;
+				search_from(match == HISTORY_NONE ? history_count() : match + 1);
+			}
+			return LINEEDIT_MORE;
+		}
+		search_accept();
+		return -1;
+	}
+}
+
+/**
+ * @brief Handle the final character of an escape sequence.
+ */
+static void
+escape_key(unsigned char c, const char *param)
+{
+	/* ESC [ 1 ; 5 C (Ctrl) and ESC [ 1 ; 3 C (Alt) move by words */
+	int word = strstr(param, ";5") || strstr(param, ";3");
+
+	switch (c) {
+	case 'A':
+		history_move(-1);
+		break;
+	case 'B':
+		history_move(1);
+		break;
+	case 'C':
+		pos = word ? word_right(pos) : next_char(pos);
+		break;
+	case 'D':
+		pos = word ? word_left(pos) : prev_char(pos);
+		break;
+	case 'H':
+		pos = 0;
+		break;
+	case 'F':
+		pos = len;
+		break;
+	case '~':
+		if (!strcmp(param, "1") || !strcmp(param, "7"))
+			pos = 0;
+		else if (!strcmp(param, "4") || !strcmp(param, "8"))
+			pos = len;
+		else if (!strcmp(param, "3"))
+			delete_range(pos, next_char(pos));
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Apply one key.
+ *
+ * @return  A LINEEDIT_* result.
+ */
+static int
+key(unsigned char c)
+{
+	tabs = c == '\t' ? tabs + 1 : 0;
+
+	if (asking) {
+		asking = 0;
+		out_str("\n");
+		if (c == 'y' || c == 'Y' || c == ' ') {
+			show_list(&listing);
+		} else {
+			out_flush();
+			prompt_reprint(exit_code);
+			cur_row = 0;
+		}
+		complete_free(&listing);
+		return LINEEDIT_MORE;
+	}
+
+	switch (esc) {
+	case ESC_START:
+		esc = ESC_NONE;
+		if (c == '[' || c == 'O') {
+			esc = c == '[' ? ESC_CSI : ESC_SS3;
+			esc_len = 0;
+		} else if (c == 'b') {
+			pos = word_left(pos);
+		} else if (c == 'f') {
+			pos = word_right(pos);
+		} else if (c == KEY_DEL) {
+			delete_range(word_left(pos), pos);
+		}
+		return LINEEDIT_MORE;
+	case ESC_CSI:
+		if (c >= 0x20 && c <= 0x3f) {
+			if (esc_len < ESC_PARAM - 1)
+				esc_param[esc_len++] = (char)c;
+			return LINEEDIT_MORE;
+		}
+		/* fall through */
+	case ESC_SS3:
+		esc_param[esc == ESC_CSI ? esc_len : 0] = '\0';
+		esc = ESC_NONE;
+		escape_key(c, esc_param);
+		return LINEEDIT_MORE;
+	default:
+		break;
+	}
+
+	if (searching) {
+		int r = search_key(c);
+
+		if (r != -1)
+			return r;
+	}
+
+	switch (c) {
+	case '\n':
+	case '\r':
+		return finish();
+	case KEY_CTRL('A'):
+		pos = 0;
+		break;
+	case KEY_CTRL('E'):
+		pos = len;
+		break;
+	case KEY_CTRL('B'):
+		pos = prev_char(pos);
+		break;
+	case KEY_CTRL('F'):
+		pos = next_char(pos);
+		break;
+	case KEY_CTRL('D'):
+		if (!len) {
+			active = 0;
+			return LINEEDIT_EOF;
+		}
+		delete_range(pos, next_char(pos));
+		break;
+	case KEY_CTRL('H'):
+	case KEY_DEL:
+		delete_range(prev_char(pos), pos);
+		break;
+	case KEY_CTRL('K'):
+		len = pos;
+		buf[len] = '\0';
+		break;
+	case KEY_CTRL('U'):
+		delete_range(0, pos);
+		break;
+	case KEY_CTRL('W'):
+		delete_range(word_left(pos), pos);
+		break;
+	case KEY_CTRL('P'):
+		history_move(-1);
+		break;
+	case KEY_CTRL('N'):
+		history_move(1);
+		break;
+	case KEY_CTRL('R'):
+		searching = 1;
+		qlen = 0;
+		match = HISTORY_NONE;
+		failed = 0;
+		break;
+	case KEY_ESC:
+		esc = ESC_START;
+		break;
+	case '\t':
+		complete_key();
+		break;
+	default:
+		if (c >= 0x20)
+			insert(c);
+		break;
+	}
+	return LINEEDIT_MORE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Start editing a new line.
+ */
+int
+lineedit_begin(void)
+{
+	const char *term = getenv("TERM");
+	struct termios t;
+
+	if (term && !strcmp(term, "dumb"))
+		return -1;
+	if (tcgetattr(STDIN_FILENO, &cooked) == -1)
+		return -1;
+
+	t = cooked;
+	t.c_lflag &= ~(tcflag_t)(ICANON | ECHO | IEXTEN);
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSADRAIN, &t) == -1)
+		return -1;
+	raw = 1;
+
+	if (reserve(0)) {
+		lineedit_end();
+		return -1;
+	}
+	len = pos = 0;
+	buf[0] = '\0';
+	cur_row = 0;
+	esc = ESC_NONE;
+	searching = 0;
+	hist_pos = history_count();
+	free(draft);
+	draft = NULL;
+	active = 1;
+	return 0;
+}
+
+/**
+ * Process the keys that are available on stdin.
+ */
+int
+lineedit_feed(char **line)
+{
+	if (key_start == key_end) {
+		ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+
+		if (n < 0)
+			return LINEEDIT_ERROR;
+		if (n == 0) {
+			active = 0;
+			return LINEEDIT_EOF;
+		}
+		key_start = 0;
+		key_end = (size_t)n;
+	}
+
+	while (key_start < key_end) {
+		int r = key(keys[key_start++]);
+
+		if (r != LINEEDIT_MORE) {
+			*line = buf;
+			return r;
+		}
+	}
+
+	if (!asking)
+		refresh();
+	return LINEEDIT_MORE;
+}
+
+/**
+ * Check whether keys are buffered.
+ */
+int
+lineedit_pending(void)
+{
+	return key_start < key_end;
+}
+
+/**
+ * Move the cursor below the line being edited.
+ */
+void
+lineedit_pause(void)
+{
+	if (!active)
+		return;
+	if (asking) {
+		/* the cursor is after the question, which is dropped */
+		complete_free(&listing);
+		asking = 0;
+		return;
+	}
+	move_to_end();
+	out_flush();
+}
+
+/**
+ * Draw the line being edited again after a fresh prompt.
+ */
+void
+lineedit_redraw(void)
+{
+	if (!active)
+		return;
+	cur_row = 0;
+	refresh();
+}
+
+/**
+ * Stop editing and restore the terminal mode.
+ */
+void
+lineedit_end(void)
+{
+	if (asking) {
+		/* the cursor is after the question */
+		complete_free(&listing);
+		asking = 0;
+	} else if (active) {
+		move_to_end();
+	}
+
+	if (active) {
+		/* interrupted: drop the line and whatever was typed after it */
+		out_str("^C");
+		out_flush();
+		key_start = key_end = 0;
+		active = 0;
+	}
+
+	if (raw) {
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+		raw = 0;
+	}
+}
@@ -0,0 +1,79 @@
+/**
+ * @file lineedit.h
+ * @brief Line editor for interactive input.
+ *
+ * Reads the terminal in non-canonical mode and edits the line in place:
+ * cursor movement (arrows, Home/End, ^A ^E ^B ^F, Alt-B/F), deletion
+ * (Backspace, Delete, ^D, ^K, ^U, ^W), history browsing (Up/Down, ^P
+ * ^N), reverse incremental search (^R, ^G to cancel) and completion
+ * of commands and file names (Tab, twice to list). Terminal signals
+ * stay enabled, so ^C and ^Z behave as before.
+ *
+ * The editor is driven by the caller's event loop: lineedit_begin()
+ * after the prompt, then lineedit_feed() whenever the terminal is
+ * readable, until it returns something other than LINEEDIT_MORE.
+ */
+
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+/* Results of lineedit_feed(). */
+#define LINEEDIT_MORE  0   /* line not finished yet */
+#define LINEEDIT_DONE  1   /* line entered */
+#define LINEEDIT_EOF   2   /* ^D on an empty line, or hangup */
+#define LINEEDIT_ERROR 3   /* read failed; errno is set (EINTR for ^C) */
+
+/**
+ * @brief Start editing a new line.
+ *
+ * Switches the terminal to non-canonical mode. The prompt must already
+ * be printed; the input starts prompt_width() columns into its line.
+ *
+ * @return  0 on success, -1 if stdin is not a terminal the editor can
+ *          drive (the caller reads lines without editing then).
+ */
+int lineedit_begin(void);
+
+/**
+ * @brief Process the keys that are available on stdin.
+ *
+ * Reads at most once; keys left over after the end of the line (a
+ * paste of several lines) are kept for the next line.
+ *
+ * @param line  Output: the line, NUL-terminated, with LINEEDIT_DONE.
+ *              Writable and valid until the next lineedit_begin().
+ * @return      One of the LINEEDIT_* results.
+ */
+int lineedit_feed(char **line);
+
+/**
+ * @brief Check whether keys are buffered, so lineedit_feed() would not
+ *        need to read.
+ *
+ * @return  Non-zero if keys are pending.
+ */
+int lineedit_pending(void);
+
+/**
+ * @brief Move the cursor below the line being edited.
+ *
+ * For output that has to appear while a line is edited (job
+ * notifications). Print a fresh prompt afterwards and call
+ * lineedit_redraw().
+ */
+void lineedit_pause(void);
+
+/**
+ * @brief Draw the line being edited again after a fresh prompt.
+ */
+void lineedit_redraw(void);
+
+/**
+ * @brief Stop editing and restore the terminal mode.
+ *
+ * Leaves the cursor after the line; an unfinished line (^C) is marked
+ * with "^C".
+ */
+void lineedit_end(void);
+
+#endif /* LINEEDIT_H */
@@ -7,14 +7,17 @@
  * Department of Electrical and Computer Engineering,
  * Aristotle University of Thessaloniki.
  *
- * Usage: ./tinyshell
- * Takes no input arguments.
+ * Usage: ./tinyshell [-c command | script]
+ *   (none)       Read commands from stdin; interactive if stdin is a tty.
+ *   -c command   Execute the lines of command and exit.
+ *   script       Execute the lines of the script file and exit.
  */
 
 #define _POSIX_C_SOURCE 200809L
 
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,12 +25,24 @@
 #include <unistd.h>
 
 #include "error.h"
+#include "history.h"
+#include "input.h"
+#include "lineedit.h"
+#include "options.h"
 #include "parser.h"
 #include "pipeline.h"
+#include "prompt.h"
+#include "scriptcache.h"
 #include "signal_setup.h"
 
-#define INPUT_MAX 4096
 #define EXIT_INTERNAL_ERROR 255
+#define EXIT_USAGE          2
+#define EXIT_NOT_FOUND      127
+
+/* Results of read_line() besides EXIT_INTERNAL_ERROR */
+#define READ_LINE            0
+#define READ_EOF             1
+#define READ_INTR           -1
 
 /**
  * @brief Global exit code of the last executed command.
@@ -35,107 +50,249 @@
 int exit_code = 0;
 
 /**
- * @brief Print the interactive shell prompt.
+ * @brief Non-zero when reading commands from a terminal.
  *
- * The prompt has the form:
- *     username@hostname: cwd
- *     [exit_code]->
+ * Controls the prompt and job control. Scripts, -c strings and piped
+ * input are never interactive.
+ */
+int interactive = 0;
+
+/**
+ * @brief Non-zero while the line editor reads the current line.
+ */
+static int editing = 0;
+
+/**
+ * @brief Wait until a line can be read, handling child events meanwhile.
  *
- * The current working directory is shortened by replacing the user's
- * home directory prefix with '~'.
+ * Polls terminal input together with signal_child_fd(). Background jobs
+ * that finish or stop while the user is at the prompt are reported
+ * right away, followed by a fresh prompt, unless `set +b` defers the
+ * report to the next prompt. Non-interactive input is read
+ * directly; its jobs are reaped between lines.
  *
- * @param code  Exit code of the previous command.
- * @return      0 on success, -1 on failure.
+ * @param in  Source of command lines.
+ * @return    0 when input is ready, -1 if interrupted (Ctrl+C), or
+ *            EXIT_INTERNAL_ERROR if the prompt could not be printed.
  */
 static int
-print_prompt(unsigned int code)
+wait_input(InputReader *in)
 {
-	const char *user;
-	const char *home;
-	char hostname[HOST_NAME_MAX];
-	char cwd[PATH_MAX];
-	char display[PATH_MAX];
-	size_t home_len;
-
-	home = getenv("HOME");
-	if (!home) {
-		error_print(__func__, "getenv \"HOME\"", errno);
-		return -1;
-	}
+	struct pollfd fds[2];
 
-	user = getenv("USER");
-	if (!user) {
-		error_print(__func__, "getenv \"USER\"", errno);
-		return -1;
-	}
+	if (!interactive || input_buffered(in) || (editing && lineedit_pending()))
+		return 0;
+
+	fds[0].fd = STDIN_FILENO;
+	fds[0].events = POLLIN;
+	fds[1].fd = signal_child_fd();
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				return -1;
+			error_print(__func__, "poll", errno);
+			return 0;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			pipeline_reap();
+			if (options_get(OPT_NOTIFY) && pipeline_jobs_changed()) {
+				if (editing)
+					lineedit_pause();
+				fputc('\n', stderr);
+				pipeline_notify_jobs();
+				if (prompt_reprint(exit_code))
+					return EXIT_INTERNAL_ERROR;
+				if (editing)
+					lineedit_redraw();
+			}
+		}
 
-	if (gethostname(hostname, sizeof(hostname))) {
-		error_print(__func__, "gethostname", errno);
-		return -1;
+		/* readable, hung up or error: let the reader find out which */
+		if (fds[0].revents)
+			return 0;
 	}
-	hostname[sizeof(hostname) - 1] = '\0';
+}
+
+/**
+ * @brief Read the next command line.
+ *
+ * Interactive shells edit the line with the line editor; other input,
+ * and terminals the editor cannot drive, go through the input reader.
+ *
+ * @param in    Source of command lines.
+ * @param line  Output: the line, with READ_LINE.
+ * @return      READ_LINE, READ_EOF, READ_INTR (Ctrl+C) or
+ *              EXIT_INTERNAL_ERROR.
+ */
+static int
+read_line(InputReader *in, char **line)
+{
+	int ret;
 
-	if (!getcwd(cwd, sizeof(cwd))) {
-		error_print(__func__, "getcwd", errno);
-		return -1;
+	editing = interactive && lineedit_begin() == 0;
+	if (!editing) {
+		ret = wait_input(in);
+		if (ret)
+			return ret;
+		*line = input_getline(in);
+		if (*line) {
+			/* what follows the line is the commands' to read */
+			input_sync(in);
+			return READ_LINE;
+		}
+		if (input_eof(in))
+			return READ_EOF;
+		input_discard(in);
+		return READ_INTR;
 	}
 
-	/* Shorten home prefix to ~ */
-	home_len = strlen(home);
-	if (!strncmp(cwd, home, home_len) &&
-	    (cwd[home_len] == '/' || cwd[home_len] == '\0')) {
-		snprintf(display, sizeof(display), "~%s", cwd + home_len);
-	} else {
-		snprintf(display, sizeof(display), "%s", cwd);
+	do {
+		ret = wait_input(in);
+		if (ret)
+			break;
+		switch (lineedit_feed(line)) {
+		case LINEEDIT_MORE:
+			ret = -2;
+			break;
+		case LINEEDIT_DONE:
+			ret = READ_LINE;
+			break;
+		case LINEEDIT_EOF:
+			ret = READ_EOF;
+			break;
+		default:
+			ret = errno == EINTR ? READ_INTR : READ_EOF;
+			break;
+		}
+	} while (ret == -2);
+
+	lineedit_end();
+	editing = 0;
+	return ret;
+}
+
+/**
+ * @brief Lines read for here-documents by the last parse.
+ */
+static int more_lines = 0;
+
+/**
+ * @brief Read a here-document line (parser_line_fn).
+ *
+ * Interactive shells show the continuation prompt first.
+ *
+ * @param arg  The InputReader of the main loop.
+ * @return     The line, or NULL at end of input or on Ctrl+C (errno
+ *             EINTR).
+ */
+static char*
+read_more(void *arg)
+{
+	char *line;
+	int ret;
+
+	more_lines++;
+	if (interactive && prompt_print_continuation()) {
+		errno = 0;
+		return NULL;
 	}
 
-	printf("\n%s@%s: %s\n[%u]-> ", user, hostname, display, code);
-	fflush(stdout);
-	return 0;
+	ret = read_line(arg, &line);
+	errno = ret == READ_INTR ? EINTR : 0;
+	return ret == READ_LINE ? line : NULL;
 }
 
 /**
  * @brief Main read-eval-print loop of the shell.
  *
- * Repeatedly prints the prompt, reads a line, parses it,
- * and executes the resulting pipeline. Runs until EOF or
- * the exit builtin is invoked.
+ * Repeatedly reads a line, parses it, and executes the resulting
+ * pipeline. When interactive, job notifications and the prompt are
+ * printed before each line, and notifications for jobs finishing while
+ * waiting for input are printed as they happen. Runs until EOF or the
+ * exit builtin is invoked.
+ *
+ * @param in     Source of command lines.
+ * @param cache  Script cache to record the parsed lines into, or NULL.
  */
 static void
-main_loop(void)
+main_loop(InputReader *in, ScriptCache *cache)
 {
-	char buf[INPUT_MAX];
-	Command *cmd;
+	char *line;
+	char *expanded;
+	char *owned;
+	char *source;
+	Pipeline *pipeline;
 	int ret;
 
 	while (1) {
 		pipeline_notify_jobs();
 
-		if (print_prompt(exit_code)) {
+		if (interactive && prompt_print(exit_code)) {
 			exit_code = EXIT_INTERNAL_ERROR;
 			return;
 		}
 
-		if (!fgets(buf, sizeof(buf), stdin)) {
-			if (feof(stdin)) {
+		ret = read_line(in, &line);
+		if (ret == EXIT_INTERNAL_ERROR) {
+			exit_code = EXIT_INTERNAL_ERROR;
+			return;
+		}
+		if (ret == READ_EOF) {
+			if (interactive)
 				printf("\n");
-				break;
-			}
+			scriptcache_store(cache);
+			break;
+		}
+		if (ret == READ_INTR) {
 			/* Interrupted by signal (Ctrl+C), print newline and reprompt */
-			clearerr(stdin);
 			printf("\n");
 			continue;
 		}
 
-		cmd = parser_parse(buf);
-		if (!cmd || cmd->argc <= 0)
+		expanded = NULL;
+		if (interactive) {
+			ret = history_expand(line, &expanded);
+			if (ret == -1)
+				continue;
+			if (ret == 1) {
+				line = expanded;
+				printf("%s\n", line);
+			}
+			history_add(line);
+		}
+
+		/* here-document lines reuse the reader's buffer: parse a copy */
+		owned = strstr(line, "<<") ? strdup(line) : NULL;
+		if (owned)
+			line = owned;
+
+		/* the parser unquotes in place: keep the line as read for the cache */
+		source = cache ? strdup(line) : NULL;
+		more_lines = 0;
+		pipeline = parser_parse_more(line, read_more, in);
+		if (cache) {
+			/* the text alone does not replay a line with here-documents */
+			scriptcache_add(cache, more_lines ? NULL : source, pipeline);
+			free(source);
+		}
+		if (!pipeline) {
+			free(owned);
+			free(expanded);
 			continue;
+		}
 
-		ret = execute_pipeline(cmd);
-		parser_free_cmd(cmd);
+		ret = execute_pipeline(pipeline);
+		parser_free_pipeline(pipeline);
+		free(owned);
+		free(expanded);
 
 		if (ret == 1) {
-			/* exit builtin was invoked */
+			/* exit builtin was invoked; scripts have no control flow,
+			 * so the lines after it never run and need no cache entry */
+			scriptcache_store(cache);
 			return;
 		}
 
@@ -146,23 +303,122 @@ main_loop(void)
 	}
 }
 
+/**
+ * @brief Run a script from its compile cache.
+ *
+ * Same as main_loop() for a script, with the pipelines taken from the
+ * cache instead of being read and parsed.
+ *
+ * @param cache  Cache with scriptcache_hit().
+ */
+static void
+replay_loop(ScriptCache *cache)
+{
+	Pipeline *pipeline;
+	char *line;
+	int ret;
+
+	while (scriptcache_next(cache, &pipeline, &line)) {
+		pipeline_notify_jobs();
+
+		if (pipeline) {
+			ret = execute_pipeline(pipeline);
+		} else {
+			/* parse again: for the diagnostics, or to rerun substitutions */
+			pipeline = parser_parse(line);
+			if (!pipeline)
+				continue;
+			ret = execute_pipeline(pipeline);
+			parser_free_pipeline(pipeline);
+		}
+
+		if (ret == 1 || ret == -1)
+			return;
+	}
+}
+
+/**
+ * @brief Open $HISTFILE, or ~/.tinyshell_history.
+ *
+ * Without either, the history lasts for the session.
+ */
+static void
+open_history(void)
+{
+	const char *path = getenv("HISTFILE");
+	const char *home = getenv("HOME");
+	char buf[PATH_MAX];
+
+	if (!path || !*path) {
+		path = NULL;
+		if (home && *home &&
+		    snprintf(buf, sizeof(buf), "%s/.tinyshell_history", home) < (int)sizeof(buf))
+			path = buf;
+	}
+
+	history_open(path);
+}
+
 /**
  * @brief Program entry point.
  *
- * Initializes error reporting and signal handlers, then enters
- * the main loop.
+ * Initializes error reporting, selects the input source from the
+ * command line, sets up signal handlers, then enters the main loop.
  *
  * @return Exit code of last command.
  */
 int
-main(int argc __attribute__((unused)), char *argv[])
+main(int argc, char *argv[])
 {
+	InputReader *in;
+	ScriptCache *cache = NULL;
+
 	error_set_name(argv[0]);
+	pipeline_zygote_helper(argc, argv);
 
-	if (signal_setup()) {
+	if (argc > 1 && !strcmp(argv[1], "-c")) {
+		if (argc < 3) {
+			error_print(NULL, "-c: option requires an argument", 0);
+			return EXIT_USAGE;
+		}
+		in = input_from_string(argv[2]);
+	} else if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+		error_print(NULL, "usage: tinyshell [-c command | script]", 0);
+		return EXIT_USAGE;
+	} else if (argc > 1) {
+		cache = scriptcache_open(argv[1]);
+		in = input_from_file(argv[1]);
+		if (!in) {
+			scriptcache_close(cache);
+			error_print(argv[1], strerror(errno), 0);
+			return EXIT_NOT_FOUND;
+		}
+	} else {
+		interactive = isatty(STDIN_FILENO);
+		in = input_from_fd(STDIN_FILENO);
+	}
+
+	if (!in) {
+		error_print(__func__, "malloc", errno);
 		return EXIT_INTERNAL_ERROR;
 	}
 
-	main_loop();
+	if (signal_setup(interactive)) {
+		scriptcache_close(cache);
+		input_close(in);
+		return EXIT_INTERNAL_ERROR;
+	}
+
+	if (interactive)
+		open_history();
+
+	if (scriptcache_hit(cache))
+		replay_loop(cache);
+	else
+		main_loop(in, cache);
+	if (interactive)
+		history_close();
+	scriptcache_close(cache);
+	input_close(in);
 	return exit_code;
 }
@@ -0,0 +1,165 @@
+/**
+ * @file options.c
+ * @brief Implementation of shell options.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "options.h"
+#include "error.h"
+
+typedef enum {
+	KIND_SWITCH,     /* on/off */
+	KIND_SIZE,       /* name=size, see options_parse_size() */
+	KIND_NUMBER      /* name=integer within [min, max] */
+} option_kind;
+
+typedef struct {
+	const char *name;
+	int value;
+	int supported;   /* compiled into this build */
+	option_kind kind;
+	int unset;       /* value of a valued option left at its default */
+	int min, max;    /* KIND_NUMBER range */
+} option_t;
+
+static option_t options[OPT_COUNT] = {
+	[OPT_SPAWN]      = { "spawn",      USE_POSIX_SPAWN, USE_POSIX_SPAWN,
+	                     KIND_SWITCH, 0, 0, 0 },
+	[OPT_PIPEBUF]    = { "pipebuf",    0,  1, KIND_SIZE,   0,  0,   0 },
+	[OPT_PIN_STAGES] = { "pin-stages", 0,  1, KIND_SWITCH, 0,  0,   0 },
+	[OPT_NICE]       = { "nice",       0,  1, KIND_NUMBER, 0,  -20, 19 },
+	[OPT_IONICE]     = { "ionice",     -1, 1, KIND_NUMBER, -1, 0,   7 },
+	[OPT_NOTIFY]     = { "notify",     1,  1, KIND_SWITCH, 0,  0,   0 },
+	[OPT_ZYGOTE]     = { "zygote",     0,  USE_ZYGOTE, KIND_SWITCH, 0, 0, 0 },
+	[OPT_GLOBSTAR]   = { "globstar",   0,  1, KIND_SWITCH, 0,  0,   0 },
+};
+
+/**
+ * @brief Parse the value of a valued option into *value.
+ */
+static int
+option_parse(const option_t *o, const char *s, int *value)
+{
+	char *end;
+	long v;
+
+	if (o->kind == KIND_SIZE)
+		return options_parse_size(s, value);
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (end == s || *end || errno || v < o->min || v > o->max)
+		return -1;
+
+	*value = (int)v;
+	return 0;
+}
+
+/**
+ * @brief Get the current value of an option.
+ */
+int
+options_get(shell_option opt)
+{
+	return options[opt].value;
+}
+
+/**
+ * @brief Enable or disable an option by name.
+ */
+int
+options_set(const char *name, int on)
+{
+	const char *eq = strchr(name, '=');
+	size_t len = eq ? (size_t)(eq - name) : strlen(name);
+
+	for (int i = 0; i < OPT_COUNT; i++) {
+		option_t *o = &options[i];
+		int valued = o->kind != KIND_SWITCH;
+
+		if (strncmp(o->name, name, len) || o->name[len])
+			continue;
+
+		if (on && !o->supported) {
+			error_print(name, "not supported by this build", 0);
+			return -1;
+		}
+
+		/* switches take no value; valued options need one to be set */
+		if (eq ? !(on && valued) : (on && valued)) {
+			error_print(name, "invalid option value", 0);
+			return -1;
+		}
+
+		if (!eq) {
+			o->value = valued ? o->unset : (on ? 1 : 0);
+			return 0;
+		}
+
+		if (option_parse(o, eq + 1, &o->value)) {
+			error_print(name, "invalid option value", 0);
+			return -1;
+		}
+		return 0;
+	}
+
+	error_print(name, "invalid option name", 0);
+	return -1;
+}
+
+/**
+ * @brief Parse a size with an optional K, M or G (binary) suffix.
+ */
+int
+options_parse_size(const char *s, int *size)
+{
+	char *end;
+	long v;
+	int shift = 0;
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (end == s || errno || v < 0)
+		return -1;
+
+	if (*end) {
+		static const char units[] = "KMG";
+		const char *u = strchr(units, toupper((unsigned char)*end));
+
+		if (!u || end[1])
+			return -1;
+		shift = 10 * (int)(u - units + 1);
+	}
+
+	if (v > (INT_MAX >> shift))
+		return -1;
+
+	*size = (int)(v << shift);
+	return 0;
+}
+
+/**
+ * @brief Print all options and their state to stdout.
+ */
+void
+options_print(void)
+{
+	for (int i = 0; i < OPT_COUNT; i++) {
+		const option_t *o = &options[i];
+
+		if (o->kind == KIND_SWITCH)
+			printf("%-15s\t%s\n", o->name, o->value ? "on" : "off");
+		else if (o->value == o->unset)
+			printf("%-15s\tdefault\n", o->name);
+		else
+			printf("%-15s\t%d\n", o->name, o->value);
+	}
+}
@@ -0,0 +1,81 @@
+/**
+ * @file options.h
+ * @brief Shell options toggled with the `set` builtin.
+ *
+ * Options are named switches that change how the shell executes
+ * commands. They are listed with `set -o`, enabled with `set -o name`
+ * and disabled with `set +o name`. Valued options are set with
+ * `set -o name=value` and reset to their default with `set +o name`.
+ * `set -b` and `set +b` are short for `set -o notify` and `set +o notify`.
+ */
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+/*
+ * Build-time switch for the posix_spawn() back end
+ * (make SPAWN=0 builds a fork()-only shell).
+ */
+#ifndef USE_POSIX_SPAWN
+#define USE_POSIX_SPAWN 1
+#endif
+
+/* The zygote launcher needs clone(CLONE_PARENT), which is Linux-only. */
+#ifndef USE_ZYGOTE
+#ifdef __linux__
+#define USE_ZYGOTE 1
+#else
+#define USE_ZYGOTE 0
+#endif
+#endif
+
+/**
+ * Option identifiers.
+ */
+typedef enum {
+	OPT_SPAWN = 0,   /* Launch external commands with posix_spawn() */
+	OPT_PIPEBUF,     /* Pipe buffer size in bytes, 0 for the kernel default */
+	OPT_PIN_STAGES,  /* Pin each forked pipeline stage to its own CPU */
+	OPT_NICE,        /* Nice increment for pipeline stages, 0 for none */
+	OPT_IONICE,      /* Best-effort I/O priority level (0-7), -1 for none */
+	OPT_NOTIFY,      /* Report job changes while at the prompt (set -b) */
+	OPT_ZYGOTE,      /* Launch external commands from the zygote process */
+	OPT_GLOBSTAR,    /* Let ** match any number of directories */
+	OPT_COUNT
+} shell_option;
+
+/**
+ * @brief Get the current value of an option.
+ *
+ * @param opt  Option identifier.
+ * @return     Non-zero if the option is enabled; the value of a valued
+ *             option.
+ */
+int options_get(shell_option opt);
+
+/**
+ * @brief Enable or disable an option by name.
+ *
+ * @param name  Option name as shown by `set -o`, followed by "=value"
+ *              for valued options when on is non-zero.
+ * @param on    Non-zero to enable (or set), zero to disable (or reset).
+ * @return      0 on success, -1 if the option is unknown, unsupported
+ *              or the value is invalid.
+ */
+int options_set(const char *name, int on);
+
+/**
+ * @brief Parse a size with an optional K, M or G (binary) suffix.
+ *
+ * @param s     String such as "65536", "512K" or "1M".
+ * @param size  Output: size in bytes.
+ * @return      0 on success, -1 if s is not a size that fits an int.
+ */
+int options_parse_size(const char *s, int *size);
+
+/**
+ * @brief Print all options and their state to stdout.
+ */
+void options_print(void);
+
+#endif /* OPTIONS_H */
@@ -2,17 +2,21 @@
  * @file parser.c
  * @brief Command line parser for shell input.
  *
- * Tokenizes and parses shell command lines into a pipeline of
- * Command structures. Supports:
+ * Tokenizes and parses shell command lines into a Pipeline: a single
+ * block with the stage array, the argv arrays and a packed string table,
+ * built from per-stage drafts once the line has been parsed. Supports:
  *
  *   - Pipes (|)
  *   - Background execution (&) (must appear at end of line)
  *   - Input redirection (<)
+ *   - Here-documents (<<word, <<-word) and here-strings (<<<word)
  *   - Output redirection (>, >>)
  *   - Stderr redirection (2>, 2>>)
  *   - Single and double quotes
  *   - Backslash escapes within double quotes
  *   - Tilde expansion (~, ~/path)
+ *   - Command substitution ($(...)), run while the line is parsed
+ *   - Pathname expansion (*, ?, [...], and ** with globstar)
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -23,15 +27,27 @@
 #include <string.h>
 
 #include "parser.h"
+#include "arena.h"
 #include "error.h"
+#include "options.h"
+#include "pathglob.h"
+#include "pipeline.h"
 
-#define TOKEN_BUFFER_SIZE 4096
+#define ARGV_INIT_CAP     8
+#define ARENA_POOL_MAX    4
+#define WORD_INIT_CAP     64
+
+/* Characters that split unquoted command substitution output */
+#define SUBST_IFS " \t\n"
 
 enum token_type {
 	TOK_WORD,
 	TOK_PIPE,
 	TOK_BG,
 	TOK_REDIR_IN,
+	TOK_HEREDOC,
+	TOK_HEREDOC_STRIP,
+	TOK_HERESTRING,
 	TOK_REDIR_OUT,
 	TOK_REDIR_OUT_APPEND,
 	TOK_REDIR_ERR,
@@ -40,10 +56,161 @@ enum token_type {
 	TOK_ERROR
 };
 
+/*
+ * One field of a word that command substitution split into several.
+ */
+typedef struct word_field word_field;
+struct word_field {
+	char *s;
+	int glob;             /* s is a pattern to expand */
+	word_field *next;
+};
+
+/*
+ * Tokenizer state. Words are terminated in place, so a NUL may overwrite
+ * the operator that follows a word; that operator is kept in held and
+ * takes the place of *p until the lexer advances.
+ */
+typedef struct {
+	char *p;              /* current position in the input buffer */
+	char held;            /* operator overwritten at *p, or '\0' */
+	word_field *fields;   /* fields of the last word after the first */
+	int glob;             /* the last word is a pattern to expand */
+	int expanded;         /* a word depends on the run (see Pipeline) */
+} lexer_t;
+
+/*
+ * A word built in the arena rather than in place, once a command
+ * substitution may have made it longer than its source text or a
+ * pattern needs its literal characters escaped (see pathglob.h).
+ */
+typedef struct {
+	char *buf;            /* current field, in escaped form */
+	size_t len;
+	size_t cap;
+	int quoted;           /* the current field had quotes */
+	int glob;             /* the current field has an unquoted *, ? or [ */
+	word_field *fields;   /* finished fields, in order */
+	word_field **tail;
+} word_builder;
+
+/*
+ * A here-document of the line being parsed. Its lines are read once
+ * the whole command line has been tokenized.
+ */
+typedef struct heredoc heredoc;
+struct heredoc {
+	Command *cmd;         /* stage whose stdin it is */
+	char *delim;
+	int strip;            /* <<-: leading tabs are removed */
+	heredoc *next;
+};
+
+/*
+ * A stage while it is being parsed. Words point into the input (or the
+ * arena) and argv grows as needed; parser_pack() then copies everything
+ * into the final Pipeline.
+ */
+typedef struct stage_draft stage_draft;
+struct stage_draft {
+	Command cmd;
+	int cap;              /* slots in cmd.argv */
+	size_t bytes;         /* string table space its words take */
+	stage_draft *next;
+};
+
+/*
+ * Arenas of freed pipelines, kept for reuse. A single parse in flight
+ * is the common case, so steady-state parsing reuses the same arena.
+ */
+static Arena *arena_pool[ARENA_POOL_MAX];
+static int arena_pool_len = 0;
+
 /* ------------------------------------------------------------------------- */
 /*                            Static Helper Functions                        */
 /* ------------------------------------------------------------------------- */
 
+/**
+ * @brief Take an arena from the pool, creating one if it is empty.
+ *
+ * @return  Arena, or NULL on allocation failure.
+ */
+static Arena*
+parser_arena_get(void)
+{
+	if (arena_pool_len > 0)
+		return arena_pool[--arena_pool_len];
+
+	return arena_create();
+}
+
+/**
+ * @brief Reset an arena and return it to the pool.
+ *
+ * @param a  Arena to release.
+ */
+static void
+parser_arena_put(Arena *a)
+{
+	arena_reset(a);
+
+	if (arena_pool_len < ARENA_POOL_MAX)
+		arena_pool[arena_pool_len++] = a;
+	else
+		arena_destroy(a);
+}
+
+/**
+ * @brief Check for characters that separate words outside quotes.
+ */
+static int
+parser_is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/**
+ * @brief Check for characters that start an operator token.
+ */
+static int
+parser_is_operator(char c)
+{
+	return c == '|' || c == '&' || c == '<' || c == '>';
+}
+
+/**
+ * @brief Character at offset off from the lexer position.
+ *
+ * Offset 0 honours a held terminator (see lexer_t).
+ */
+static char
+lexer_peek(const lexer_t *lx, size_t off)
+{
+	if (off == 0 && lx->held)
+		return lx->held;
+	return lx->p[off];
+}
+
+/**
+ * @brief Advance the lexer position by n characters.
+ */
+static void
+lexer_advance(lexer_t *lx, size_t n)
+{
+	lx->held = '\0';
+	lx->p += n;
+}
+
+/**
+ * @brief Skip blanks at the lexer position.
+ */
+static void
+lexer_skip_blanks(lexer_t *lx)
+{
+	while (parser_is_blank(lexer_peek(lx, 0)))
+		lexer_advance(lx, 1);
+}
+
 /**
  * @brief Expand a leading '~' into the user's HOME directory.
  *
@@ -51,136 +218,385 @@ enum token_type {
  *   "~"      -> $HOME
  *   "~/foo"  -> $HOME/foo
  *
- * "~user" is not implemented and is copied verbatim.
+ * "~user" is not implemented and is kept verbatim. The word is rewritten
+ * in place when the expansion is not longer than the word itself; only
+ * a growing expansion allocates from the arena. In a pattern, the HOME
+ * prefix is escaped so that it matches literally.
  *
- * @param path      Input path string.
- * @param expanded  Output buffer for expanded path.
- * @param size      Maximum size of the output buffer.
- * @return          0 on success, -1 if HOME is not set.
+ * @param arena  Arena owning the Command tree being built.
+ * @param word   Null-terminated word (inside the input buffer).
+ * @param glob   Non-zero if word is a pattern, in escaped form.
+ * @return       Expanded word, or NULL if HOME is not set or on
+ *               allocation failure.
  */
-static int
-parser_expand_tilde(const char *path, char *expanded, size_t size)
+static char*
+parser_expand_tilde(Arena *arena, char *word, int glob)
 {
 	const char *env;
+	size_t home_len;
+	size_t rest_len;
+	size_t esc = 0;
+	char *expanded;
+	char *out;
 
 	/* return if not "~" or "~/<path>" */
-	if (path[0] != '~' || (path[1] != '\0' && path[1] != '/')) {
-		strncpy(expanded, path, size - 1);
-		expanded[size - 1] = '\0';
-		return 0;
-	}
+	if (word[0] != '~' || (word[1] != '\0' && word[1] != '/'))
+		return word;
 
 	if (!(env = getenv("HOME"))) {
 		error_print(__func__, "getenv \"HOME\"", errno);
+		return NULL;
+	}
+
+	home_len = strlen(env);
+	rest_len = strlen(word + 1);
+	for (const char *c = env; glob && *c; c++)
+		esc += *c == '\\' || PATHGLOB_SPECIAL(*c);
+
+	if (home_len <= 1 && !esc) {
+		memmove(word + home_len, word + 1, rest_len + 1);
+		memcpy(word, env, home_len);
+		return word;
+	}
+
+	expanded = arena_alloc(arena, home_len + esc + rest_len + 1);
+	if (!expanded) {
+		error_print(__func__, "malloc", errno);
+		return NULL;
+	}
+
+	out = expanded;
+	for (const char *c = env; *c; c++) {
+		if (glob && (*c == '\\' || PATHGLOB_SPECIAL(*c)))
+			*out++ = '\\';
+		*out++ = *c;
+	}
+	memcpy(out, word + 1, rest_len + 1);
+	return expanded;
+}
+
+/**
+ * @brief Append n bytes to the current field of a word.
+ *
+ * The field doubles in the arena whenever it fills up.
+ *
+ * @return  0 on success, -1 on allocation failure.
+ */
+static int
+word_append(Arena *arena, word_builder *wb, const char *s, size_t n)
+{
+	if (wb->len + n >= wb->cap) {
+		size_t ncap = wb->cap ? wb->cap : WORD_INIT_CAP;
+		char *nbuf;
+
+		while (wb->len + n >= ncap)
+			ncap *= 2;
+		nbuf = arena_alloc(arena, ncap);
+		if (!nbuf) {
+			error_print(__func__, "malloc", errno);
+			return -1;
+		}
+		if (wb->len)
+			memcpy(nbuf, wb->buf, wb->len);
+		wb->buf = nbuf;
+		wb->cap = ncap;
+	}
+
+	memcpy(wb->buf + wb->len, s, n);
+	wb->len += n;
+	return 0;
+}
+
+static int
+word_put(Arena *arena, word_builder *wb, char c)
+{
+	return word_append(arena, wb, &c, 1);
+}
+
+/**
+ * @brief Append a character that is not special to a word.
+ *
+ * Escapes it if a pattern would otherwise take it as special.
+ */
+static int
+word_lit(Arena *arena, word_builder *wb, char c)
+{
+	if ((c == '\\' || PATHGLOB_SPECIAL(c)) && word_put(arena, wb, '\\'))
+		return -1;
+	return word_put(arena, wb, c);
+}
+
+/**
+ * @brief Switch a word being unquoted in place over to the arena.
+ *
+ * @param start  Start of the word.
+ * @param w      Write position: start..w is the word so far, unquoted.
+ * @param r      Read position.
+ * @return       0 on success, -1 on allocation failure.
+ */
+static int
+word_start(Arena *arena, word_builder *wb, const char *start,
+           const char *w, const char *r)
+{
+	wb->buf = NULL;
+	wb->len = wb->cap = 0;
+	wb->glob = 0;
+	wb->fields = NULL;
+	wb->tail = &wb->fields;
+	for (const char *q = start; q < w; q++) {
+		if (word_lit(arena, wb, *q))
+			return -1;
+	}
+	/* fewer characters written than read: there were quotes */
+	wb->quoted = w < r;
+	return 0;
+}
+
+/**
+ * @brief Finish the current field of a word, if it has one.
+ *
+ * A field exists once it has a character or had quotes, so "" is an
+ * empty word while an unquoted empty substitution is no word at all.
+ * A field that is not a pattern is unescaped here.
+ *
+ * @return  0 on success, -1 on allocation failure.
+ */
+static int
+word_break(Arena *arena, word_builder *wb)
+{
+	word_field *f;
+
+	if (!wb->len && !wb->quoted)
+		return 0;
+
+	f = arena_alloc(arena, sizeof(*f));
+	if (!f || word_put(arena, wb, '\0')) {
+		error_print(__func__, "malloc", errno);
 		return -1;
 	}
+	f->s = wb->buf;
+	f->glob = wb->glob;
+	f->next = NULL;
+	if (!f->glob)
+		pathglob_unescape(f->s);
+	*wb->tail = f;
+	wb->tail = &f->next;
 
-	snprintf(expanded, size, "%s%s", env, path + 1);
+	wb->buf = NULL;
+	wb->len = wb->cap = 0;
+	wb->quoted = 0;
+	wb->glob = 0;
 	return 0;
 }
 
 /**
- * @brief Get next token from input string.
+ * @brief Run a command substitution and add its output to a word.
+ *
+ * r points at the "$(" and the command runs up to the matching ')',
+ * skipping parentheses in quotes. Trailing newlines are removed;
+ * outside double quotes the rest is split into fields at blanks. The
+ * output is never a pattern.
+ *
+ * @param arena  Arena owning the pipeline being built.
+ * @param wb     Word being built.
+ * @param r      Read position at the '$'.
+ * @param dq     Non-zero inside double quotes.
+ * @return       Read position after the ')', or NULL on error.
+ */
+static char*
+parser_substitute(Arena *arena, word_builder *wb, char *r, int dq)
+{
+	char *cmd = r + 2;
+	char *end;
+	char *out;
+	size_t len;
+	int depth = 1;
+	char quote = 0;
+	int ret = 0;
+
+	for (end = cmd; *end; end++) {
+		if (quote) {
+			if (*end == quote)
+				quote = 0;
+		} else if (*end == '\'' || *end == '"') {
+			quote = *end;
+		} else if (*end == '(') {
+			depth++;
+		} else if (*end == ')' && !--depth) {
+			break;
+		}
+	}
+	if (!*end) {
+		error_print("parse error", "unclosed $(", 0);
+		return NULL;
+	}
+
+	*end = '\0';
+	if (pipeline_capture(cmd, &out, &len))
+		return NULL;
+
+	while (len && out[len - 1] == '\n')
+		len--;
+
+	for (size_t i = 0; !ret && i < len; i++) {
+		if (!out[i])
+			continue;
+		if (!dq && strchr(SUBST_IFS, out[i]))
+			ret = word_break(arena, wb);
+		else
+			ret = word_lit(arena, wb, out[i]);
+	}
+	free(out);
+
+	return ret ? NULL : end + 1;
+}
+
+/**
+ * @brief Get next token from the input buffer.
+ *
+ * Words are unquoted and NUL-terminated in place: the write position
+ * trails the read position, since removing quotes and escapes only
+ * ever shortens a word. When a word is immediately followed by an
+ * operator, the terminating NUL overwrites that operator, so it is
+ * remembered in lx->held and returned on the next call.
  *
- * Advances *input to point past the consumed token.
- * For TOK_WORD, allocates and returns the word value.
+ * A word with a command substitution is built in the arena instead,
+ * and may come out as zero or several fields: the first is returned
+ * in *value and the others are left in lx->fields. So is a word with
+ * an unquoted *, ? or [: it is returned in escaped form, with lx->glob
+ * set, for pathglob_expand().
  *
- * @param input  Pointer to input string pointer (updated on return).
- * @param value  Output: allocated string for TOK_WORD (NULL for operators).
+ * @param arena  Arena owning the Command tree being built.
+ * @param lx     Lexer state (updated on return).
+ * @param value  Output: word for TOK_WORD (NULL for operators and for
+ *               a word that expanded to no field). Points into the
+ *               input buffer, or into the arena if an expansion grew
+ *               the word.
  * @return       Token type.
  */
 static enum token_type
-parser_next_token(const char **input, char **value)
+parser_next_token(Arena *arena, lexer_t *lx, char **value)
 {
-	char buf[TOKEN_BUFFER_SIZE];
-	char temp[TOKEN_BUFFER_SIZE];
-	size_t len = 0;
 	int sq = 0, dq = 0;
-	const char *p = *input;
+	word_builder wb;
+	int building = 0;
+	char *start;
+	char *r;
+	char *w;
+	char c;
 
 	*value = NULL;
+	lx->fields = NULL;
+	lx->glob = 0;
 
-	/* skip whitespace */
-	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-		p++;
+	lexer_skip_blanks(lx);
+	c = lexer_peek(lx, 0);
 
 	/* end of input */
-	if (!*p) {
-		*input = p;
+	if (!c)
 		return TOK_END;
-	}
 
 	/* single char operators */
-	if (*p == '|') {
-		*input = p + 1;
+	if (c == '|') {
+		lexer_advance(lx, 1);
 		return TOK_PIPE;
 	}
 
-	if (*p == '&') {
-		*input = p + 1;
+	if (c == '&') {
+		lexer_advance(lx, 1);
 		return TOK_BG;
 	}
 
-	if (*p == '<') {
-		*input = p + 1;
+	if (c == '<') {
+		if (lexer_peek(lx, 1) == '<') {
+			c = lexer_peek(lx, 2);
+			lexer_advance(lx, c == '<' || c == '-' ? 3 : 2);
+			return c == '<' ? TOK_HERESTRING :
+			       c == '-' ? TOK_HEREDOC_STRIP : TOK_HEREDOC;
+		}
+		lexer_advance(lx, 1);
 		return TOK_REDIR_IN;
 	}
 
-	if (*p == '>') {
-		if (*(p + 1) == '>') {
-			*input = p + 2;
+	if (c == '>') {
+		if (lexer_peek(lx, 1) == '>') {
+			lexer_advance(lx, 2);
 			return TOK_REDIR_OUT_APPEND;
 		}
-		*input = p + 1;
+		lexer_advance(lx, 1);
 		return TOK_REDIR_OUT;
 	}
 
 	/* stderr redirection: 2> or 2>> */
-	if (*p == '2' && *(p + 1) == '>') {
-		if (*(p + 2) == '>') {
-			*input = p + 3;
+	if (c == '2' && lexer_peek(lx, 1) == '>') {
+		if (lexer_peek(lx, 2) == '>') {
+			lexer_advance(lx, 3);
 			return TOK_REDIR_ERR_APPEND;
 		}
-		*input = p + 2;
+		lexer_advance(lx, 2);
 		return TOK_REDIR_ERR;
 	}
 
-	/* build word token */
-	while (*p && len < TOKEN_BUFFER_SIZE - 1) {
-		if (*p == '\'' && !dq) {
+	/* build word token (a word never starts on a held operator) */
+	start = w = r = lx->p;
+	while (*r) {
+		if (*r == '\'' && !dq) {
 			sq = !sq;
-			p++;
+			if (building)
+				wb.quoted = 1;
+			r++;
 			continue;
 		}
 
-		if (*p == '"' && !sq) {
+		if (*r == '"' && !sq) {
 			dq = !dq;
-			p++;
+			if (building)
+				wb.quoted = 1;
+			r++;
 			continue;
 		}
 
-		/* Backslash escapes within double quotes */
-		if (*p == '\\' && dq &&
-		    (*(p + 1) == '"' || *(p + 1) == '\\')) {
-			p++;
-			buf[len++] = *p++;
+		/* Command substitution: the rest of the word goes to the arena */
+		if (*r == '$' && r[1] == '(' && !sq) {
+			if (!building && word_start(arena, &wb, start, w, r))
+				return TOK_ERROR;
+			building = 1;
+			lx->expanded = 1;
+			r = parser_substitute(arena, &wb, r, dq);
+			if (!r)
+				return TOK_ERROR;
 			continue;
 		}
 
-		/* Unquoted: stop at whitespace or operators */
-		if (!sq && !dq) {
-			if (*p == ' ' || *p == '\t' ||
-			    *p == '|' || *p == '&' || *p == '<' || *p == '>' ||
-			    *p == '\n' || *p == '\r')
-				break;
+		/* Pattern: the word goes to the arena, escaping literal characters */
+		if (PATHGLOB_SPECIAL(*r) && !sq && !dq) {
+			if (!building && word_start(arena, &wb, start, w, r))
+				return TOK_ERROR;
+			building = 1;
+			wb.glob = 1;
+			lx->expanded = 1;
+			if (word_put(arena, &wb, *r++))
+				return TOK_ERROR;
+			continue;
 		}
 
-		buf[len++] = *p++;
-	}
+		/* Backslash escapes within double quotes: \newline is removed */
+		if (*r == '\\' && dq && r[1] == '\n') {
+			r += 2;
+			continue;
+		}
+		if (*r == '\\' && dq &&
+		    (r[1] == '"' || r[1] == '\\' || r[1] == '$' || r[1] == '`'))
+			r++;
 
-	if (len >= TOKEN_BUFFER_SIZE - 1) {
-		error_print("parse error", "token too long", 0);
-		return TOK_ERROR;
+		/* Unquoted: stop at whitespace or operators */
+		else if (!sq && !dq && (parser_is_blank(*r) || parser_is_operator(*r)))
+			break;
+
+		if (!building)
+			*w++ = *r++;
+		else if (word_lit(arena, &wb, *r++))
+			return TOK_ERROR;
 	}
 
 	/* check for unclosed quotes */
@@ -189,198 +605,489 @@ parser_next_token(const char **input, char **value)
 		return TOK_ERROR;
 	}
 
-	buf[len] = '\0';
+	if (building) {
+		lx->p = r;
+		lx->held = '\0';
+		if (word_break(arena, &wb))
+			return TOK_ERROR;
+		if (!wb.fields)
+			return TOK_WORD;
+
+		lx->fields = wb.fields->next;
+		lx->glob = wb.fields->glob;
+		*value = *start == '~' ?
+		         parser_expand_tilde(arena, wb.fields->s, lx->glob) :
+		                         wb.fields->s;
+		return *value ? TOK_WORD : TOK_ERROR;
+	}
+
+	/* terminate the word, holding an operator we are about to overwrite */
+	lx->p = r;
+	lx->held = '\0';
+	if (w == r && *r) {
+		c = *r;
+		*w = '\0';
+		if (parser_is_operator(c))
+			lx->held = c;
+		else
+			lx->p++;
+	} else {
+		*w = '\0';
+	}
 
 	/* expand tilde if applicable */
-	if (parser_expand_tilde(buf, temp, TOKEN_BUFFER_SIZE))
+	*value = parser_expand_tilde(arena, start, 0);
+	if (!*value)
 		return TOK_ERROR;
 
-	*value = strdup(temp);
-	if (!*value) {
-		error_print(__func__, "strdup", errno);
+	return TOK_WORD;
+}
+
+/**
+ * @brief Get the target word of a redirection.
+ *
+ * A target is never a pattern: "*" names a file called "*".
+ *
+ * @return  TOK_WORD with the word in *value, or the token found instead;
+ *          a word that expanded to no or several fields is TOK_ERROR.
+ */
+static enum token_type
+parser_next_target(Arena *arena, lexer_t *lx, char **value)
+{
+	enum token_type type = parser_next_token(arena, lx, value);
+
+	if (type == TOK_WORD && (!*value || lx->fields)) {
+		error_print(NULL, "ambiguous redirect", 0);
 		return TOK_ERROR;
 	}
+	if (type == TOK_WORD && lx->glob)
+		pathglob_unescape(*value);
+	return type;
+}
 
-	*input = p;
-	return TOK_WORD;
+/**
+ * @brief Read the lines of the here-documents of a command line.
+ *
+ * Each text becomes the stdin target of its stage, every line ending
+ * in a newline.
+ *
+ * @return  0 on success, -1 on error or if reading was abandoned.
+ */
+static int
+parser_read_heredocs(Arena *arena, heredoc *h, parser_line_fn more, void *arg)
+{
+	for (; h; h = h->next) {
+		word_builder wb;
+		char *line;
+
+		if (!more) {
+			error_print(NULL, "here-document needs more input", 0);
+			return -1;
+		}
+
+		memset(&wb, 0, sizeof(wb));
+		for (;;) {
+			line = more(arg);
+			if (!line) {
+				if (errno == EINTR)
+					return -1;
+				error_print(NULL, "here-document ended by end of input", 0);
+				break;
+			}
+			if (h->strip)
+				line += strspn(line, "\t");
+			if (!strcmp(line, h->delim))
+				break;
+			if (word_append(arena, &wb, line, strlen(line)) ||
+			    word_put(arena, &wb, '\n'))
+				return -1;
+		}
+
+		if (word_put(arena, &wb, '\0'))
+			return -1;
+		h->cmd->redirect[REDIR_STDIN] = wb.buf;
+	}
+
+	return 0;
 }
 
 /**
- * @brief Allocate and initialize a new Command structure.
+ * @brief Allocate and initialize a new stage draft.
+ *
+ * The draft and its initial argv array come from the arena.
  *
- * @return  New Command or NULL on allocation failure.
+ * @param arena  Arena owning the pipeline being built.
+ * @return       New draft or NULL on allocation failure.
  */
-static Command*
-parser_init_cmd(void)
+static stage_draft*
+parser_init_stage(Arena *arena)
 {
-	Command *cmd;
+	stage_draft *d;
 
-	cmd = malloc(sizeof(Command));
-	if (!cmd) {
+	d = arena_alloc(arena, sizeof(*d));
+	if (!d) {
 		error_print(__func__, "malloc", errno);
 		return NULL;
 	}
 
-	cmd->argc = 0;
-	cmd->argv = malloc(sizeof(char *));
-	if (!cmd->argv) {
+	d->cmd.argc = 0;
+	d->cmd.argv = arena_alloc(arena, ARGV_INIT_CAP * sizeof(char *));
+	if (!d->cmd.argv) {
 		error_print(__func__, "malloc", errno);
-		free(cmd);
 		return NULL;
 	}
 
-	cmd->argv[0] = NULL;
-	cmd->redirect[REDIR_STDIN]  = NULL;
-	cmd->redirect[REDIR_STDOUT] = NULL;
-	cmd->redirect[REDIR_STDERR] = NULL;
-	cmd->next = NULL;
-	cmd->append = 0;
-	cmd->background = 0;
+	d->cmd.argv[0] = NULL;
+	d->cmd.redirect[REDIR_STDIN]  = NULL;
+	d->cmd.redirect[REDIR_STDOUT] = NULL;
+	d->cmd.redirect[REDIR_STDERR] = NULL;
+	d->cmd.append = 0;
+	d->cap = ARGV_INIT_CAP;
+	d->bytes = 0;
+	d->next = NULL;
 
-	return cmd;
+	return d;
 }
 
 /**
- * @brief Append an argument to a command's argv array.
+ * @brief Append an argument to a draft's argv array.
  *
- * Takes ownership of the argument string.
+ * The argv array doubles in the arena whenever it fills up; the old
+ * array is simply abandoned until the arena is reset.
  *
- * @param cmd  Command to append to.
- * @param arg  Argument string (ownership transferred).
- * @return     0 on success, -1 on allocation failure.
+ * @param arena  Arena owning the pipeline being built.
+ * @param d      Stage to append to.
+ * @param arg    Argument string.
+ * @return       0 on success, -1 on allocation failure.
  */
 static int
-parser_arg_append(Command *cmd, char *arg)
+parser_arg_append(Arena *arena, stage_draft *d, char *arg)
 {
+	Command *cmd = &d->cmd;
 	char **argv;
 
-	cmd->argc++;
-	argv = realloc(cmd->argv, (cmd->argc + 1) * sizeof(char *));
-	if (!argv) {
-		error_print(__func__, "realloc", errno);
-		return -1;
+	if (cmd->argc + 2 > d->cap) {
+		argv = arena_alloc(arena, (size_t)d->cap * 2 * sizeof(char *));
+		if (!argv) {
+			error_print(__func__, "malloc", errno);
+			return -1;
+		}
+
+		memcpy(argv, cmd->argv, (size_t)(cmd->argc + 1) * sizeof(char *));
+		cmd->argv = argv;
+		d->cap *= 2;
 	}
 
-	argv[cmd->argc - 1] = arg;
-	argv[cmd->argc] = NULL;
-	cmd->argv = argv;
+	cmd->argv[cmd->argc++] = arg;
+	cmd->argv[cmd->argc] = NULL;
+	d->bytes += strlen(arg) + 1;
+
+	return 0;
+}
+
+/**
+ * @brief Append a word to a draft's argv, expanding it if it is a pattern.
+ *
+ * A pattern adds each pathname it matches, in sorted order; one that
+ * matches nothing is kept as written.
+ *
+ * @param arena  Arena owning the pipeline being built.
+ * @param d      Stage to append to.
+ * @param word   The word, in escaped form if glob is set.
+ * @param glob   Non-zero if word is a pattern.
+ * @return       0 on success, -1 on allocation failure.
+ */
+static int
+parser_word_append(Arena *arena, stage_draft *d, char *word, int glob)
+{
+	char **matches;
+	size_t n;
 
+	if (!glob)
+		return parser_arg_append(arena, d, word);
+
+	if (pathglob_expand(arena, word, options_get(OPT_GLOBSTAR), &matches, &n))
+		return -1;
+	if (!n) {
+		pathglob_unescape(word);
+		return parser_arg_append(arena, d, word);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (parser_arg_append(arena, d, matches[i]))
+			return -1;
+	}
 	return 0;
 }
 
+/**
+ * @brief Copy a string to the string table cursor.
+ */
+static char*
+parser_pack_string(char **table, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *copy = *table;
+
+	memcpy(copy, s, len);
+	*table += len;
+	return copy;
+}
+
+/**
+ * @brief Lay out the parsed stages as one Pipeline block.
+ *
+ * The block holds, in order, the Pipeline header, the stage array, every
+ * stage's argv slots and the string table.
+ *
+ * @param arena   Arena owning the pipeline being built.
+ * @param first   First stage draft.
+ * @param nstages Number of drafts.
+ * @return        The pipeline, or NULL on allocation failure.
+ */
+static Pipeline*
+parser_pack(Arena *arena, const stage_draft *first, int nstages)
+{
+	const stage_draft *d;
+	Pipeline *p;
+	char **slot;
+	char *table;
+	size_t nslots = 0;
+	size_t bytes = 0;
+	int i;
+
+	for (d = first; d; d = d->next) {
+		nslots += (size_t)d->cmd.argc + 1;
+		bytes += d->bytes;
+		for (i = 0; i < REDIR_COUNT; i++) {
+			if (d->cmd.redirect[i])
+				bytes += strlen(d->cmd.redirect[i]) + 1;
+		}
+	}
+
+	p = arena_alloc(arena, sizeof(*p) + (size_t)nstages * sizeof(Command) +
+	                       nslots * sizeof(char *) + bytes);
+	if (!p) {
+		error_print(__func__, "malloc", errno);
+		return NULL;
+	}
+
+	p->nstages = nstages;
+	p->stages = (Command *)(p + 1);
+	slot = (char **)(p->stages + nstages);
+	table = (char *)(slot + nslots);
+	p->strings = table;
+	p->strings_len = bytes;
+	p->arena = arena;
+
+	for (d = first, i = 0; d; d = d->next, i++) {
+		Command *cmd = &p->stages[i];
+
+		cmd->argc = d->cmd.argc;
+		cmd->argv = slot;
+		for (int k = 0; k < cmd->argc; k++)
+			*slot++ = parser_pack_string(&table, d->cmd.argv[k]);
+		*slot++ = NULL;
+
+		for (int r = 0; r < REDIR_COUNT; r++) {
+			cmd->redirect[r] = d->cmd.redirect[r] ?
+			    parser_pack_string(&table, d->cmd.redirect[r]) : NULL;
+		}
+		cmd->append = d->cmd.append;
+	}
+
+	return p;
+}
+
 /* ------------------------------------------------------------------------- */
 /*                              Public Interface                             */
 /* ------------------------------------------------------------------------- */
 
 /**
- * @brief Parse a command line into a pipeline of Commands.
+ * @brief Parse a command line that may start here-documents.
  *
  * @param input  Null-terminated input string.
- * @return       Head of Command list, or NULL on parse error or empty input.
+ * @param more   Source of the here-document lines, or NULL.
+ * @param arg    Passed to more.
+ * @return       Pipeline, or NULL on parse error or empty input.
  */
-Command*
-parser_parse(char *input)
+Pipeline*
+parser_parse_more(char *input, parser_line_fn more, void *arg)
 {
-	Command *head;
-	Command *cur;
+	stage_draft *head;
+	stage_draft *cur;
+	Pipeline *p;
+	Arena *arena;
 	enum token_type type;
-	const char *p = input;
+	lexer_t lx = { input, '\0', NULL, 0, 0 };
+	heredoc *heredocs = NULL;
+	heredoc **heredoc_tail = &heredocs;
+	heredoc *h;
+	int heredocs_read = 0;
 	char *value;
+	size_t len;
+	int nstages = 1;
+	int background = 0;
+	int timed = 0;
 
 	/* Check for empty/whitespace-only input */
-	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-		p++;
-	if (!*p)
+	lexer_skip_blanks(&lx);
+	if (!*lx.p)
 		return NULL;
 
-	p = input;  /* Reset for actual parsing */
+	arena = parser_arena_get();
+	if (!arena) {
+		error_print(__func__, "malloc", errno);
+		return NULL;
+	}
 
-	head = parser_init_cmd();
+	head = parser_init_stage(arena);
 	if (!head)
-		return NULL;
+		goto fail;
 
 	cur = head;
 
-	while ((type = parser_next_token(&p, &value)) != TOK_END) {
+	/* 'time' is a reserved word only when unquoted and first */
+	if (!strncmp(lx.p, "time", 4) &&
+	    (!lx.p[4] || parser_is_blank(lx.p[4]) || parser_is_operator(lx.p[4]))) {
+		timed = 1;
+		lexer_advance(&lx, 4);
+	}
+
+	while ((type = parser_next_token(arena, &lx, &value)) != TOK_END) {
 		switch (type) {
 		case TOK_WORD:
-			if (parser_arg_append(cur, value)) {
-				free(value);
+			if (value && parser_word_append(arena, cur, value, lx.glob))
 				goto fail;
+			for (; lx.fields; lx.fields = lx.fields->next) {
+				if (parser_word_append(arena, cur, lx.fields->s, lx.fields->glob))
+					goto fail;
 			}
 			break;
 
 		case TOK_PIPE:
-			if (!cur->argv[0]) {
+			/* a bare `< file` feeding a pipe is an implicit cat */
+			if (!cur->cmd.argv[0] && cur->cmd.redirect[REDIR_STDIN] &&
+			    !cur->cmd.redirect[REDIR_STDOUT] && !cur->cmd.redirect[REDIR_STDERR]) {
+				if (parser_arg_append(arena, cur, "cat"))
+					goto fail;
+			}
+			if (!cur->cmd.argv[0]) {
 				error_print(NULL, "parse error near '|'", 0);
 				goto fail;
 			}
-			cur->next = parser_init_cmd();
+			cur->next = parser_init_stage(arena);
 			if (!cur->next)
 				goto fail;
 			cur = cur->next;
+			nstages++;
 			break;
 
 		case TOK_BG:
 			/* '&' is only supported at the end of the pipeline */
-			if (!head->argv[0]) {
+			if (!head->cmd.argv[0]) {
 				error_print(NULL, "parse error near '&'", 0);
 				goto fail;
 			}
-			while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-				p++;
-			if (*p) {
+			lexer_skip_blanks(&lx);
+			if (lexer_peek(&lx, 0)) {
 				error_print(NULL, "parse error near '&'", 0);
 				goto fail;
 			}
-			head->background = 1;
+			background = 1;
 			goto done;
 
 		case TOK_REDIR_IN:
-			if (cur->redirect[REDIR_STDIN] ||
-			    parser_next_token(&p, &value) != TOK_WORD) {
+			if (cur->cmd.redirect[REDIR_STDIN] ||
+			    parser_next_target(arena, &lx, &value) != TOK_WORD) {
 				error_print(NULL, "parse error near '<'", 0);
 				goto fail;
 			}
-			cur->redirect[REDIR_STDIN] = value;
+			cur->cmd.redirect[REDIR_STDIN] = value;
+			break;
+
+		case TOK_HEREDOC:
+		case TOK_HEREDOC_STRIP:
+			if (parser_next_target(arena, &lx, &value) != TOK_WORD) {
+				error_print(NULL, "parse error near '<<'", 0);
+				goto fail;
+			}
+			h = arena_alloc(arena, sizeof(*h));
+			if (!h) {
+				error_print(__func__, "malloc", errno);
+				goto fail;
+			}
+			h->cmd = &cur->cmd;
+			h->delim = value;
+			h->strip = type == TOK_HEREDOC_STRIP;
+			h->next = NULL;
+			*heredoc_tail = h;
+			heredoc_tail = &h->next;
+
+			/* several here-documents are all read; the last is the input */
+			if (cur->cmd.redirect[REDIR_STDIN] && !(cur->cmd.append & HERE_STDIN)) {
+				error_print(NULL, "parse error near '<<'", 0);
+				goto fail;
+			}
+
+			/* the delimiter stands in until the lines are read */
+			cur->cmd.redirect[REDIR_STDIN] = value;
+			cur->cmd.append |= HERE_STDIN;
+			break;
+
+		case TOK_HERESTRING:
+			if (cur->cmd.redirect[REDIR_STDIN] ||
+			    parser_next_target(arena, &lx, &value) != TOK_WORD) {
+				error_print(NULL, "parse error near '<<<'", 0);
+				goto fail;
+			}
+			len = strlen(value);
+			cur->cmd.redirect[REDIR_STDIN] = arena_alloc(arena, len + 2);
+			if (!cur->cmd.redirect[REDIR_STDIN]) {
+				error_print(__func__, "malloc", errno);
+				goto fail;
+			}
+			memcpy(cur->cmd.redirect[REDIR_STDIN], value, len);
+			memcpy(cur->cmd.redirect[REDIR_STDIN] + len, "\n", 2);
+			cur->cmd.append |= HERE_STDIN;
 			break;
 
 		case TOK_REDIR_OUT:
-			if (cur->redirect[REDIR_STDOUT] ||
-			    parser_next_token(&p, &value) != TOK_WORD) {
+			if (cur->cmd.redirect[REDIR_STDOUT] ||
+			    parser_next_target(arena, &lx, &value) != TOK_WORD) {
 				error_print(NULL, "parse error near '>'", 0);
 				goto fail;
 			}
-			cur->redirect[REDIR_STDOUT] = value;
+			cur->cmd.redirect[REDIR_STDOUT] = value;
 			break;
 
 		case TOK_REDIR_OUT_APPEND:
-			if (cur->redirect[REDIR_STDOUT] ||
-			    parser_next_token(&p, &value) != TOK_WORD) {
+			if (cur->cmd.redirect[REDIR_STDOUT] ||
+			    parser_next_target(arena, &lx, &value) != TOK_WORD) {
 				error_print(NULL, "parse error near '>>'", 0);
 				goto fail;
 			}
-			cur->redirect[REDIR_STDOUT] = value;
-			cur->append |= APPEND_STDOUT;
+			cur->cmd.redirect[REDIR_STDOUT] = value;
+			cur->cmd.append |= APPEND_STDOUT;
 			break;
 
 		case TOK_REDIR_ERR:
-			if (cur->redirect[REDIR_STDERR] ||
-			    parser_next_token(&p, &value) != TOK_WORD) {
+			if (cur->cmd.redirect[REDIR_STDERR] ||
+			    parser_next_target(arena, &lx, &value) != TOK_WORD) {
 				error_print(NULL, "parse error near '2>'", 0);
 				goto fail;
 			}
-			cur->redirect[REDIR_STDERR] = value;
+			cur->cmd.redirect[REDIR_STDERR] = value;
 			break;
 
 		case TOK_REDIR_ERR_APPEND:
-			if (cur->redirect[REDIR_STDERR] ||
-			    parser_next_token(&p, &value) != TOK_WORD) {
+			if (cur->cmd.redirect[REDIR_STDERR] ||
+			    parser_next_target(arena, &lx, &value) != TOK_WORD) {
 				error_print(NULL, "parse error near '2>>'", 0);
 				goto fail;
 			}
-			cur->redirect[REDIR_STDERR] = value;
-			cur->append |= APPEND_STDERR;
+			cur->cmd.redirect[REDIR_STDERR] = value;
+			cur->cmd.append |= APPEND_STDERR;
 			break;
 
 		case TOK_ERROR:
@@ -392,44 +1099,63 @@ parser_parse(char *input)
 	}
 
 done:
-	if (!cur->argv[0]) {
+	/* a bare `time` times an empty command, as true */
+	if (timed && nstages == 1 && !background && !cur->cmd.argv[0] &&
+	    !cur->cmd.redirect[REDIR_STDIN] && !cur->cmd.redirect[REDIR_STDOUT] &&
+	    !cur->cmd.redirect[REDIR_STDERR]) {
+		if (parser_arg_append(arena, cur, "true"))
+			goto fail;
+	}
+
+	if (!cur->cmd.argv[0]) {
 		error_print(NULL, "parse error: empty command", 0);
 		goto fail;
 	}
 
-	return head;
+	heredocs_read = 1;
+	if (parser_read_heredocs(arena, heredocs, more, arg))
+		goto fail;
+
+	p = parser_pack(arena, head, nstages);
+	if (!p)
+		goto fail;
+	p->background = background;
+	p->timed = timed;
+	p->expanded = lx.expanded;
+	return p;
 
 fail:
-	parser_free_cmd(head);
+	/* the lines of a here-document are never commands */
+	if (heredocs && !heredocs_read && more)
+		parser_read_heredocs(arena, heredocs, more, arg);
+	parser_arena_put(arena);
 	return NULL;
 }
 
 /**
- * @brief Free a Command pipeline.
+ * @brief Parse a command line into a Pipeline.
  *
- * Frees all Commands in the linked list, including their
- * argv arrays and redirection targets.
+ * @param input  Null-terminated input string.
+ * @return       Pipeline, or NULL on parse error or empty input.
+ */
+Pipeline*
+parser_parse(char *input)
+{
+	return parser_parse_more(input, NULL, NULL);
+}
+
+/**
+ * @brief Free a Pipeline.
  *
- * @param cmd  Head of Command list (may be NULL).
+ * The Pipeline and the drafts it was built from live in one arena, so
+ * this is a single arena reset. The arena is kept for the next
+ * parser_parse() call.
+ *
+ * @param p  Pipeline (may be NULL).
  */
 void
-parser_free_cmd(Command *cmd)
+parser_free_pipeline(Pipeline *p)
 {
-	Command *next;
-
-	while (cmd) {
-		if (cmd->argv) {
-			for (int i = 0; i < cmd->argc; i++)
-				free(cmd->argv[i]);
-			free(cmd->argv);
-		}
-
-		free(cmd->redirect[REDIR_STDIN]);
-		free(cmd->redirect[REDIR_STDOUT]);
-		free(cmd->redirect[REDIR_STDERR]);
-
-		next = cmd->next;
-		free(cmd);
-		cmd = next;
-	}
+	if (p && p->arena)
+		parser_arena_put(p->arena);
 }
@@ -2,14 +2,15 @@
  * @file parser.h
  * @brief Shell command line parser interface.
  *
- * Parses shell input into a linked list of Command structures
- * representing a pipeline. Each Command holds arguments and
- * optional I/O redirections.
+ * Parses shell input into a Pipeline of Command stages. Each Command
+ * holds arguments and optional I/O redirections.
  */
 
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "arena.h"
+
 /**
  * Redirect array indices.
  */
@@ -21,43 +22,93 @@ enum {
 };
 
 /**
- * Append mode flags (bitfield).
+ * Redirection flags (bitfield).
  */
 enum {
+	HERE_STDIN    = 1 << REDIR_STDIN,   /* 0x01: stdin target is the text itself */
 	APPEND_STDOUT = 1 << REDIR_STDOUT,  /* 0x02 */
 	APPEND_STDERR = 1 << REDIR_STDERR   /* 0x04 */
 };
 
 /**
  * @struct Command
- * @brief Represents a single command in a pipeline.
+ * @brief Represents a single stage of a pipeline.
  */
 typedef struct Command Command;
 struct Command {
 	int argc;                    /* Argument count */
 	char **argv;                 /* NULL-terminated argument vector */
 	char *redirect[REDIR_COUNT]; /* I/O redirection targets (NULL if unused) */
-	unsigned int append;         /* Append flags (APPEND_STDOUT, APPEND_STDERR) */
-	int background;              /* Pipeline runs in background if '&' (head only) */
-	Command *next;               /* Next command in pipeline */
+	unsigned int append;         /* Redirection flags (HERE_STDIN, APPEND_*) */
+};
+
+/**
+ * @struct Pipeline
+ * @brief A parsed command line.
+ *
+ * Laid out as one contiguous block: this header, the stage array, the
+ * argv arrays of all stages and a string table holding every argument
+ * and redirection target. The stage count is known up front and the
+ * whole pipeline is walked front to back in memory.
+ */
+typedef struct Pipeline Pipeline;
+struct Pipeline {
+	int nstages;                 /* Number of stages, at least 1 */
+	int background;              /* Runs in the background ('&') */
+	int timed;                   /* Prefixed with 'time' */
+	int expanded;                /* Words depend on the run ($(...), patterns) */
+	Command *stages;             /* The stages, in pipeline order */
+	char *strings;               /* String table */
+	size_t strings_len;          /* Its length in bytes */
+	Arena *arena;                /* Arena the block lives in (NULL if not the parser's) */
 };
 
 /**
- * @brief Parse a command line into a pipeline of Commands.
+ * @brief Parse a command line into a Pipeline.
+ *
+ * Words are unquoted in place, so input is modified; the Pipeline holds
+ * copies of them and does not refer to input once parsed. Command
+ * substitutions run during the call (see pipeline_capture()), and
+ * patterns are expanded against the filesystem at that time.
+ *
+ * @param input  Null-terminated, writable input string.
+ * @return       The pipeline, or NULL on parse error or empty input.
+ */
+Pipeline *parser_parse(char *input);
+
+/**
+ * @brief Source of the lines of here-documents.
+ *
+ * @param arg  Caller data.
+ * @return     The next line without its newline, valid until the next
+ *             call; NULL at the end of input, with errno set to EINTR
+ *             if the line should be abandoned instead (Ctrl+C).
+ */
+typedef char *(*parser_line_fn)(void *arg);
+
+/**
+ * @brief Parse a command line that may start here-documents.
+ *
+ * Same as parser_parse(); the lines of each here-document (<<word,
+ * <<-word) are read from more once the command line is parsed, up to
+ * the line holding just the delimiter word.
  *
- * @param input  Null-terminated input string.
- * @return       Head of Command list, or NULL on parse error.
+ * @param input  Null-terminated, writable input string. It must stay
+ *               valid while more is called.
+ * @param more   Line source, or NULL if there is no further input.
+ * @param arg    Passed to more.
+ * @return       The pipeline, or NULL on parse error or empty input.
  */
-Command *parser_parse(char *input);
+Pipeline *parser_parse_more(char *input, parser_line_fn more, void *arg);
 
 /**
- * @brief Free a Command pipeline.
+ * @brief Free a Pipeline.
  *
- * Frees all Commands in the linked list, including their
- * argv arrays and redirection targets.
+ * Releases the arena holding the pipeline. Pipelines not allocated by
+ * the parser (arena NULL) are left alone.
  *
- * @param cmd  Head of Command list (may be NULL).
+ * @param p  Pipeline (may be NULL).
  */
-void parser_free_cmd(Command *cmd);
+void parser_free_pipeline(Pipeline *p);
 
 #endif /* PARSER_H */
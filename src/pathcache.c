@@ -0,0 +1,590 @@
+/**
+ * @file pathcache.c
+ * @brief Implementation of the command path hash table.
+ *
+ * Entries map a command name to the path it resolved to, together with
+ * a hit counter (shown by `hash`) and whether the $PATH element it came
+ * from was relative. The table uses separate chaining and doubles its
+ * bucket count once the load factor exceeds one.
+ *
+ * Invalidation rules:
+ *   - $PATH differs from the string the table was filled with -> flush all
+ *   - working directory changes                               -> drop relative
+ *   - `hash -r` / `hash -d name`                               -> explicit
+ *
+ * The same module keeps the executable index used for completion: the
+ * sorted names of the executables in every $PATH directory, built on
+ * first use. Each completion stats the directories and rescans only
+ * those whose identity or modification time changed, so completing a
+ * prefix is a binary search per directory instead of a readdir() of the
+ * whole $PATH. The index follows the table's rules: a new $PATH rebuilds
+ * the directory list (keeping the scans of directories still in it),
+ * `hash -r` forces a rescan of all of them and a directory change one of
+ * the relative elements.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pathcache.h"
+#include "arena.h"
+#include "error.h"
+
+#define PATHCACHE_INIT_BUCKETS 64
+
+typedef struct pathcache_entry pathcache_entry;
+struct pathcache_entry {
+	char *name;
+	char *path;
+	unsigned int hits;
+	int relative;            /* resolved through a relative $PATH element */
+	pathcache_entry *next;
+};
+
+static pathcache_entry **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t nentries = 0;
+
+/* Copy of $PATH the current entries were resolved with. */
+static char *cached_path_env = NULL;
+
+/* One $PATH directory of the executable index. */
+typedef struct {
+	char *dir;
+	int scanned;             /* names reflect the directory as stat()ed */
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	Arena *arena;            /* names */
+	char **names;            /* sorted */
+	size_t nnames;
+	size_t cap;
+} exec_dir;
+
+static exec_dir *exec_dirs = NULL;
+static size_t nexec_dirs = 0;
+
+/* Copy of $PATH the directory list was built from. */
+static char *exec_path_env = NULL;
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief FNV-1a hash of a NUL-terminated string.
+ */
+static size_t
+pathcache_hash(const char *s)
+{
+	size_t h = 2166136261u;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void
+pathcache_entry_free(pathcache_entry *e)
+{
+	free(e->name);
+	free(e->path);
+	free(e);
+}
+
+/**
+ * @brief Double the bucket array and rehash all entries.
+ *
+ * On allocation failure the table keeps its current size.
+ */
+static void
+pathcache_grow(void)
+{
+	pathcache_entry **nb;
+	size_t nsize = nbuckets ? nbuckets * 2 : PATHCACHE_INIT_BUCKETS;
+
+	nb = calloc(nsize, sizeof(*nb));
+	if (!nb)
+		return;
+
+	for (size_t i = 0; i < nbuckets; i++) {
+		pathcache_entry *e = buckets[i];
+
+		while (e) {
+			pathcache_entry *next = e->next;
+			size_t b = pathcache_hash(e->name) & (nsize - 1);
+
+			e->next = nb[b];
+			nb[b] = e;
+			e = next;
+		}
+	}
+
+	free(buckets);
+	buckets = nb;
+	nbuckets = nsize;
+}
+
+static pathcache_entry*
+pathcache_find(const char *name)
+{
+	pathcache_entry *e;
+
+	if (!nbuckets)
+		return NULL;
+
+	for (e = buckets[pathcache_hash(name) & (nbuckets - 1)]; e; e = e->next) {
+		if (!strcmp(e->name, name))
+			return e;
+	}
+	return NULL;
+}
+
+static void
+pathcache_insert(const char *name, const char *path, int relative)
+{
+	pathcache_entry *e;
+	size_t b;
+
+	if (nentries >= nbuckets)
+		pathcache_grow();
+	if (!nbuckets)
+		return;
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return;
+
+	e->name = strdup(name);
+	e->path = strdup(path);
+	if (!e->name || !e->path) {
+		pathcache_entry_free(e);
+		return;
+	}
+
+	e->hits = 0;
+	e->relative = relative;
+
+	b = pathcache_hash(name) & (nbuckets - 1);
+	e->next = buckets[b];
+	buckets[b] = e;
+	nentries++;
+}
+
+/**
+ * @brief Walk $PATH looking for an executable called name.
+ *
+ * @param name      Command name (no '/').
+ * @param env       Value of $PATH.
+ * @param path      Output buffer of PATH_MAX bytes.
+ * @param relative  Output: set if the match came from a relative element.
+ * @return          0 on success, -1 if not found.
+ */
+static int
+pathcache_walk(const char *name, const char *env, char *path, int *relative)
+{
+	char *temp;
+	char *tok;
+
+	temp = strdup(env);
+	if (!temp) {
+		error_print(__func__, "strdup", errno);
+		return -1;
+	}
+
+	tok = strtok(temp, ":");
+	while (tok) {
+		snprintf(path, PATH_MAX, "%s/%s", tok, name);
+		if (!access(path, X_OK)) {
+			if (relative)
+				*relative = tok[0] != '/';
+			free(temp);
+			return 0;
+		}
+		tok = strtok(NULL, ":");
+	}
+
+	free(temp);
+	return -1;
+}
+
+/**
+ * @brief Flush the table if $PATH changed since it was filled.
+ *
+ * @param env  Current value of $PATH.
+ */
+static void
+pathcache_check_env(const char *env)
+{
+	if (cached_path_env && !strcmp(cached_path_env, env))
+		return;
+
+	pathcache_clear();
+	free(cached_path_env);
+	cached_path_env = strdup(env);
+}
+
+static void
+exec_dir_free(exec_dir *d)
+{
+	free(d->dir);
+	free(d->names);
+	arena_destroy(d->arena);
+}
+
+static int
+exec_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Read the executables of a directory into its sorted name list.
+ *
+ * A directory that cannot be read ends up empty.
+ */
+static void
+exec_dir_scan(exec_dir *d)
+{
+	DIR *dp;
+	struct dirent *de;
+
+	d->nnames = 0;
+	if (d->arena)
+		arena_reset(d->arena);
+	else if (!(d->arena = arena_create()))
+		return;
+
+	dp = opendir(d->dir);
+	if (!dp)
+		return;
+
+	while ((de = readdir(dp))) {
+		struct stat st;
+		char *name;
+
+		if (de->d_name[0] == '.' &&
+		    (!de->d_name[1] || (de->d_name[1] == '.' && !de->d_name[2])))
+			continue;
+		if (fstatat(dirfd(dp), de->d_name, &st, 0) || !S_ISREG(st.st_mode) ||
+		    faccessat(dirfd(dp), de->d_name, X_OK, 0))
+			continue;
+
+		if (d->nnames == d->cap) {
+			size_t ncap = d->cap ? d->cap * 2 : 64;
+			char **nn = realloc(d->names, ncap * sizeof(*nn));
+
+			if (!nn)
+				break;
+			d->names = nn;
+			d->cap = ncap;
+		}
+		name = arena_strdup(d->arena, de->d_name);
+		if (!name)
+			break;
+		d->names[d->nnames++] = name;
+	}
+	closedir(dp);
+
+	qsort(d->names, d->nnames, sizeof(*d->names), exec_name_cmp);
+}
+
+/**
+ * @brief Rebuild the directory list for a new $PATH.
+ *
+ * Directories that stay on $PATH keep their scan.
+ */
+static int
+exec_index_reset(const char *env)
+{
+	exec_dir *nd = NULL;
+	size_t n = 0;
+	size_t cap = 0;
+	char *temp;
+	char *tok;
+
+	temp = strdup(env);
+	if (!temp) {
+		error_print(__func__, "strdup", errno);
+		return -1;
+	}
+
+	for (tok = strtok(temp, ":"); tok; tok = strtok(NULL, ":")) {
+		exec_dir d;
+		size_t i;
+
+		for (i = 0; i < nexec_dirs; i++) {
+			if (exec_dirs[i].dir && !strcmp(exec_dirs[i].dir, tok))
+				break;
+		}
+		if (i < nexec_dirs) {
+			d = exec_dirs[i];
+			exec_dirs[i].dir = NULL;
+			exec_dirs[i].names = NULL;
+			exec_dirs[i].arena = NULL;
+		} else {
+			memset(&d, 0, sizeof(d));
+			d.dir = strdup(tok);
+			if (!d.dir)
+				continue;
+		}
+
+		if (n == cap) {
+			size_t ncap = cap ? cap * 2 : 16;
+			exec_dir *t = realloc(nd, ncap * sizeof(*t));
+
+			if (!t) {
+				exec_dir_free(&d);
+				break;
+			}
+			nd = t;
+			cap = ncap;
+		}
+		nd[n++] = d;
+	}
+	free(temp);
+
+	for (size_t i = 0; i < nexec_dirs; i++)
+		exec_dir_free(&exec_dirs[i]);
+	free(exec_dirs);
+	exec_dirs = nd;
+	nexec_dirs = n;
+
+	free(exec_path_env);
+	exec_path_env = strdup(env);
+	return 0;
+}
+
+/**
+ * @brief Bring the executable index up to date with the file system.
+ */
+static void
+exec_index_sync(const char *env)
+{
+	if ((!exec_path_env || strcmp(exec_path_env, env)) && exec_index_reset(env))
+		return;
+
+	for (size_t i = 0; i < nexec_dirs; i++) {
+		exec_dir *d = &exec_dirs[i];
+		struct stat st;
+
+		if (stat(d->dir, &st) || !S_ISDIR(st.st_mode)) {
+			d->scanned = 0;
+			d->nnames = 0;
+			continue;
+		}
+		if (d->scanned && d->dev == st.st_dev && d->ino == st.st_ino &&
+		    d->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    d->mtime.tv_nsec == st.st_mtim.tv_nsec)
+			continue;
+
+		exec_dir_scan(d);
+		d->scanned = 1;
+		d->dev = st.st_dev;
+		d->ino = st.st_ino;
+		d->mtime = st.st_mtim;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Resolve a command name, consulting the hash table first.
+ */
+int
+pathcache_lookup(const char *name, char *path)
+{
+	pathcache_entry *e;
+	const char *env;
+	int relative = 0;
+
+	if (strchr(name, '/')) {
+		if (access(name, X_OK))
+			return -1;
+
+		strncpy(path, name, PATH_MAX - 1);
+		path[PATH_MAX - 1] = '\0';
+		return 0;
+	}
+
+	env = getenv("PATH");
+	if (!env) {
+		error_print(__func__, "getenv \"PATH\"", errno);
+		return -1;
+	}
+
+	pathcache_check_env(env);
+
+	e = pathcache_find(name);
+	if (e) {
+		e->hits++;
+		strncpy(path, e->path, PATH_MAX - 1);
+		path[PATH_MAX - 1] = '\0';
+		return 0;
+	}
+
+	if (pathcache_walk(name, env, path, &relative))
+		return -1;
+
+	pathcache_insert(name, path, relative);
+	e = pathcache_find(name);
+	if (e)
+		e->hits++;
+
+	return 0;
+}
+
+/**
+ * @brief Resolve a command name by walking $PATH, bypassing the table.
+ */
+int
+pathcache_search(const char *name, char *path)
+{
+	const char *env;
+
+	env = getenv("PATH");
+	if (!env)
+		return -1;
+
+	return pathcache_walk(name, env, path, NULL);
+}
+
+/**
+ * @brief Remove a single entry from the table.
+ */
+int
+pathcache_remove(const char *name)
+{
+	pathcache_entry **pp;
+
+	if (!nbuckets)
+		return -1;
+
+	for (pp = &buckets[pathcache_hash(name) & (nbuckets - 1)]; *pp; pp = &(*pp)->next) {
+		pathcache_entry *e = *pp;
+
+		if (!strcmp(e->name, name)) {
+			*pp = e->next;
+			pathcache_entry_free(e);
+			nentries--;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Remove all entries from the table.
+ */
+void
+pathcache_clear(void)
+{
+	for (size_t i = 0; i < nbuckets; i++) {
+		pathcache_entry *e = buckets[i];
+
+		while (e) {
+			pathcache_entry *next = e->next;
+			pathcache_entry_free(e);
+			e = next;
+		}
+		buckets[i] = NULL;
+	}
+	nentries = 0;
+
+	for (size_t i = 0; i < nexec_dirs; i++)
+		exec_dirs[i].scanned = 0;
+}
+
+/**
+ * @brief Drop entries resolved through relative $PATH elements.
+ */
+void
+pathcache_chdir(void)
+{
+	for (size_t i = 0; i < nbuckets; i++) {
+		pathcache_entry **pp = &buckets[i];
+
+		while (*pp) {
+			pathcache_entry *e = *pp;
+
+			if (e->relative) {
+				*pp = e->next;
+				pathcache_entry_free(e);
+				nentries--;
+				continue;
+			}
+			pp = &e->next;
+		}
+	}
+
+	for (size_t i = 0; i < nexec_dirs; i++) {
+		if (exec_dirs[i].dir[0] != '/')
+			exec_dirs[i].scanned = 0;
+	}
+}
+
+/**
+ * @brief Print the table in `hash` builtin format to stdout.
+ */
+int
+pathcache_print(void)
+{
+	int n = 0;
+
+	for (size_t i = 0; i < nbuckets; i++) {
+		for (pathcache_entry *e = buckets[i]; e; e = e->next) {
+			if (!n)
+				printf("hits\tcommand\n");
+			printf("%4u\t%s\n", e->hits, e->path);
+			n++;
+		}
+	}
+	return n;
+}
+
+/**
+ * @brief Report the executables on $PATH whose names start with prefix.
+ */
+void
+pathcache_complete(const char *prefix, pathcache_name_fn fn, void *arg)
+{
+	const char *env = getenv("PATH");
+	size_t plen = strlen(prefix);
+
+	if (!env)
+		return;
+
+	exec_index_sync(env);
+
+	for (size_t i = 0; i < nexec_dirs; i++) {
+		exec_dir *d = &exec_dirs[i];
+		size_t lo = 0;
+		size_t hi = d->nnames;
+
+		/* first name not below prefix */
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+
+			if (strcmp(d->names[mid], prefix) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (; lo < d->nnames && !strncmp(d->names[lo], prefix, plen); lo++)
+			fn(d->names[lo], arg);
+	}
+}
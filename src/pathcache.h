@@ -0,0 +1,80 @@
+/**
+ * @file pathcache.h
+ * @brief Command path hash table (bash-style `hash`).
+ *
+ * Caches the resolved location of external commands in the shell
+ * process so that repeated invocations cost a single hash probe
+ * instead of a walk over every $PATH directory.
+ */
+
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+/**
+ * @brief Resolve a command name to an executable path.
+ *
+ * Names containing '/' are checked with access() and never cached.
+ * Other names are looked up in the hash table first and resolved
+ * through $PATH on a miss. The table is flushed automatically when
+ * $PATH differs from the value the cached entries were resolved with.
+ *
+ * @param name  Command name (argv[0]).
+ * @param path  Output buffer of at least PATH_MAX bytes.
+ * @return      0 on success, -1 if the command was not found.
+ */
+int pathcache_lookup(const char *name, char *path);
+
+/**
+ * @brief Resolve a command name by walking $PATH, bypassing the table.
+ *
+ * @param name  Command name (must not contain '/').
+ * @param path  Output buffer of at least PATH_MAX bytes.
+ * @return      0 on success, -1 if the command was not found.
+ */
+int pathcache_search(const char *name, char *path);
+
+/**
+ * @brief Remove a single entry from the table.
+ *
+ * @param name  Command name.
+ * @return      0 if an entry was removed, -1 if none existed.
+ */
+int pathcache_remove(const char *name);
+
+/**
+ * @brief Remove all entries from the table.
+ */
+void pathcache_clear(void);
+
+/**
+ * @brief Notify the cache that the working directory changed.
+ *
+ * Drops entries that were resolved through a relative $PATH element
+ * (e.g. "." or "bin"), since they now point somewhere else.
+ */
+void pathcache_chdir(void);
+
+/**
+ * @brief Print the table in `hash` builtin format to stdout.
+ *
+ * @return  Number of entries printed.
+ */
+int pathcache_print(void);
+
+/* Receives each name found by pathcache_complete(). */
+typedef void (*pathcache_name_fn)(const char *name, void *arg);
+
+/**
+ * @brief Report the executables on $PATH whose names start with prefix.
+ *
+ * Served from the executable index: directories are stat()ed and only
+ * the ones that changed since the last call are read again. A name
+ * found in several directories is reported once for each.
+ *
+ * @param prefix  Start of the names; "" reports every executable.
+ * @param fn      Called with each name (valid during the call only).
+ * @param arg     Passed to fn.
+ */
+void pathcache_complete(const char *prefix, pathcache_name_fn fn, void *arg);
+
+#endif /* PATHCACHE_H */
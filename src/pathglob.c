@@ -0,0 +1,593 @@
+/**
+ * @file pathglob.c
+ * @brief Implementation of pathname expansion.
+ *
+ * A pattern is split at '/' into segments and each segment compiled
+ * into a short op array: literal characters, '?', '*' and bracket
+ * expressions as 256-bit sets. A segment without any of those is a
+ * plain name and is looked up, or descended into, without reading its
+ * directory. Entry types come from d_type; stat is only needed when
+ * the filesystem does not report one or the entry is a symbolic link
+ * that has to lead to a directory.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* d_type and DT_* of struct dirent */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pathglob.h"
+#include "error.h"
+
+#define MATCHES_INIT_CAP 16
+
+typedef enum {
+	OP_END,
+	OP_CHAR,      /* one given character */
+	OP_ANY,       /* ? */
+	OP_STAR,      /* *, runs of them folded into one */
+	OP_SET        /* [...] */
+} op_type;
+
+typedef struct {
+	op_type type;
+	unsigned char c;              /* OP_CHAR */
+	const unsigned char *set;     /* OP_SET: bit per byte value */
+} glob_op;
+
+typedef struct {
+	char *name;       /* the segment; unescaped if it is literal */
+	glob_op *ops;     /* compiled segment, NULL if literal */
+	int dot;          /* starts with a literal '.': may match hidden names */
+	int globstar;     /* "**" matching any number of directories */
+} glob_seg;
+
+typedef struct {
+	Arena *arena;
+	glob_seg *segs;
+	int nsegs;
+	int dironly;      /* pattern ended in '/' */
+	char path[PATH_MAX];
+	char **matches;
+	size_t n;
+	size_t cap;
+	int failed;
+} glob_state;
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Add a POSIX character class ("[:alpha:]") to a set.
+ *
+ * @return Position after the class, or NULL if p does not start one.
+ */
+static const char*
+set_add_class(unsigned char *set, const char *p)
+{
+	static const struct {
+		const char *name;
+		int (*test)(int);
+	} classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+		{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+		{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+		{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+	};
+	const char *end;
+
+	if (p[0] != '[' || p[1] != ':' || !(end = strstr(p + 2, ":]")))
+		return NULL;
+
+	for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+		size_t len = strlen(classes[i].name);
+
+		if ((size_t)(end - (p + 2)) != len || strncmp(p + 2, classes[i].name, len))
+			continue;
+		for (int c = 1; c < 256; c++) {
+			if (classes[i].test(c))
+				set[c >> 3] |= (unsigned char)(1u << (c & 7));
+		}
+		return end + 2;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Compile a bracket expression.
+ *
+ * @param p    Position after the '['.
+ * @param set  Output: 32-byte set, zeroed by the caller.
+ * @return     Position after the closing ']', or NULL if it has none
+ *             (the '[' is then an ordinary character).
+ */
+static const char*
+set_compile(const char *p, unsigned char *set)
+{
+	const char *first;
+	int negate = 0;
+
+	if (*p == '!' || *p == '^') {
+		negate = 1;
+		p++;
+	}
+
+	/* a ']' right at the start is a member */
+	for (first = p; *p && (*p != ']' || p == first); ) {
+		const char *next = set_add_class(set, p);
+		unsigned char lo, hi;
+
+		if (next) {
+			p = next;
+			continue;
+		}
+
+		if (*p == '\\' && p[1])
+			p++;
+		lo = hi = (unsigned char)*p++;
+		if (*p == '-' && p[1] && p[1] != ']') {
+			p++;
+			if (*p == '\\' && p[1])
+				p++;
+			hi = (unsigned char)*p++;
+		}
+		for (unsigned int c = lo; c <= hi; c++)
+			set[c >> 3] |= (unsigned char)(1u << (c & 7));
+	}
+	if (!*p)
+		return NULL;
+
+	if (negate) {
+		for (int i = 0; i < 32; i++)
+			set[i] = (unsigned char)~set[i];
+	}
+	/* names never hold NUL; '/' never reaches a segment */
+	set[0] &= (unsigned char)~1u;
+	return p + 1;
+}
+
+/**
+ * @brief Compile one segment.
+ *
+ * Leaves seg->ops NULL, and seg->name unescaped, if the segment has
+ * nothing to expand.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int
+seg_compile(Arena *arena, glob_seg *seg, int globstar)
+{
+	const char *p = seg->name;
+	size_t len = strlen(p);
+	glob_op *ops;
+	int nops = 0;
+	int literal = 1;
+
+	seg->ops = NULL;
+	seg->dot = p[0] == '.' || (p[0] == '\\' && p[1] == '.');
+	seg->globstar = globstar && !strcmp(p, "**");
+	if (seg->globstar)
+		return 0;
+
+	/* never more ops than characters */
+	ops = arena_alloc(arena, (len + 1) * sizeof(*ops));
+	if (!ops)
+		return -1;
+
+	while (*p) {
+		glob_op *op = &ops[nops];
+
+		op->set = NULL;
+		if (*p == '*') {
+			literal = 0;
+			while (*p == '*')
+				p++;
+			op->type = OP_STAR;
+		} else if (*p == '?') {
+			literal = 0;
+			op->type = OP_ANY;
+			p++;
+		} else if (*p == '[') {
+			unsigned char *set = arena_alloc(arena, 32);
+			const char *end;
+
+			if (!set)
+				return -1;
+			memset(set, 0, 32);
+			end = set_compile(p + 1, set);
+			if (end) {
+				literal = 0;
+				op->type = OP_SET;
+				op->set = set;
+				p = end;
+			} else {
+				op->type = OP_CHAR;
+				op->c = (unsigned char)*p++;
+			}
+		} else {
+			if (*p == '\\' && p[1])
+				p++;
+			op->type = OP_CHAR;
+			op->c = (unsigned char)*p++;
+		}
+		nops++;
+	}
+	ops[nops].type = OP_END;
+
+	if (literal)
+		pathglob_unescape(seg->name);
+	else
+		seg->ops = ops;
+	return 0;
+}
+
+static int
+op_accepts(const glob_op *op, unsigned char c)
+{
+	switch (op->type) {
+	case OP_CHAR:
+		return op->c == c;
+	case OP_ANY:
+		return 1;
+	case OP_SET:
+		return (op->set[c >> 3] >> (c & 7)) & 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Match a name against a compiled segment.
+ *
+ * Backtracks only to the last '*', so a name is scanned at most once
+ * per '*' in the segment.
+ */
+static int
+seg_match(const glob_op *p, const char *name)
+{
+	const unsigned char *s = (const unsigned char *)name;
+	const glob_op *star_p = NULL;
+	const unsigned char *star_s = NULL;
+
+	while (*s) {
+		if (p->type == OP_STAR) {
+			star_p = ++p;
+			star_s = s;
+			if (p->type == OP_END)
+				return 1;
+			continue;
+		}
+		if (op_accepts(p, *s)) {
+			p++;
+			s++;
+		} else if (star_p) {
+			p = star_p;
+			s = ++star_s;
+		} else {
+			return 0;
+		}
+	}
+
+	while (p->type == OP_STAR)
+		p++;
+	return p->type == OP_END;
+}
+
+/**
+ * @brief Check whether a directory entry is, or leads to, a directory.
+ *
+ * @param follow  Non-zero to follow a symbolic link.
+ */
+static int
+entry_is_dir(DIR *dp, const struct dirent *de, int follow)
+{
+	struct stat st;
+
+	if (de->d_type == DT_DIR)
+		return 1;
+	if (de->d_type != DT_UNKNOWN && (de->d_type != DT_LNK || !follow))
+		return 0;
+
+	return !fstatat(dirfd(dp), de->d_name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) &&
+	       S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Put name after the path prefix of length len.
+ *
+ * @return The new length, or 0 if the path would not fit.
+ */
+static size_t
+path_put(glob_state *g, size_t len, const char *name, int slash)
+{
+	size_t nlen = strlen(name);
+
+	if (len + nlen + (size_t)slash + 1 > sizeof(g->path))
+		return 0;
+	memcpy(g->path + len, name, nlen);
+	len += nlen;
+	if (slash)
+		g->path[len++] = '/';
+	g->path[len] = '\0';
+	return len;
+}
+
+/**
+ * @brief Record the path built so far as a match.
+ */
+static void
+glob_add(glob_state *g, size_t len)
+{
+	char *s;
+
+	if (g->n == g->cap) {
+		size_t ncap = g->cap ? g->cap * 2 : MATCHES_INIT_CAP;
+		char **nm = arena_alloc(g->arena, ncap * sizeof(*nm));
+
+		if (!nm) {
+			g->failed = 1;
+			return;
+		}
+		if (g->n)
+			memcpy(nm, g->matches, g->n * sizeof(*nm));
+		g->matches = nm;
+		g->cap = ncap;
+	}
+
+	s = arena_alloc(g->arena, len + 1);
+	if (!s) {
+		g->failed = 1;
+		return;
+	}
+	memcpy(s, g->path, len + 1);
+	g->matches[g->n++] = s;
+}
+
+/**
+ * @brief Whether a segment may match an entry name at all.
+ */
+static int
+name_visible(const glob_seg *seg, const char *name)
+{
+	if (name[0] != '.')
+		return 1;
+	if (!name[1] || (name[1] == '.' && !name[2]))
+		return 0;
+	return seg->dot;
+}
+
+static void glob_dir(glob_state *g, int fd, int seg, size_t len);
+
+/**
+ * @brief Descend into the entry name of the directory dp.
+ */
+static void
+glob_descend(glob_state *g, DIR *dp, const char *name, int seg, size_t len)
+{
+	int fd;
+
+	len = path_put(g, len, name, 1);
+	if (!len)
+		return;
+	fd = openat(dirfd(dp), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd != -1)
+		glob_dir(g, fd, seg, len);
+}
+
+/**
+ * @brief Expand "**": any number of directories, then the next segment.
+ */
+static void
+glob_star_dir(glob_state *g, DIR *dp, int seg, size_t len)
+{
+	int last = seg == g->nsegs - 1;
+	struct dirent *de;
+	int fd;
+
+	/* no directory at all: the rest of the pattern right here */
+	if (!last) {
+		fd = openat(dirfd(dp), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd != -1)
+			glob_dir(g, fd, seg + 1, len);
+	}
+
+	while (!g->failed && (de = readdir(dp))) {
+		int dir;
+		size_t nlen;
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		/* links are not followed, so the walk cannot loop */
+		dir = entry_is_dir(dp, de, 0);
+		if (last && (dir || !g->dironly)) {
+			nlen = path_put(g, len, de->d_name, dir && g->dironly);
+			if (nlen)
+				glob_add(g, nlen);
+		}
+		if (dir)
+			glob_descend(g, dp, de->d_name, seg, len);
+	}
+}
+
+/**
+ * @brief Match segment seg in the directory open at fd.
+ *
+ * g->path holds the first len bytes of the pathname: the directory as
+ * written, with a trailing '/', or nothing for the working directory.
+ * fd is closed before returning.
+ */
+static void
+glob_dir(glob_state *g, int fd, int seg, size_t len)
+{
+	const glob_seg *s = &g->segs[seg];
+	int last = seg == g->nsegs - 1;
+	struct dirent *de;
+	DIR *dp;
+
+	if (!s->ops && !s->globstar) {
+		/* a plain name is taken as written, without reading the directory */
+		struct stat st;
+		size_t nlen = path_put(g, len, s->name, !last || g->dironly);
+
+		if (nlen && !last) {
+			int sub = openat(fd, s->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			if (sub != -1)
+				glob_dir(g, sub, seg + 1, nlen);
+		} else if (nlen && !fstatat(fd, s->name, &st, g->dironly ? 0 : AT_SYMLINK_NOFOLLOW) &&
+		           (!g->dironly || S_ISDIR(st.st_mode))) {
+			glob_add(g, nlen);
+		}
+		close(fd);
+		return;
+	}
+
+	dp = fdopendir(fd);
+	if (!dp) {
+		close(fd);
+		return;
+	}
+
+	if (s->globstar) {
+		glob_star_dir(g, dp, seg, len);
+		closedir(dp);
+		return;
+	}
+
+	while (!g->failed && (de = readdir(dp))) {
+		const char *name = de->d_name;
+		size_t nlen;
+
+		if (!name_visible(s, name) || !seg_match(s->ops, name))
+			continue;
+
+		if (last && !g->dironly) {
+			nlen = path_put(g, len, name, 0);
+			if (nlen)
+				glob_add(g, nlen);
+		} else if (entry_is_dir(dp, de, 1)) {
+			if (last) {
+				nlen = path_put(g, len, name, 1);
+				if (nlen)
+					glob_add(g, nlen);
+			} else {
+				glob_descend(g, dp, name, seg + 1, len);
+			}
+		}
+	}
+	closedir(dp);
+}
+
+static int
+match_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Expand a pattern into the pathnames it matches.
+ */
+int
+pathglob_expand(Arena *arena, const char *pattern, int globstar,
+                char ***matches, size_t *n)
+{
+	glob_state g;
+	int expands = 0;
+	size_t len = 0;
+	size_t nslash = 0;
+	char *copy, *p;
+	int fd;
+
+	*matches = NULL;
+	*n = 0;
+
+	memset(&g, 0, sizeof(g));
+	g.arena = arena;
+
+	/* split and compiled in a copy; pattern is kept for the no-match case */
+	copy = arena_strdup(arena, pattern);
+	for (p = copy; p && *p; p++)
+		nslash += *p == '/';
+	g.segs = copy ? arena_alloc(arena, (nslash + 1) * sizeof(*g.segs)) : NULL;
+	if (!g.segs) {
+		error_print(__func__, "malloc", errno);
+		return -1;
+	}
+
+	/* leading slashes are the root, as written */
+	p = copy;
+	while (*p == '/' && len < sizeof(g.path) - 1)
+		g.path[len++] = *p++;
+	while (*p == '/')
+		p++;
+
+	/* split at '/' in place; empty segments ("a//b") are dropped */
+	while (*p) {
+		char *end = strchr(p, '/');
+
+		if (end)
+			*end = '\0';
+		if (*p) {
+			g.segs[g.nsegs].name = p;
+			if (seg_compile(arena, &g.segs[g.nsegs], globstar)) {
+				error_print(__func__, "malloc", errno);
+				return -1;
+			}
+			expands |= g.segs[g.nsegs].ops != NULL || g.segs[g.nsegs].globstar;
+			g.nsegs++;
+		}
+		if (!end)
+			break;
+		g.dironly = !end[1];
+		p = end + 1;
+	}
+
+	/* nothing to expand: the word stays as written */
+	if (!expands)
+		return 0;
+
+	fd = open(len ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return 0;
+	glob_dir(&g, fd, 0, len);
+	if (g.failed) {
+		error_print(__func__, "malloc", errno);
+		return -1;
+	}
+
+	if (g.n > 1)
+		qsort(g.matches, g.n, sizeof(*g.matches), match_cmp);
+	*matches = g.matches;
+	*n = g.n;
+	return 0;
+}
+
+/**
+ * Turn a pattern back into the word it was written as.
+ */
+void
+pathglob_unescape(char *s)
+{
+	char *w = s;
+
+	for (; *s; s++) {
+		if (*s == '\\' && s[1])
+			s++;
+		*w++ = *s;
+	}
+	*w = '\0';
+}
@@ -0,0 +1,48 @@
+/**
+ * @file pathglob.h
+ * @brief Pathname expansion (`*`, `?`, `[...]` and `**`).
+ *
+ * Patterns are given in escaped form: a backslash makes the character
+ * after it literal, so quoted glob characters in a word are kept apart
+ * from the ones that expand. Each pattern is compiled once per call and
+ * every directory a segment has to look into is read in a single
+ * readdir() pass, descending with openat().
+ */
+
+#ifndef PATHGLOB_H
+#define PATHGLOB_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+/* Characters that are special in a pattern unless escaped */
+#define PATHGLOB_SPECIAL(c) ((c) == '*' || (c) == '?' || (c) == '[')
+
+/**
+ * @brief Expand a pattern into the pathnames it matches.
+ *
+ * Names starting with '.' only match a segment that starts with a
+ * literal '.'; "." and ".." never match. A trailing '/' matches
+ * directories only.
+ *
+ * @param arena     Arena the matches and their array are allocated from.
+ * @param pattern   Pattern in escaped form.
+ * @param globstar  Non-zero to let a "**" segment match any number of
+ *                  directories (symbolic links are not followed there).
+ * @param matches   Output: the matches in strcmp() order.
+ * @param n         Output: number of matches, 0 if nothing matched or the
+ *                  pattern has nothing to expand.
+ * @return          0 on success, -1 on allocation failure (reported).
+ */
+int pathglob_expand(Arena *arena, const char *pattern, int globstar,
+                    char ***matches, size_t *n);
+
+/**
+ * @brief Turn a pattern back into the word it was written as.
+ *
+ * @param s  Pattern in escaped form, unescaped in place.
+ */
+void pathglob_unescape(char *s);
+
+#endif /* PATHGLOB_H */
@@ -6,35 +6,58 @@
  *   - Multiple piped commands
  *   - Input/output/stderr redirection on any command
  *   - Builtin commands (in parent for single commands, child for pipelines)
+ *   - posix_spawn() fast path for external commands (`set -o spawn`),
+ *     with fork() kept for builtins and as the error-reporting fallback
+ *   - Launching external commands from a zygote process instead
+ *     (`set -o zygote`), see zygote.h
  *   - Phase 3: basic job control (background '&', fg/bg, process groups)
+ *   - Child status changes are applied from the main loop when
+ *     signal_child_fd() polls readable, never from a signal handler, so
+ *     the job table is only touched from one context and needs no SIGCHLD
+ *     masking
  *
  * Job id behavior:
- *   - Uses the smallest free jid in [1..MAX_JOBS]
+ *   - Uses the smallest free jid; the table grows as needed
  *   - When the job table becomes empty, jid display naturally restarts at 1
  *     for the next job, mimicking bash-style behavior.
  */
 
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* wait4(), F_SETPIPE_SZ, memfd_create() */
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pipeline.h"
 #include "error.h"
 #include "builtin.h"
+#include "datamove.h"
+#include "options.h"
+#include "pathcache.h"
+#include "placement.h"
 #include "signal_setup.h"
+#include "trace.h"
+#include "zygote.h"
 
 extern char **environ;
 extern int exit_code;
+extern int interactive;
 
 #define DEFAULT_FILE_MODE 0644
 
@@ -42,9 +65,9 @@ extern int exit_code;
 /*                                Job Control                                */
 /* ------------------------------------------------------------------------- */
 
-#define MAX_JOBS      64
-#define MAX_PROCS     64
-#define CMDLINE_MAX   1024
+#define JID_INDEX_INIT  16
+#define PID_INDEX_INIT  64
+#define WAIT_SAVED      256
 
 typedef enum {
 	JOB_UNUSED = 0,
@@ -53,6 +76,16 @@ typedef enum {
 	JOB_DONE
 } job_state_t;
 
+/* One process of a job, with the accounting collected when it exits. */
+typedef struct {
+	pid_t pid;
+	int cpu;                /* pinned CPU, -1 if not pinned */
+	int done;               /* exited or killed */
+	int status;             /* wait status, once done */
+	struct timespec end;    /* CLOCK_MONOTONIC, once done */
+	struct rusage ru;       /* from wait4(), once done */
+} job_proc_t;
+
 typedef struct job {
 	int used;
 	int jid;
@@ -62,17 +95,52 @@ typedef struct job {
 
 	int nprocs;
 	int alive;
-	pid_t pids[MAX_PROCS];
+	job_proc_t *procs;      /* nprocs entries, in pipeline order */
+
+	struct timespec start;  /* CLOCK_MONOTONIC, before the first stage */
+	struct timespec end;    /* when the last process finished */
+	int timed;              /* report times when done ('time' prefix) */
+	int nice;               /* nice increment of the stages, 0 if none */
+	int ioprio;             /* best-effort I/O level, -1 if unchanged */
 
 	pid_t last_pid;
 	int last_status_valid;
 	int last_status;
+	int stop_sig;           /* signal that last stopped the job */
 
-	char cmdline[CMDLINE_MAX];
+	const Pipeline *pipeline; /* borrowed while execute_pipeline() runs */
+	char *cmdline;          /* rendered on first use, sized to fit */
 	int notified;
+	int dirty;              /* on the dirty queue */
+	struct job *dirty_prev;
+	struct job *dirty_next;
 } job_t;
 
-static job_t jobs[MAX_JOBS];
+/*
+ * The job table is indexed by jid: jid_index[jid] points to the job
+ * holding that id, or is NULL if the id is free. Jobs are allocated
+ * individually, so job pointers stay valid while the index grows.
+ */
+static job_t **jid_index = NULL;
+static int jid_cap = 0;      /* allocated entries of jid_index */
+static int jid_top = 0;      /* highest jid in use */
+static int jid_hint = 1;     /* no free jid below this one */
+static int njobs = 0;
+
+/*
+ * pid -> job index: open addressing with linear probing and
+ * backward-shift deletion, so lookups never degrade through tombstones.
+ * Kept at a load factor of at most 1/2 by doubling in job_add().
+ */
+typedef struct {
+	pid_t pid;   /* 0 marks an empty bucket */
+	int proc;    /* index into job->procs */
+	job_t *job;
+} pid_index_entry;
+
+static pid_index_entry *pid_index = NULL;
+static size_t pid_cap = 0;   /* power of two */
+static size_t npids = 0;
 
 /* “Current” and “previous” jobs for %+ and %- */
 static int current_jid = 0;
@@ -81,23 +149,47 @@ static int previous_jid = 0;
 /* Monotonic sequence for stable “most recently started job” ordering */
 static unsigned long long next_seq = 1;
 
-/* Forward declarations (used by helpers that appear before their definitions). */
-static job_t* job_by_jid(int jid);
+/* Job whose builtin stages are running in the shell; hidden from jobs */
+static job_t *launching = NULL;
 
-static int
-jobs_any_used(void)
-{
-	for (int i = 0; i < MAX_JOBS; i++) {
-		if (jobs[i].used)
-			return 1;
-	}
-	return 0;
-}
+/* Bumped whenever a job stops or a process exits; waiters rescan only then */
+static unsigned long job_changes = 0;
 
+/*
+ * Jobs that stopped or finished since they were last reported, oldest
+ * first. Filled by the reaper, so notifications visit only these.
+ */
+static job_t *dirty_head = NULL;
+static job_t *dirty_tail = NULL;
+
+/* Notifications staged for the next write() */
+static char *notify_buf = NULL;
+static size_t notify_len = 0;
+static size_t notify_cap = 0;
+
+/*
+ * Statuses of background processes whose job was reported as done and
+ * removed before anyone waited for it, so that a later wait still gets
+ * them. A ring: the oldest entries are overwritten.
+ */
+typedef struct {
+	pid_t pid;   /* 0 for an unused or consumed entry */
+	int jid;     /* 0 once the jid belongs to a newer job */
+	int last;    /* last stage: its status is the job's */
+	int code;
+} saved_status_t;
+
+static saved_status_t saved[WAIT_SAVED];
+static int saved_next = 0;
+
+/*
+ * Job control (process groups, terminal hand-off, fg/bg) is only enabled
+ * for interactive shells; scripts run every job in the shell's own group.
+ */
 static int
 is_interactive(void)
 {
-	return isatty(STDIN_FILENO);
+	return interactive;
 }
 
 static char
@@ -125,22 +217,6 @@ job_state_str(job_state_t state)
 	}
 }
 
-static void
-sigchld_block(sigset_t *prev)
-{
-	sigset_t mask;
-
-	sigemptyset(&mask);
-	sigaddset(&mask, SIGCHLD);
-	(void)sigprocmask(SIG_BLOCK, &mask, prev);
-}
-
-static void
-sigchld_restore(const sigset_t *prev)
-{
-	(void)sigprocmask(SIG_SETMASK, prev, NULL);
-}
-
 /*
  * Recompute current/previous jobs based on the monotonic start sequence.
  * This gives a sane default for + and - when jobs are created/removed.
@@ -153,18 +229,20 @@ recompute_current_previous(void)
 	int newest_jid = 0;
 	int second_jid = 0;
 
-	for (int i = 0; i < MAX_JOBS; i++) {
-		if (!jobs[i].used)
+	for (int jid = 1; jid <= jid_top; jid++) {
+		job_t *j = jid_index[jid];
+
+		if (!j)
 			continue;
 
-		if (jobs[i].seq > newest_seq) {
+		if (j->seq > newest_seq) {
 			second_seq = newest_seq;
 			second_jid = newest_jid;
-			newest_seq = jobs[i].seq;
-			newest_jid = jobs[i].jid;
-		} else if (jobs[i].seq > second_seq) {
-			second_seq = jobs[i].seq;
-			second_jid = jobs[i].jid;
+			newest_seq = j->seq;
+			newest_jid = j->jid;
+		} else if (j->seq > second_seq) {
+			second_seq = j->seq;
+			second_jid = j->jid;
 		}
 	}
 
@@ -173,42 +251,277 @@ recompute_current_previous(void)
 }
 
 /*
- * Allocate the smallest unused jid (1..MAX_JOBS).
+ * Allocate the smallest unused jid, growing the index when all are taken.
  * This makes job ids reuse holes like bash does.
  */
 static int
 alloc_jid(void)
 {
-	for (int jid = 1; jid <= MAX_JOBS; jid++) {
-		if (!job_by_jid(jid))
-			return jid;
+	int jid;
+
+	for (jid = jid_hint; jid < jid_cap; jid++) {
+		if (!jid_index[jid])
+			break;
 	}
-	return -1;
+
+	if (jid >= jid_cap) {
+		int ncap = jid_cap ? jid_cap * 2 : JID_INDEX_INIT;
+		job_t **nidx = realloc(jid_index, (size_t)ncap * sizeof(*nidx));
+
+		if (!nidx) {
+			error_print(__func__, "realloc", errno);
+			return -1;
+		}
+
+		memset(nidx + jid_cap, 0, (size_t)(ncap - jid_cap) * sizeof(*nidx));
+		jid_index = nidx;
+		jid = jid_cap ? jid_cap : 1;
+		jid_cap = ncap;
+	}
+
+	jid_hint = jid + 1;
+	return jid;
 }
 
-static job_t*
-job_by_jid(int jid)
+static size_t
+pid_index_hash(pid_t pid)
+{
+	/* Knuth multiplicative hash, folded to the table size */
+	return ((unsigned long)pid * 2654435761u) & (pid_cap - 1);
+}
+
+/*
+ * Map pid to a job. A recycled pid still present from an older job is
+ * simply re-pointed at the new job. The caller guarantees free space.
+ */
+static void
+pid_index_put(pid_t pid, job_t *job, int proc)
+{
+	size_t i = pid_index_hash(pid);
+
+	while (pid_index[i].pid && pid_index[i].pid != pid)
+		i = (i + 1) & (pid_cap - 1);
+
+	if (!pid_index[i].pid)
+		npids++;
+
+	pid_index[i].pid = pid;
+	pid_index[i].proc = proc;
+	pid_index[i].job = job;
+}
+
+/*
+ * Make room for n more pids, doubling the table (and rehashing) while
+ * the load factor would exceed 1/2.
+ */
+static int
+pid_index_reserve(size_t n)
+{
+	pid_index_entry *old = pid_index;
+	size_t old_cap = pid_cap;
+	size_t ncap = pid_cap ? pid_cap : PID_INDEX_INIT;
+
+	while ((npids + n) * 2 > ncap)
+		ncap *= 2;
+
+	if (ncap == pid_cap)
+		return 0;
+
+	pid_index = calloc(ncap, sizeof(*pid_index));
+	if (!pid_index) {
+		error_print(__func__, "calloc", errno);
+		pid_index = old;
+		return -1;
+	}
+
+	pid_cap = ncap;
+	npids = 0;
+	for (size_t i = 0; i < old_cap; i++) {
+		if (old[i].pid)
+			pid_index_put(old[i].pid, old[i].job, old[i].proc);
+	}
+
+	free(old);
+	return 0;
+}
+
+static pid_index_entry*
+pid_index_find(pid_t pid)
 {
-	for (int i = 0; i < MAX_JOBS; i++) {
-		if (jobs[i].used && jobs[i].jid == jid)
-			return &jobs[i];
+	size_t i;
+
+	if (!pid_cap)
+		return NULL;
+
+	for (i = pid_index_hash(pid); pid_index[i].pid; i = (i + 1) & (pid_cap - 1)) {
+		if (pid_index[i].pid == pid)
+			return &pid_index[i];
 	}
 	return NULL;
 }
 
+/*
+ * Remove pid if it still maps to job, then shift later members of the
+ * probe run back so that no lookup chain is broken.
+ */
+static void
+pid_index_remove(pid_t pid, job_t *job)
+{
+	size_t mask = pid_cap - 1;
+	size_t i;
+	size_t j;
+
+	if (!pid_cap)
+		return;
+
+	i = pid_index_hash(pid);
+	while (pid_index[i].pid && pid_index[i].pid != pid)
+		i = (i + 1) & mask;
+
+	if (!pid_index[i].pid || pid_index[i].job != job)
+		return;
+
+	for (j = (i + 1) & mask; pid_index[j].pid; j = (j + 1) & mask) {
+		size_t home = pid_index_hash(pid_index[j].pid);
+
+		/* entry j may move into the hole at i unless home lies in (i, j] */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			pid_index[i] = pid_index[j];
+			i = j;
+		}
+	}
+
+	pid_index[i].pid = 0;
+	npids--;
+}
+
+static job_t*
+job_by_jid(int jid)
+{
+	if (jid <= 0 || jid > jid_top)
+		return NULL;
+
+	return jid_index[jid];
+}
+
+/* Find the job running pid; *proc receives its index in job->procs. */
 static job_t*
-job_by_pid(pid_t pid)
+job_by_pid(pid_t pid, int *proc)
+{
+	pid_index_entry *e = pid_index_find(pid);
+
+	if (!e)
+		return NULL;
+
+	*proc = e->proc;
+	return e->job;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                            Timing and Usage                               */
+/* ------------------------------------------------------------------------- */
+
+static double
+elapsed_seconds(const struct timespec *from, const struct timespec *to)
+{
+	return (double)(to->tv_sec - from->tv_sec) +
+	       (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double
+timeval_seconds(const struct timeval *tv)
+{
+	return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+/* Total usage of the finished processes of j; maxrss is the largest one. */
+static void
+job_rusage(const job_t *j, struct rusage *ru)
 {
-	for (int i = 0; i < MAX_JOBS; i++) {
-		job_t *j = &jobs[i];
-		if (!j->used)
+	memset(ru, 0, sizeof(*ru));
+
+	for (int k = 0; k < j->nprocs; k++) {
+		const struct rusage *p = &j->procs[k].ru;
+
+		if (!j->procs[k].done)
 			continue;
-		for (int k = 0; k < j->nprocs; k++) {
-			if (j->pids[k] == pid)
-				return j;
-		}
+
+		timeradd(&ru->ru_utime, &p->ru_utime, &ru->ru_utime);
+		timeradd(&ru->ru_stime, &p->ru_stime, &ru->ru_stime);
+		if (p->ru_maxrss > ru->ru_maxrss)
+			ru->ru_maxrss = p->ru_maxrss;
+		ru->ru_nvcsw += p->ru_nvcsw;
+		ru->ru_nivcsw += p->ru_nivcsw;
 	}
-	return NULL;
+}
+
+static void
+print_duration(const char *label, double secs)
+{
+	int min = (int)(secs / 60);
+
+	fprintf(stderr, "%s	%dm%.3fs\n", label, min, secs - 60.0 * min);
+}
+
+/*
+ * Print the report of the 'time' prefix, bash style, plus peak memory
+ * and context switches.
+ */
+static void
+print_times(double real, const struct rusage *ru)
+{
+	fprintf(stderr, "\n");
+	print_duration("real", real);
+	print_duration("user", timeval_seconds(&ru->ru_utime));
+	print_duration("sys", timeval_seconds(&ru->ru_stime));
+	fprintf(stderr, "maxrss\t%ldk\nctxsw\t%ld voluntary, %ld involuntary\n",
+	        ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+static void
+job_print_times(const job_t *j)
+{
+	struct rusage ru;
+
+	job_rusage(j, &ru);
+	print_times(elapsed_seconds(&j->start, &j->end), &ru);
+}
+
+/*
+ * Queue a job that stopped or finished for the next notification.
+ */
+static void
+job_dirty(job_t *j)
+{
+	j->notified = 0;
+	if (j->dirty)
+		return;
+
+	j->dirty = 1;
+	j->dirty_prev = dirty_tail;
+	j->dirty_next = NULL;
+	if (dirty_tail)
+		dirty_tail->dirty_next = j;
+	else
+		dirty_head = j;
+	dirty_tail = j;
+}
+
+static void
+job_undirty(job_t *j)
+{
+	if (!j->dirty)
+		return;
+
+	if (j->dirty_prev)
+		j->dirty_prev->dirty_next = j->dirty_next;
+	else
+		dirty_head = j->dirty_next;
+	if (j->dirty_next)
+		j->dirty_next->dirty_prev = j->dirty_prev;
+	else
+		dirty_tail = j->dirty_prev;
+	j->dirty = 0;
 }
 
 static void
@@ -217,10 +530,26 @@ job_remove(job_t *j)
 	if (!j || !j->used)
 		return;
 
-	memset(j, 0, sizeof(*j));
+	if (j->timed && j->state == JOB_DONE)
+		job_print_times(j);
+
+	for (int k = 0; k < j->nprocs; k++)
+		pid_index_remove(j->procs[k].pid, j);
+
+	job_undirty(j);
+	jid_index[j->jid] = NULL;
+	if (j->jid < jid_hint)
+		jid_hint = j->jid;
+	while (jid_top > 0 && !jid_index[jid_top])
+		jid_top--;
+	njobs--;
+
+	free(j->procs);
+	free(j->cmdline);
+	free(j);
 
 	/* If the job table is now empty, restart marks/sequence cleanly. */
-	if (!jobs_any_used()) {
+	if (!njobs) {
 		current_jid = 0;
 		previous_jid = 0;
 		next_seq = 1;
@@ -230,73 +559,132 @@ job_remove(job_t *j)
 	recompute_current_previous();
 }
 
+/*
+ * Drop every job, as a subshell does: its processes are not children of
+ * the process calling this, so they can neither be waited for nor
+ * brought to the foreground.
+ */
 static void
-format_cmdline(Command *pipeline, char out[CMDLINE_MAX])
+jobs_forget(void)
 {
-	size_t used = 0;
-	Command *cmd;
+	for (int jid = jid_top; jid > 0; jid--) {
+		if (jid_index[jid]) {
+			jid_index[jid]->timed = 0;
+			job_remove(jid_index[jid]);
+		}
+	}
+	memset(saved, 0, sizeof(saved));
+}
+
+/*
+ * Render a pipeline as "cmd args | cmd args &" into an allocated string
+ * sized to fit.
+ */
+static char*
+format_cmdline(const Pipeline *pipeline)
+{
+	size_t len = 0;
+	const Command *cmd;
+	char *out;
+	char *p;
+	int s;
+
+	for (s = 0; s < pipeline->nstages; s++) {
+		cmd = &pipeline->stages[s];
+		for (int i = 0; i < cmd->argc; i++)
+			len += strlen(cmd->argv[i]) + 1;
+	}
+	len += 2 * (size_t)pipeline->nstages;
 
-	out[0] = '\0';
+	out = malloc(len + 1);
+	if (!out) {
+		error_print(__func__, "malloc", errno);
+		return NULL;
+	}
 
-	for (cmd = pipeline; cmd; cmd = cmd->next) {
+	p = out;
+	for (s = 0; s < pipeline->nstages; s++) {
+		cmd = &pipeline->stages[s];
 		for (int i = 0; i < cmd->argc; i++) {
-			int n;
-
-			n = snprintf(out + used, CMDLINE_MAX - used, "%s%s",
-			             used ? " " : "", cmd->argv[i]);
-			if (n < 0)
-				return;
-			if ((size_t)n >= CMDLINE_MAX - used) {
-				out[CMDLINE_MAX - 1] = '\0';
-				return;
-			}
-			used += (size_t)n;
-		}
+			size_t n = strlen(cmd->argv[i]);
 
-		if (cmd->next) {
-			int n;
+			if (p != out)
+				*p++ = ' ';
+			memcpy(p, cmd->argv[i], n);
+			p += n;
+		}
 
-			n = snprintf(out + used, CMDLINE_MAX - used, " | ");
-			if (n < 0)
-				return;
-			if ((size_t)n >= CMDLINE_MAX - used) {
-				out[CMDLINE_MAX - 1] = '\0';
-				return;
-			}
-			used += (size_t)n;
+		if (s < pipeline->nstages - 1) {
+			memcpy(p, " |", 2);
+			p += 2;
 		}
 	}
 
-	if (pipeline && pipeline->background)
-		(void)snprintf(out + used, CMDLINE_MAX - used, " &");
+	if (pipeline->background) {
+		memcpy(p, " &", 2);
+		p += 2;
+	}
+	*p = '\0';
+
+	return out;
+}
+
+/*
+ * The display string of a job. It is rendered from the pipeline the
+ * first time something prints it, so foreground jobs that finish
+ * without being listed never format one.
+ */
+static const char*
+job_cmdline(job_t *j)
+{
+	if (!j->cmdline && j->pipeline)
+		j->cmdline = format_cmdline(j->pipeline);
+	return j->cmdline ? j->cmdline : "";
+}
+
+/*
+ * Render the display string of a job that outlives its execute_pipeline()
+ * call and drop the reference to the pipeline, which the caller frees.
+ */
+static void
+job_detach(job_t *j)
+{
+	job_cmdline(j);
+	j->pipeline = NULL;
 }
 
+/*
+ * Add a job to the table and index its pids. The pipeline is only
+ * referenced until job_detach().
+ */
 static job_t*
-job_add(pid_t pgid, pid_t *pids, int nprocs, pid_t last_pid, Command *pipeline)
+job_add(pid_t pgid, pid_t *pids, const int *cpus, int nprocs, pid_t last_pid,
+        const Pipeline *pipeline, const struct timespec *start)
 {
-	job_t *j = NULL;
-	char cmdline[CMDLINE_MAX];
+	job_t *j;
 	int jid;
 
-	for (int i = 0; i < MAX_JOBS; i++) {
-		if (!jobs[i].used) {
-			j = &jobs[i];
-			break;
-		}
-	}
-
-	if (!j)
+	j = calloc(1, sizeof(*j));
+	if (!j) {
+		error_print(__func__, "calloc", errno);
 		return NULL;
+	}
 
-	memset(j, 0, sizeof(*j));
-	j->used = 1;
+	j->procs = calloc((size_t)nprocs, sizeof(*j->procs));
+	if (!j->procs || pid_index_reserve((size_t)nprocs))
+		goto fail;
 
 	jid = alloc_jid();
-	if (jid < 0) {
-		memset(j, 0, sizeof(*j));
-		return NULL;
+	if (jid < 0)
+		goto fail;
+
+	/* %jid means this job from now on */
+	for (int i = 0; i < WAIT_SAVED; i++) {
+		if (saved[i].jid == jid)
+			saved[i].jid = 0;
 	}
 
+	j->used = 1;
 	j->jid = jid;
 	j->seq = next_seq++;
 	j->pgid = pgid;
@@ -306,17 +694,30 @@ job_add(pid_t pgid, pid_t *pids, int nprocs, pid_t last_pid, Command *pipeline)
 	j->last_pid = last_pid;
 	j->last_status_valid = 0;
 	j->notified = 0;
+	j->start = *start;
+	j->pipeline = pipeline;
+	j->timed = pipeline->timed;
+	j->nice = options_get(OPT_NICE);
+	j->ioprio = options_get(OPT_IONICE);
+
+	for (int k = 0; k < nprocs; k++) {
+		j->procs[k].pid = pids[k];
+		j->procs[k].cpu = cpus ? cpus[k] : -1;
+		pid_index_put(pids[k], j, k);
+	}
 
-	if (nprocs > MAX_PROCS)
-		nprocs = MAX_PROCS;
-	for (int k = 0; k < nprocs; k++)
-		j->pids[k] = pids[k];
-
-	format_cmdline(pipeline, cmdline);
-	snprintf(j->cmdline, sizeof(j->cmdline), "%s", cmdline);
+	jid_index[jid] = j;
+	if (jid > jid_top)
+		jid_top = jid;
+	njobs++;
 
 	recompute_current_previous();
 	return j;
+
+fail:
+	free(j->procs);
+	free(j);
+	return NULL;
 }
 
 static int
@@ -329,91 +730,296 @@ status_to_exitcode(int status)
 	return 0;
 }
 
-/**
- * @brief Reap child status changes and update the job table.
- *
- * Called from the SIGCHLD handler (signal_setup.c). This function must
- * remain async-signal-safe: do not call non-signal-safe functions such as
- * malloc(), printf(), etc.
- */
-void
-jobs_sigchld_reap(void)
+/* Remember the statuses of a finished job that is about to be removed. */
+static void
+job_save_statuses(const job_t *j)
 {
-	int saved_errno = errno;
-	int status;
-	pid_t pid;
+	for (int k = 0; k < j->nprocs; k++) {
+		saved_status_t *e = &saved[saved_next];
+		int status = j->procs[k].status;
 
-	while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-		job_t *j = job_by_pid(pid);
-		if (!j)
+		/* only terminations: a stop is not a status wait reports later */
+		if (!j->procs[k].done || !(WIFEXITED(status) || WIFSIGNALED(status)))
 			continue;
 
-		if (WIFSTOPPED(status)) {
-			j->state = JOB_STOPPED;
-			j->notified = 0;
-			continue;
-		}
+		e->pid = j->procs[k].pid;
+		e->jid = j->jid;
+		e->last = j->procs[k].pid == j->last_pid;
+		e->code = status_to_exitcode(status);
+		saved_next = (saved_next + 1) % WAIT_SAVED;
+	}
+}
 
-		if (WIFCONTINUED(status)) {
-			j->state = JOB_RUNNING;
-			j->notified = 0;
-			continue;
-		}
+/*
+ * Record the exit of process k of job j, with its resource usage.
+ */
+static void
+job_proc_exited(job_t *j, int k, int status, const struct rusage *ru)
+{
+	job_proc_t *p = &j->procs[k];
 
-		if (WIFEXITED(status) || WIFSIGNALED(status)) {
-			if (pid == j->last_pid) {
-				j->last_status = status;
-				j->last_status_valid = 1;
-			}
+	/* the pid may be recycled from now on */
+	pid_index_remove(p->pid, j);
 
-			if (j->alive > 0)
-				j->alive--;
-			if (j->alive == 0) {
-				j->state = JOB_DONE;
-				j->notified = 0;
-			}
-		}
+	p->done = 1;
+	p->status = status;
+	p->ru = *ru;
+	clock_gettime(CLOCK_MONOTONIC, &p->end);
+
+	if (p->pid == j->last_pid) {
+		j->last_status = status;
+		j->last_status_valid = 1;
 	}
 
-	errno = saved_errno;
+	if (j->alive > 0)
+		j->alive--;
+	if (j->alive == 0) {
+		j->state = JOB_DONE;
+		j->end = p->end;
+		job_dirty(j);
+	}
+	job_changes++;
+
+	if (trace_enabled())
+		trace_printf("event=exit jid=%d pid=%d stage=%d status=%d "
+		             "real=%.6f user=%.6f sys=%.6f maxrss=%ld "
+		             "nvcsw=%ld nivcsw=%ld cmd=%s",
+		             j->jid, (int)p->pid, k, status_to_exitcode(status),
+		             elapsed_seconds(&j->start, &p->end),
+		             timeval_seconds(&ru->ru_utime),
+		             timeval_seconds(&ru->ru_stime),
+		             ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, job_cmdline(j));
 }
 
-/**
- * @brief Print notifications for background job state changes.
- *
- * Prints "Stopped" and "Done" notifications for jobs that have changed
- * state since the last call. Done jobs are removed from the job table.
- * Safe to call from the main loop before printing the next prompt.
+/*
+ * Commands started by the parallel builtin. They are not jobs: the
+ * builtin waits for them itself, so they are kept out of the job table
+ * and its notifications and only looked up here when the reaper finds
+ * a pid no job owns.
  */
-void
-pipeline_notify_jobs(void)
-{
-	sigset_t prev;
+typedef struct {
+	pid_t pid;               /* 0 for a free slot */
+	size_t seq;              /* item number */
+} par_worker_t;
+
+/* Output of one -k item, held until every earlier item is written. */
+typedef struct {
+	int fd;                  /* memfd with the output, -1 once written */
+	int done;
+} par_output_t;
+
+typedef struct {
+	par_worker_t *workers;
+	int nworkers;            /* slots, the concurrency limit */
+	int running;
+	par_output_t *outputs;   /* per item with -k, NULL otherwise */
+	size_t outputs_cap;
+	int failed;              /* items that exited non-zero */
+	int interrupted;         /* an item was killed by SIGINT */
+} par_state_t;
+
+static par_state_t *par = NULL;
 
-	sigchld_block(&prev);
+/*
+ * Record a status change of a parallel worker. Returns 1 if pid is one.
+ * A stopped worker is continued right away: the builtin runs in the
+ * shell and cannot be suspended as a whole.
+ */
+static int
+par_worker_changed(pid_t pid, int status)
+{
+	if (!par)
+		return 0;
 
-	for (int i = 0; i < MAX_JOBS; i++) {
-		job_t *j = &jobs[i];
+	for (int i = 0; i < par->nworkers; i++) {
+		par_worker_t *w = &par->workers[i];
 
-		if (!j->used || j->notified)
+		if (w->pid != pid)
 			continue;
 
-		if (j->state == JOB_STOPPED) {
-			fprintf(stderr, "[%d]%c  %s\t%s\n",
-			        j->jid, job_mark(j->jid), job_state_str(j->state), j->cmdline);
-			j->notified = 1;
-			continue;
+		if (WIFSTOPPED(status)) {
+			kill(pid, SIGCONT);
+			return 1;
 		}
+		if (!WIFEXITED(status) && !WIFSIGNALED(status))
+			return 1;
 
-		if (j->state == JOB_DONE) {
-			fprintf(stderr, "[%d]%c  %s\t%s\n",
-			        j->jid, job_mark(j->jid), job_state_str(j->state), j->cmdline);
-			j->notified = 1;
+		w->pid = 0;
+		par->running--;
+		if (status_to_exitcode(status))
+			par->failed++;
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+			par->interrupted = 1;
+		if (par->outputs)
+			par->outputs[w->seq].done = 1;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Collect child status changes (signal_child_wait()) and update the job
+ * table. With WNOHANG in options, takes changes until no child reports;
+ * without it, blocks for a single change.
+ */
+static void
+reap_children(int options)
+{
+	struct rusage ru;
+	int status;
+	pid_t pid;
+	int k;
+
+	int blocking = !(options & WNOHANG);
+
+	while ((pid = signal_child_wait(&status, &ru, blocking)) > 0) {
+		job_t *j = job_by_pid(pid, &k);
+
+		if (!j) {
+			par_worker_changed(pid, status);
+			if (blocking)
+				break;
+			continue;
+		}
+
+		if (WIFSTOPPED(status)) {
+			/* one report per job, not per stopped process */
+			if (j->state != JOB_STOPPED)
+				job_dirty(j);
+			j->state = JOB_STOPPED;
+			j->stop_sig = WSTOPSIG(status);
+			job_changes++;
+		} else if (WIFCONTINUED(status)) {
+			j->state = JOB_RUNNING;
+			j->notified = 0;
+		}
+
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			job_proc_exited(j, k, status, &ru);
+
+		if (blocking)
+			break;
+	}
+}
+
+/**
+ * @brief Reap children that changed state since the last call.
+ */
+void
+pipeline_reap(void)
+{
+	/* drain first: an event arriving while we reap stays pending */
+	if (signal_child_drain())
+		reap_children(WNOHANG);
+}
+
+/**
+ * @brief Check whether pipeline_notify_jobs() has anything to report.
+ */
+int
+pipeline_jobs_changed(void)
+{
+	for (job_t *j = dirty_head; j; j = j->dirty_next) {
+		if (!j->notified && (j->state == JOB_STOPPED || j->state == JOB_DONE))
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Number of jobs currently in the job table.
+ */
+int
+pipeline_job_count(void)
+{
+	return njobs;
+}
+
+/*
+ * Stage one notification line. On allocation failure the line is
+ * dropped; the job is still marked as reported.
+ */
+static void
+notify_add(const job_t *j, const char *cmdline)
+{
+	int n = snprintf(NULL, 0, "[%d]%c  %s\t%s\n",
+	                 j->jid, job_mark(j->jid), job_state_str(j->state), cmdline);
+
+	if (n < 0)
+		return;
+	if (notify_len + (size_t)n + 1 > notify_cap) {
+		size_t ncap = notify_cap ? notify_cap : 256;
+		char *nbuf;
+
+		while (notify_len + (size_t)n + 1 > ncap)
+			ncap *= 2;
+		nbuf = realloc(notify_buf, ncap);
+		if (!nbuf)
+			return;
+		notify_buf = nbuf;
+		notify_cap = ncap;
+	}
+
+	snprintf(notify_buf + notify_len, notify_cap - notify_len, "[%d]%c  %s\t%s\n",
+	         j->jid, job_mark(j->jid), job_state_str(j->state), cmdline);
+	notify_len += (size_t)n;
+}
+
+static void
+notify_flush(void)
+{
+	size_t off = 0;
+
+	while (off < notify_len) {
+		ssize_t w = write(STDERR_FILENO, notify_buf + off, notify_len - off);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		off += (size_t)w;
+	}
+	notify_len = 0;
+}
+
+/**
+ * @brief Print notifications for background job state changes.
+ *
+ * Reaps pending child events, then reports the jobs on the dirty queue
+ * that stopped or finished since the last call, all in a single
+ * write(). Done jobs are removed from the job table. Non-interactive
+ * shells remove finished jobs silently.
+ */
+void
+pipeline_notify_jobs(void)
+{
+	int interactive = is_interactive();
+
+	pipeline_reap();
+
+	while (dirty_head) {
+		job_t *j = dirty_head;
+
+		job_undirty(j);
+		if (j->notified)
+			continue;
+
+		if (j->state == JOB_STOPPED) {
+			if (interactive)
+				notify_add(j, job_cmdline(j));
+			j->notified = 1;
+		} else if (j->state == JOB_DONE) {
+			if (interactive)
+				notify_add(j, job_cmdline(j));
+			j->notified = 1;
+			job_save_statuses(j);
 			job_remove(j);
 		}
 	}
 
-	sigchld_restore(&prev);
+	notify_flush();
 }
 
 static int
@@ -441,49 +1047,136 @@ parse_job_spec(const char *s)
 	return (int)v;
 }
 
-static int
-builtin_jobs(void)
+/*
+ * Placement of a process for jobs -l, e.g. "\tcpu 3 nice 5 ionice be/4";
+ * nothing if it runs where and how the shell does.
+ */
+static void
+print_placement(const job_t *j, const job_proc_t *p)
+{
+	const char *sep = "\t";
+
+	if (p->cpu >= 0) {
+		printf("%scpu %d", sep, p->cpu);
+		sep = " ";
+	}
+	if (j->nice) {
+		printf("%snice %d", sep, j->nice);
+		sep = " ";
+	}
+	if (j->ioprio >= 0)
+		printf("%sionice be/%d", sep, j->ioprio);
+}
+
+/*
+ * jobs -l: one line per process under the job line, with the time since
+ * the job started, for finished processes their resource usage, and the
+ * placement set up by pin-stages, nice and ionice.
+ */
+static void
+print_job_procs(const job_t *j)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (int k = 0; k < j->nprocs; k++) {
+		const job_proc_t *p = &j->procs[k];
+
+		if (!p->done) {
+			printf("\t%d\t%s\treal %.3fs", (int)p->pid,
+			       j->state == JOB_STOPPED ? "stopped" : "running",
+			       elapsed_seconds(&j->start, &now));
+		} else {
+			printf("\t%d\t%s %d\treal %.3fs user %.3fs sys %.3fs "
+			       "maxrss %ldk ctxsw %ld/%ld",
+			       (int)p->pid,
+			       WIFSIGNALED(p->status) ? "signal" : "exit",
+			       WIFSIGNALED(p->status) ? WTERMSIG(p->status)
+			                              : WEXITSTATUS(p->status),
+			       elapsed_seconds(&j->start, &p->end),
+			       timeval_seconds(&p->ru.ru_utime),
+			       timeval_seconds(&p->ru.ru_stime),
+			       p->ru.ru_maxrss, p->ru.ru_nvcsw, p->ru.ru_nivcsw);
+		}
+
+		print_placement(j, p);
+		putchar('\n');
+	}
+}
+
+/**
+ * @brief Handle the builtin `jobs [-l]` command.
+ */
+int
+builtin_jobs(Command *cmd)
 {
-	sigset_t prev;
+	int verbose = 0;
+
+	for (int i = 1; i < cmd->argc; i++) {
+		if (strcmp(cmd->argv[i], "-l")) {
+			error_print("jobs", "usage: jobs [-l]", 0);
+			exit_code = 2;
+			return -1;
+		}
+		verbose = 1;
+	}
 
-	sigchld_block(&prev);
+	pipeline_reap();
 
-	for (int i = 0; i < MAX_JOBS; i++) {
-		job_t *j = &jobs[i];
-		if (!j->used)
+	for (int jid = 1; jid <= jid_top; jid++) {
+		job_t *j = jid_index[jid];
+		if (!j || j == launching)
 			continue;
 		printf("[%d]%c  %s\t%s\n",
-		       j->jid, job_mark(j->jid), job_state_str(j->state), j->cmdline);
+		       j->jid, job_mark(j->jid), job_state_str(j->state), job_cmdline(j));
+		if (verbose)
+			print_job_procs(j);
 	}
 
-	sigchld_restore(&prev);
-
 	exit_code = 0;
 	return 0;
 }
 
+/*
+ * Sleep in poll() on the child event descriptor until the job is no
+ * longer running. SIGINT and friends only interrupt the poll.
+ */
 static void
 wait_foreground(job_t *j)
 {
-	sigset_t mask, prev;
+	struct pollfd pfd;
 
-	sigemptyset(&mask);
-	sigaddset(&mask, SIGCHLD);
-	sigprocmask(SIG_BLOCK, &mask, &prev);
+	pfd.fd = signal_child_fd();
+	pfd.events = POLLIN;
 
-	while (j->used && j->state == JOB_RUNNING)
-		sigsuspend(&prev);
-
-	sigprocmask(SIG_SETMASK, &prev, NULL);
+	pipeline_reap();
+	while (j->used && j->state == JOB_RUNNING) {
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			/* cannot wait for events: block in waitpid() instead */
+			reap_children(0);
+			continue;
+		}
+		pipeline_reap();
+	}
 }
 
-static int
+/**
+ * @brief Handle the builtin `fg [%job]` command.
+ */
+int
 builtin_fg(Command *cmd)
 {
 	int jid;
 	job_t *j;
 	pid_t shell_pgid;
 
+	if (!is_interactive()) {
+		error_print("fg", "no job control", 0);
+		exit_code = 1;
+		return -1;
+	}
+
 	jid = parse_job_spec(cmd->argc >= 2 ? cmd->argv[1] : NULL);
 	if (jid <= 0) {
 		error_print("fg", "no such job", 0);
@@ -491,11 +1184,8 @@ builtin_fg(Command *cmd)
 		return -1;
 	}
 
-	sigset_t prev;
-	sigchld_block(&prev);
 	j = job_by_jid(jid);
 	if (!j) {
-		sigchld_restore(&prev);
 		error_print("fg", "no such job", 0);
 		exit_code = 1;
 		return -1;
@@ -508,8 +1198,6 @@ builtin_fg(Command *cmd)
 	j->notified = 0;
 	j->state = JOB_RUNNING;
 
-	sigchld_restore(&prev);
-
 	shell_pgid = getpgrp();
 	kill(-j->pgid, SIGCONT);
 
@@ -521,7 +1209,6 @@ builtin_fg(Command *cmd)
 	if (is_interactive())
 		tcsetpgrp(STDIN_FILENO, shell_pgid);
 
-	sigchld_block(&prev);
 	if (j->used && j->state == JOB_DONE) {
 		if (j->last_status_valid)
 			exit_code = status_to_exitcode(j->last_status);
@@ -532,20 +1219,28 @@ builtin_fg(Command *cmd)
 		/* stopped */
 		exit_code = 0;
 		if (j->used)
-			j->notified = 0;
+			job_dirty(j);
 	}
-	sigchld_restore(&prev);
 
 	pipeline_notify_jobs();
 	return 0;
 }
 
-static int
+/**
+ * @brief Handle the builtin `bg [%job]` command.
+ */
+int
 builtin_bg(Command *cmd)
 {
 	int jid;
 	job_t *j;
 
+	if (!is_interactive()) {
+		error_print("bg", "no job control", 0);
+		exit_code = 1;
+		return -1;
+	}
+
 	jid = parse_job_spec(cmd->argc >= 2 ? cmd->argv[1] : NULL);
 	if (jid <= 0) {
 		error_print("bg", "no such job", 0);
@@ -553,11 +1248,8 @@ builtin_bg(Command *cmd)
 		return -1;
 	}
 
-	sigset_t prev;
-	sigchld_block(&prev);
 	j = job_by_jid(jid);
 	if (!j) {
-		sigchld_restore(&prev);
 		error_print("bg", "no such job", 0);
 		exit_code = 1;
 		return -1;
@@ -569,141 +1261,611 @@ builtin_bg(Command *cmd)
 
 	j->state = JOB_RUNNING;
 	j->notified = 0;
-	sigchld_restore(&prev);
 
 	kill(-j->pgid, SIGCONT);
 	printf("[%d]%c  %s\t%s &\n",
-	       j->jid, job_mark(j->jid), job_state_str(j->state), j->cmdline);
+	       j->jid, job_mark(j->jid), job_state_str(j->state), job_cmdline(j));
 
 	exit_code = 0;
 	return 0;
 }
 
+/*
+ * Sleep in poll() on the child event descriptor until job_changes moves
+ * past seen. Returns 0 then, or -1 if a signal other than SIGCHLD (^C)
+ * interrupted the wait.
+ */
 static int
-builtin_jobctl(Command *cmd)
-{
-	if (!strcmp(cmd->argv[0], "jobs"))
-		return builtin_jobs();
-	if (!strcmp(cmd->argv[0], "fg"))
-		return builtin_fg(cmd);
-	if (!strcmp(cmd->argv[0], "bg"))
-		return builtin_bg(cmd);
-	return 1;
+wait_job_change(unsigned long seen)
+{
+	struct pollfd pfd;
+
+	pfd.fd = signal_child_fd();
+	pfd.events = POLLIN;
+
+	pipeline_reap();
+	while (job_changes == seen) {
+		if (poll(&pfd, 1, -1) == -1) {
+			if (errno != EINTR) {
+				/* cannot wait for events: block in waitpid() instead */
+				reap_children(0);
+				continue;
+			}
+			/* the self-pipe fallback interrupts poll() for SIGCHLD too */
+			if (!signal_child_drain())
+				return -1;
+			reap_children(WNOHANG);
+			continue;
+		}
+		pipeline_reap();
+	}
+	return 0;
 }
 
-/* ------------------------------------------------------------------------- */
-/*                              Exec Utilities                               */
-/* ------------------------------------------------------------------------- */
+/*
+ * Find the job and process index of pid, including processes that have
+ * already exited (and left the pid index) in jobs not yet removed.
+ */
+static job_t*
+job_by_any_pid(pid_t pid, int *proc)
+{
+	job_t *j = job_by_pid(pid, proc);
+
+	for (int jid = 1; !j && jid <= jid_top; jid++) {
+		job_t *c = jid_index[jid];
+
+		for (int k = 0; c && k < c->nprocs; k++) {
+			if (c->procs[k].pid == pid) {
+				*proc = k;
+				return c;
+			}
+		}
+	}
+	return j;
+}
 
+/*
+ * Exit status of a job that is no longer running, or of one of its
+ * processes if proc >= 0. A stopped job reports 128 + the stop signal.
+ */
 static int
-get_path(const char *cmd, char *path)
+wait_status(const job_t *j, int proc)
 {
-	const char *env;
-	char *temp;
-	char *tok;
+	if (proc >= 0 && j->procs[proc].done)
+		return status_to_exitcode(j->procs[proc].status);
+	if (j->state == JOB_STOPPED)
+		return 128 + j->stop_sig;
+	if (j->last_status_valid)
+		return status_to_exitcode(j->last_status);
+	return 0;
+}
 
-	if (strchr(cmd, '/')) {
-		if (access(cmd, X_OK))
-			return -1;
+/*
+ * Whether a wait for job j (or its process proc, if >= 0) is over.
+ */
+static int
+wait_done(const job_t *j, int proc)
+{
+	if (proc >= 0 && j->procs[proc].done)
+		return 1;
+	return j->state != JOB_RUNNING;
+}
 
-		strncpy(path, cmd, PATH_MAX - 1);
-		path[PATH_MAX - 1] = '\0';
-		return 0;
-	}
+/*
+ * Whether job j (or its process proc, if >= 0) has terminated: unlike
+ * wait_done(), a job that only stopped is still waited for.
+ */
+static int
+wait_ended(const job_t *j, int proc)
+{
+	if (proc >= 0 && j->procs[proc].done)
+		return 1;
+	return j->state == JOB_DONE;
+}
 
-	env = getenv("PATH");
-	if (!env) {
-		error_print(__func__, "getenv \"PATH\"", errno);
-		return -1;
-	}
+/*
+ * Resolve a wait operand: %job, or the pid of any process of a job.
+ * Returns the job (proc is -1 for a job spec). For a job that was
+ * already reported and removed, returns NULL with *gone pointing to its
+ * saved status; otherwise NULL after reporting the operand.
+ */
+static job_t*
+wait_operand(const char *arg, int *proc, saved_status_t **gone)
+{
+	job_t *j = NULL;
+	int jid = 0;
+	pid_t pid = 0;
+	char *end;
+	long v;
 
-	temp = strdup(env);
-	if (!temp) {
-		error_print(__func__, "strdup", errno);
-		return -1;
+	*proc = -1;
+	*gone = NULL;
+	if (arg[0] == '%') {
+		jid = parse_job_spec(arg);
+		if (jid > 0)
+			j = job_by_jid(jid);
+	} else {
+		errno = 0;
+		v = strtol(arg, &end, 10);
+		if (!errno && end != arg && !*end && v > 0 && v <= INT_MAX)
+			pid = (pid_t)v;
+		if (pid)
+			j = job_by_any_pid(pid, proc);
 	}
+	if (j && j != launching)
+		return j;
 
-	tok = strtok(temp, ":");
-	while (tok) {
-		snprintf(path, PATH_MAX, "%s/%s", tok, cmd);
-		if (!access(path, X_OK)) {
-			free(temp);
-			return 0;
+	/* newest entry first: pids are recycled */
+	for (int n = 1; (jid > 0 || pid) && n <= WAIT_SAVED; n++) {
+		saved_status_t *e = &saved[(saved_next + WAIT_SAVED - n) % WAIT_SAVED];
+
+		if (e->pid && (pid ? e->pid == pid : e->jid == jid && e->last)) {
+			*gone = e;
+			return NULL;
 		}
-		tok = strtok(NULL, ":");
 	}
 
-	free(temp);
-	return -1;
+	if (arg[0] == '%') {
+		error_print("wait", "no such job", 0);
+	} else {
+		char msg[64];
+
+		snprintf(msg, sizeof(msg), "%.20s: not a child of this shell", arg);
+		error_print("wait", msg, 0);
+	}
+	return NULL;
 }
 
+/*
+ * wait -n: the first job of the operands (all jobs without operands)
+ * that terminates; jobs that stop meanwhile are still waited for.
+ * Returns its status, 127 if there is no job to wait for, or -1 if
+ * interrupted.
+ */
 static int
-setup_redirects(Command *cmd)
+wait_any(Command *cmd, int first)
 {
-	int fd;
-	int flags;
-
-	/* Input redirect */
-	if (cmd->redirect[REDIR_STDIN]) {
-		fd = open(cmd->redirect[REDIR_STDIN], O_RDONLY);
-		if (fd == -1) {
-			error_print("open", cmd->redirect[REDIR_STDIN], errno);
-			return -1;
+	int nops = cmd->argc - first;
+	job_t **jobs = NULL;
+	int *procs = NULL;
+	int code = 127;
+	int early = 0;
+
+	/* operands are resolved once: nothing is removed while we wait */
+	if (nops) {
+		jobs = malloc((size_t)nops * sizeof(*jobs));
+		procs = malloc((size_t)nops * sizeof(*procs));
+		if (!jobs || !procs) {
+			error_print("wait", "malloc", errno);
+			free(jobs);
+			free(procs);
+			return 1;
 		}
-		if (dup2(fd, STDIN_FILENO) == -1) {
-			error_print("dup2", "stdin redirect", errno);
-			close(fd);
-			return -1;
+		pipeline_reap();
+		for (int i = 0; i < nops; i++) {
+			saved_status_t *gone;
+
+			jobs[i] = wait_operand(cmd->argv[first + i], &procs[i], &gone);
+			if (gone && !early) {
+				/* finished before the wait began */
+				code = gone->code;
+				gone->pid = 0;
+				early = 1;
+			}
 		}
-		close(fd);
 	}
 
-	/* Output redirect */
-	if (cmd->redirect[REDIR_STDOUT]) {
-		flags = O_WRONLY | O_CREAT;
-		flags |= (cmd->append & APPEND_STDOUT) ? O_APPEND : O_TRUNC;
-		fd = open(cmd->redirect[REDIR_STDOUT], flags, DEFAULT_FILE_MODE);
-		if (fd == -1) {
-			error_print("open", cmd->redirect[REDIR_STDOUT], errno);
-			return -1;
+	while (!early) {
+		unsigned long seen;
+		job_t *found = NULL;
+		int proc = -1;
+		int pending = 0;
+
+		pipeline_reap();
+		seen = job_changes;
+
+		for (int i = 0; nops && i < nops && !found; i++) {
+			if (!jobs[i])
+				continue;
+			if (wait_ended(jobs[i], procs[i])) {
+				found = jobs[i];
+				proc = procs[i];
+			}
+			pending = 1;
 		}
-		if (dup2(fd, STDOUT_FILENO) == -1) {
-			error_print("dup2", "stdout redirect", errno);
-			close(fd);
-			return -1;
+		for (int jid = 1; !nops && jid <= jid_top && !found; jid++) {
+			job_t *j = jid_index[jid];
+
+			if (!j || j == launching)
+				continue;
+			if (wait_ended(j, -1))
+				found = j;
+			pending = 1;
 		}
-		close(fd);
-	}
 
-	/* Stderr redirect */
-	if (cmd->redirect[REDIR_STDERR]) {
-		flags = O_WRONLY | O_CREAT;
-		flags |= (cmd->append & APPEND_STDERR) ? O_APPEND : O_TRUNC;
-		fd = open(cmd->redirect[REDIR_STDERR], flags, DEFAULT_FILE_MODE);
-		if (fd == -1) {
-			error_print("open", cmd->redirect[REDIR_STDERR], errno);
-			return -1;
+		if (found) {
+			code = wait_status(found, proc);
+			if (found->state == JOB_DONE)
+				job_remove(found);
+			break;
 		}
-		if (dup2(fd, STDERR_FILENO) == -1) {
-			error_print("dup2", "stderr redirect", errno);
-			close(fd);
-			return -1;
+		if (!pending)
+			break;
+		if (wait_job_change(seen)) {
+			code = -1;
+			break;
 		}
-		close(fd);
 	}
 
-	return 0;
+	free(jobs);
+	free(procs);
+	return code;
 }
 
-static void
-execute_child(Command *cmd, int prev_fd, int pipe_fd[2])
+/**
+ * @brief Handle the builtin `wait [-n] [%job | pid ...]` command.
+ */
+int
+builtin_wait(Command *cmd)
 {
-	char path[PATH_MAX];
+	int first = 1;
+	int code = 0;
+
+	if (cmd->argc > 1 && !strcmp(cmd->argv[1], "-n"))
+		first = 2;
+
+	if (first == 2) {
+		code = wait_any(cmd, first);
+		if (code == -1)
+			code = 130;
+		exit_code = code;
+		return 0;
+	}
+
+	/* no operands: until no job is running */
+	if (first >= cmd->argc) {
+		for (;;) {
+			unsigned long seen;
+			int running = 0;
+
+			pipeline_reap();
+			seen = job_changes;
+
+			for (int jid = 1; jid <= jid_top && !running; jid++) {
+				job_t *j = jid_index[jid];
+
+				running = j && j != launching && j->state == JOB_RUNNING;
+			}
+			if (!running)
+				break;
+			if (wait_job_change(seen)) {
+				code = 130;
+				break;
+			}
+		}
+		exit_code = code;
+		return 0;
+	}
+
+	for (int i = first; i < cmd->argc; i++) {
+		saved_status_t *gone;
+		int proc;
+		job_t *j;
+
+		pipeline_reap();
+		j = wait_operand(cmd->argv[i], &proc, &gone);
+		if (!j) {
+			code = gone ? gone->code : 127;
+			if (gone)
+				gone->pid = 0;
+			continue;
+		}
+
+		while (!wait_done(j, proc)) {
+			if (wait_job_change(job_changes)) {
+				exit_code = 130;
+				return 0;
+			}
+		}
+
+		code = wait_status(j, proc);
+		if (j->state == JOB_DONE)
+			job_remove(j);
+	}
+
+	exit_code = code;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Exec Utilities                               */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Open a descriptor that reads the text of a here-document or
+ * here-string. Text up to PIPE_BUF goes into a pipe, which takes it
+ * without blocking; longer text into a memfd. Neither touches the file
+ * system. The descriptor is close-on-exec.
+ *
+ * Returns the descriptor, or -1 with errno set; nothing is printed.
+ */
+static int
+here_open(const char *text)
+{
+	size_t len = strlen(text);
+	size_t off = 0;
+	int fds[2];
+	int err;
+
+	if (len <= PIPE_BUF) {
+		if (pipe2(fds, O_CLOEXEC) == -1)
+			return -1;
+	} else {
+		fds[0] = fds[1] = memfd_create("here-document", MFD_CLOEXEC);
+		if (fds[0] == -1)
+			return -1;
+	}
+
+	while (off < len) {
+		ssize_t w = write(fds[1], text + off, len - off);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			err = errno;
+			if (fds[1] != fds[0])
+				close(fds[1]);
+			close(fds[0]);
+			errno = err;
+			return -1;
+		}
+		off += (size_t)w;
+	}
+
+	if (fds[1] != fds[0])
+		close(fds[1]);
+	else
+		lseek(fds[0], 0, SEEK_SET);
+	return fds[0];
+}
+
+static int
+setup_redirects(Command *cmd)
+{
+	int fd;
+	int flags;
+
+	/* Input redirect */
+	if (cmd->append & HERE_STDIN) {
+		fd = here_open(cmd->redirect[REDIR_STDIN]);
+		if (fd == -1) {
+			error_print("open", "here-document", errno);
+			return -1;
+		}
+		if (dup2(fd, STDIN_FILENO) == -1) {
+			error_print("dup2", "stdin redirect", errno);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	} else if (cmd->redirect[REDIR_STDIN]) {
+		fd = open(cmd->redirect[REDIR_STDIN], O_RDONLY);
+		if (fd == -1) {
+			error_print("open", cmd->redirect[REDIR_STDIN], errno);
+			return -1;
+		}
+		if (dup2(fd, STDIN_FILENO) == -1) {
+			error_print("dup2", "stdin redirect", errno);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+
+	/* Output redirect */
+	if (cmd->redirect[REDIR_STDOUT]) {
+		flags = O_WRONLY | O_CREAT;
+		flags |= (cmd->append & APPEND_STDOUT) ? O_APPEND : O_TRUNC;
+		fd = open(cmd->redirect[REDIR_STDOUT], flags, DEFAULT_FILE_MODE);
+		if (fd == -1) {
+			error_print("open", cmd->redirect[REDIR_STDOUT], errno);
+			return -1;
+		}
+		if (dup2(fd, STDOUT_FILENO) == -1) {
+			error_print("dup2", "stdout redirect", errno);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+
+	/* Stderr redirect */
+	if (cmd->redirect[REDIR_STDERR]) {
+		flags = O_WRONLY | O_CREAT;
+		flags |= (cmd->append & APPEND_STDERR) ? O_APPEND : O_TRUNC;
+		fd = open(cmd->redirect[REDIR_STDERR], flags, DEFAULT_FILE_MODE);
+		if (fd == -1) {
+			error_print("open", cmd->redirect[REDIR_STDERR], errno);
+			return -1;
+		}
+		if (dup2(fd, STDERR_FILENO) == -1) {
+			error_print("dup2", "stderr redirect", errno);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+
+	return 0;
+}
+
+#if USE_POSIX_SPAWN
+/* spawn_child(): posix_spawn() failed and the error was reported */
+#define SPAWN_FAILED ((pid_t)-2)
+
+/*
+ * Open the redirection targets of cmd in the shell, close-on-exec, into
+ * fds[REDIR_*] (-1 where there is none). Each file is opened exactly
+ * once, so the spawn file actions are plain dup2()s and a failed spawn
+ * has not touched any file. Errors are reported as setup_redirects()
+ * reports them; nothing is left open then.
+ */
+static int
+spawn_open_redirects(Command *cmd, int fds[REDIR_COUNT])
+{
+	int flags;
+
+	for (int r = 0; r < REDIR_COUNT; r++)
+		fds[r] = -1;
+
+	for (int r = 0; r < REDIR_COUNT; r++) {
+		const char *target = cmd->redirect[r];
+
+		if (!target)
+			continue;
+
+		if (r == REDIR_STDIN && (cmd->append & HERE_STDIN)) {
+			fds[r] = here_open(target);
+			target = "here-document";
+		} else if (r == REDIR_STDIN) {
+			fds[r] = open(target, O_RDONLY | O_CLOEXEC);
+		} else {
+			flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+			flags |= (cmd->append & (r == REDIR_STDOUT ? APPEND_STDOUT : APPEND_STDERR)) ?
+			         O_APPEND : O_TRUNC;
+			fds[r] = open(target, flags, DEFAULT_FILE_MODE);
+		}
+
+		if (fds[r] == -1) {
+			error_print("open", target, errno);
+			for (int k = 0; k < r; k++) {
+				if (fds[k] != -1)
+					close(fds[k]);
+			}
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Launch an external command with posix_spawn(), mirroring what
+ * execute_child() does after fork(): pipe wiring, redirections, process
+ * group and default signal dispositions. pipe_fd[0] may be -1 when
+ * stdout goes to a plain descriptor; pgid -1 keeps the shell's group.
+ *
+ * Returns the child pid. -1 means the spawn was not attempted, before
+ * any file was opened, and the caller falls back to fork(). Once the
+ * redirections are open the command is never launched a second way:
+ * SPAWN_FAILED means the error was reported and *code holds the status
+ * the fork path would have exited with.
+ */
+static pid_t
+spawn_child(Command *cmd, const char *path, int prev_fd, int pipe_fd[2],
+            pid_t pgid, int *code)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t defaults, mask;
+	char fresh[PATH_MAX];
+	int fds[REDIR_COUNT];
+	pid_t pid;
+	int err = 0;
+
+	if (posix_spawn_file_actions_init(&fa))
+		return -1;
+
+	if (posix_spawnattr_init(&attr)) {
+		posix_spawn_file_actions_destroy(&fa);
+		return -1;
+	}
+
+	/* Connect stdin to previous pipe (if not first command) */
+	if (prev_fd != -1) {
+		err |= posix_spawn_file_actions_adddup2(&fa, prev_fd, STDIN_FILENO);
+		err |= posix_spawn_file_actions_addclose(&fa, prev_fd);
+	}
+
+	/* Connect stdout to next pipe (if not last command) */
+	if (pipe_fd) {
+		if (pipe_fd[0] != -1)
+			err |= posix_spawn_file_actions_addclose(&fa, pipe_fd[0]);
+		err |= posix_spawn_file_actions_adddup2(&fa, pipe_fd[1], STDOUT_FILENO);
+		err |= posix_spawn_file_actions_addclose(&fa, pipe_fd[1]);
+	}
+
+	signal_default_set(&defaults);
+	signal_child_mask(&mask);
+	err |= posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+	                                       POSIX_SPAWN_SETSIGMASK |
+	                                       (is_interactive() && pgid != -1 ?
+	                                        POSIX_SPAWN_SETPGROUP : 0));
+	err |= posix_spawnattr_setpgroup(&attr, pgid);
+	err |= posix_spawnattr_setsigdefault(&attr, &defaults);
+	err |= posix_spawnattr_setsigmask(&attr, &mask);
+
+	if (err) {
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&fa);
+		return -1;
+	}
+
+	/* from here on, the command is launched by this path or not at all */
+	*code = 1;
+	if (spawn_open_redirects(cmd, fds)) {
+		err = -1;
+	} else {
+		/* File redirects override pipe connections; REDIR_* are fd numbers */
+		for (int r = 0; !err && r < REDIR_COUNT; r++) {
+			if (fds[r] != -1)
+				err = posix_spawn_file_actions_adddup2(&fa, fds[r], r);
+		}
+		if (err) {
+			error_print("posix_spawn", "file actions", err);
+		} else {
+			err = posix_spawn(&pid, path, &fa, &attr, cmd->argv, environ);
+
+			/* Hashed location vanished: fall back to a fresh PATH walk */
+			if (err == ENOENT && !strchr(cmd->argv[0], '/') &&
+			    !pathcache_search(cmd->argv[0], fresh))
+				err = posix_spawn(&pid, fresh, &fa, &attr, cmd->argv, environ);
+			if (err) {
+				error_print(cmd->argv[0], strerror(err), 0);
+				*code = 126;
+			}
+		}
+		for (int r = 0; r < REDIR_COUNT; r++) {
+			if (fds[r] != -1)
+				close(fds[r]);
+		}
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+
+	return err ? SPAWN_FAILED : pid;
+}
+#endif /* USE_POSIX_SPAWN */
+
+/*
+ * Runs in the forked child, after placement_apply(). path is the
+ * executable resolved by the parent through the command hash table, or
+ * NULL if the lookup failed. As with spawn_child(), pipe_fd[0] may be -1.
+ */
+static void
+execute_child(Command *cmd, const char *path, int prev_fd, int pipe_fd[2])
+{
+	char fresh[PATH_MAX];
 	int builtin_ret;
 
 	/* Restore default signal handlers for child */
 	signal_restore_defaults();
 
+	/* a builtin goes on as a shell and may wait for children of its own */
+	if ((builtin_classify(cmd) & BUILTIN_FOUND) && signal_child_reset())
+		_exit(1);
+
 	/* Connect stdin to previous pipe (if not first command) */
 	if (prev_fd != -1) {
 		if (dup2(prev_fd, STDIN_FILENO) == -1)
@@ -713,7 +1875,8 @@ execute_child(Command *cmd, int prev_fd, int pipe_fd[2])
 
 	/* Connect stdout to next pipe (if not last command) */
 	if (pipe_fd) {
-		close(pipe_fd[0]);
+		if (pipe_fd[0] != -1)
+			close(pipe_fd[0]);
 		if (dup2(pipe_fd[1], STDOUT_FILENO) == -1)
 			_exit(1);
 		close(pipe_fd[1]);
@@ -726,26 +1889,268 @@ execute_child(Command *cmd, int prev_fd, int pipe_fd[2])
 	/* Try builtin first */
 	builtin_ret = builtin_exec(cmd);
 	if (builtin_ret != 1) {
-		if (builtin_ret == 2)
-			_exit(exit_code);
-		_exit(builtin_ret == 0 ? 0 : 1);
+		/* _exit() skips stdio: push out what the builtin printed */
+		fflush(stdout);
+		_exit(exit_code);
 	}
 
 	/* External command */
-	if (get_path(cmd->argv[0], path) == -1) {
+	if (!path) {
 		error_print(cmd->argv[0], "command not found", 0);
 		_exit(127);
 	}
 
 	execve(path, cmd->argv, environ);
+
+	/* Hashed location vanished: fall back to a fresh PATH walk */
+	if (errno == ENOENT && !strchr(cmd->argv[0], '/') &&
+	    !pathcache_search(cmd->argv[0], fresh))
+		execve(fresh, cmd->argv, environ);
+
 	error_print(cmd->argv[0], strerror(errno), 0);
 	_exit(126);
 }
 
+#if USE_ZYGOTE
+/* zygote_exec_fn: the launched process, with the shell's placement */
+static void
+zygote_exec(const zygote_launch *l)
+{
+	placement_apply(l->cpu, l->nice, l->ionice);
+	execute_child(l->cmd, l->path, -1, NULL);
+}
+
+/*
+ * Launch an external command through the zygote, forking it on first
+ * use. Arguments are as for spawn_child(); cpu is the CPU to pin to, or
+ * -1. The process is a child of the shell like a forked one.
+ *
+ * Returns the child pid, or -1 if the zygote could not launch it; the
+ * caller then falls back to its own launch path. If the zygote cannot
+ * be started at all, the option is turned off after the one report.
+ */
+static pid_t
+zygote_child(Command *cmd, const char *path, int prev_fd, int pipe_fd[2],
+             pid_t pgid, int cpu)
+{
+	zygote_launch l;
+
+	if (!zygote_running() && zygote_start() == -1) {
+		options_set("zygote", 0);
+		return -1;
+	}
+
+	/* the shell's current stdio, which pipeline_capture() may have moved */
+	l.cmd = cmd;
+	l.path = path;
+	l.fds[0] = prev_fd != -1 ? prev_fd : STDIN_FILENO;
+	l.fds[1] = pipe_fd ? pipe_fd[1] : STDOUT_FILENO;
+	l.fds[2] = STDERR_FILENO;
+	l.pgid = is_interactive() && pgid != -1 ? pgid : getpgrp();
+	l.cpu = cpu;
+	l.nice = options_get(OPT_NICE);
+	l.ionice = options_get(OPT_IONICE);
+
+	return zygote_spawn(&l);
+}
+#endif /* USE_ZYGOTE */
+
+/**
+ * @brief Serve as the zygote if this process was started as one.
+ *
+ * Called first in main(); see zygote_helper().
+ */
+void
+pipeline_zygote_helper(int argc, char *argv[])
+{
+#if USE_ZYGOTE
+	zygote_helper(argc, argv, zygote_exec);
+#else
+	(void)argc;
+	(void)argv;
+#endif
+}
+
 /* ------------------------------------------------------------------------- */
 /*                           Pipeline Execution                               */
 /* ------------------------------------------------------------------------- */
 
+/*
+ * Run a builtin in the shell process. Returns 0 if it ran, 1 if it is
+ * not a builtin, 2 if the shell should exit.
+ */
+static int
+run_parent_builtin(Command *cmd)
+{
+	int ret;
+
+	ret = builtin_exec(cmd);
+	if (ret == 2)
+		return 2;
+	return ret == 1 ? 1 : 0;
+}
+
+/*
+ * Whether a builtin stage may read its stdin inside the shell. The input
+ * must be a file, or a pipe fed only by processes that are already
+ * running: deferred builtins run downstream first, so one anywhere
+ * upstream would start after this stage is done reading. A terminal is
+ * left to a child: the shell never hands the terminal to itself, so ^C
+ * and ^Z could not reach a builtin reading from it.
+ */
+static int
+stdin_usable_in_shell(const Command *cmd, int first, int upstream_deferred)
+{
+	if (cmd->redirect[REDIR_STDIN])
+		return 1;
+	if (!first)
+		return !upstream_deferred;
+	return !isatty(STDIN_FILENO);
+}
+
+static int
+set_cloexec(int fd)
+{
+	return fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/*
+ * Pipe buffer size wanted for the next pipeline: TINYSHELL_PIPE_SIZE if
+ * set, else `set -o pipebuf`. 0 keeps the kernel default. Both are read
+ * per pipeline, so changing either affects the next command line.
+ */
+static int
+pipe_size_wanted(void)
+{
+	const char *env = getenv("TINYSHELL_PIPE_SIZE");
+	int size;
+
+	if (env && *env) {
+		if (!options_parse_size(env, &size))
+			return size;
+		error_print("TINYSHELL_PIPE_SIZE", "invalid size", 0);
+	}
+	return options_get(OPT_PIPEBUF);
+}
+
+/*
+ * Largest size an unprivileged F_SETPIPE_SZ may ask for, read from
+ * /proc once (0 if unknown).
+ */
+static int
+pipe_size_max(void)
+{
+	static int max = -1;
+	FILE *f;
+
+	if (max != -1)
+		return max;
+
+	max = 0;
+	f = fopen("/proc/sys/fs/pipe-max-size", "r");
+	if (f) {
+		if (fscanf(f, "%d", &max) != 1)
+			max = 0;
+		fclose(f);
+	}
+	return max;
+}
+
+/*
+ * Resize a new pipe, clamping to pipe-max-size when the kernel refuses
+ * the request. Returns the effective buffer size (-1 if unknown); on
+ * failure the pipe simply keeps its default size.
+ */
+static int
+pipe_resize(int fd, int size)
+{
+	int got = fcntl(fd, F_SETPIPE_SZ, size);
+
+	if (got == -1 && errno == EPERM && pipe_size_max() > 0 &&
+	    size > pipe_size_max())
+		got = fcntl(fd, F_SETPIPE_SZ, pipe_size_max());
+	if (got == -1)
+		got = fcntl(fd, F_GETPIPE_SZ);
+	return got;
+}
+
+/*
+ * Run a builtin in the shell with stdin/stdout taken from in_fd/out_fd
+ * (-1 keeps the shell's own) and its redirections applied. The shell's
+ * descriptors are saved beforehand and restored afterwards, so the
+ * builtin writes straight into a pipe or file without a fork.
+ *
+ * Returns like run_parent_builtin(); exit_code is 1 if the descriptors
+ * could not be set up.
+ */
+static int
+run_builtin_in_shell(Command *cmd, int in_fd, int out_fd)
+{
+	int saved[REDIR_COUNT] = { -1, -1, -1 };
+	int ret = 0;
+	int fd;
+
+	/* keep earlier output ahead of whatever the builtin writes */
+	fflush(stdout);
+
+	for (fd = 0; fd < REDIR_COUNT; fd++) {
+		int used = cmd->redirect[fd] ||
+		           (fd == STDIN_FILENO && in_fd != -1) ||
+		           (fd == STDOUT_FILENO && out_fd != -1);
+
+		if (!used)
+			continue;
+
+		saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+		if (saved[fd] == -1) {
+			error_print(__func__, "fcntl", errno);
+			ret = -1;
+			goto restore;
+		}
+	}
+
+	if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+	    (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1)) {
+		error_print(__func__, "dup2", errno);
+		ret = -1;
+		goto restore;
+	}
+
+	if (setup_redirects(cmd) == -1) {
+		ret = -1;
+		goto restore;
+	}
+
+	ret = run_parent_builtin(cmd);
+
+restore:
+	fflush(stdout);
+	for (fd = 0; fd < REDIR_COUNT; fd++) {
+		if (saved[fd] == -1)
+			continue;
+		dup2(saved[fd], fd);
+		close(saved[fd]);
+	}
+
+	if (ret == -1) {
+		exit_code = 1;
+		ret = 0;
+	}
+	return ret;
+}
+
+/*
+ * Per-stage execution plan: the builtin classification of the stage and,
+ * for a builtin stage deferred until every external stage is running,
+ * the pipe ends it reads from and writes to (-1 for the shell's own).
+ */
+typedef struct {
+	unsigned int kind;       /* builtin_classify() flags */
+	int in_fd;
+	int out_fd;
+	int deferred;
+} shell_stage_t;
+
 /**
  * @brief Execute a pipeline of commands.
  *
@@ -753,27 +2158,48 @@ execute_child(Command *cmd, int prev_fd, int pipe_fd[2])
  * and performs basic job control for foreground/background execution.
  * Updates the global exit_code to the last command's status.
  *
- * @param pipeline  Head of a Command linked list.
+ * Builtins run inside the shell when possible: a single builtin always
+ * (redirections are applied and undone around it), and forkless
+ * builtins in foreground pipelines that feed only other builtins. The
+ * latter run after all external stages are started, last stage first,
+ * so that every reader of their output already exists; none of those
+ * readers is a process that a stop signal could leave blocking the shell.
+ *
+ * @param pipeline  Parsed pipeline.
  * @return          0 on success,
  *                  1 if the shell should exit ("exit" builtin),
  *                 -1 on fatal error.
  */
 int
-execute_pipeline(Command *pipeline)
+execute_pipeline(Pipeline *pipeline)
 {
 	Command *cmd;
 	int prev_fd = -1;
 	int pipe_fd[2];
+	char path[PATH_MAX];
+	const char *resolved;
 	int cmd_count = 0;
 	pid_t pid;
 	pid_t pgid = 0;
 	pid_t last_pid = -1;
 	pid_t *pids = NULL;
+	shell_stage_t *stages = NULL;
+	int nproc = 0;
+	int in_shell = 0;
+	int last_in_shell = 0;
+	int forked;
+	int last_code = 0;
+	int spawn_code;
 	int status;
 	int i;
 	int background;
-	job_t *job;
-	sigset_t prevmask;
+	int pipe_size = 0;
+	int pipe_eff = 0;
+	int *cpus = NULL;
+	int placed;
+	unsigned int kind;
+	job_t *job = NULL;
+	struct timespec start;
 
 	if (!pipeline)
 		return 0;
@@ -782,61 +2208,177 @@ execute_pipeline(Command *pipeline)
 	pipeline_notify_jobs();
 
 	background = pipeline->background ? 1 : 0;
-
-	/* Count commands */
-	for (cmd = pipeline; cmd; cmd = cmd->next)
-		cmd_count++;
-
+	cmd_count = pipeline->nstages;
 	if (cmd_count <= 0)
 		return 0;
+	cmd = pipeline->stages;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	/*
-	 * Single builtin without redirects: run in parent.
+	 * Single builtin: run in parent, redirected if needed.
 	 * (required for cd/exit and job control builtins).
 	 */
-	if (cmd_count == 1 &&
-	    !pipeline->redirect[REDIR_STDIN] &&
-	    !pipeline->redirect[REDIR_STDOUT] &&
-	    !pipeline->redirect[REDIR_STDERR]) {
+	kind = builtin_classify(cmd);
+	if (cmd_count == 1 && (kind & BUILTIN_FOUND) &&
+	    (!(kind & BUILTIN_READS_STDIN) ||
+	     stdin_usable_in_shell(cmd, 1, 0))) {
+		struct rusage before, after;
+		struct timespec end;
 		int ret;
 
-		ret = builtin_jobctl(pipeline);
-		if (ret != 1)
-			return 0;
+		if (pipeline->timed)
+			getrusage(RUSAGE_SELF, &before);
 
-		ret = builtin_exec(pipeline);
+		ret = run_builtin_in_shell(cmd, -1, -1);
 		if (ret == 2)
 			return 1;
-		if (ret != 1)
-			return 0;
-	}
 
-	if (cmd_count > MAX_PROCS) {
-		error_print(__func__, "pipeline too long", 0);
-		exit_code = 1;
-		return -1;
+		if (pipeline->timed) {
+			/* the shell's own usage; maxrss is the shell's peak */
+			getrusage(RUSAGE_SELF, &after);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+			timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+			after.ru_nvcsw -= before.ru_nvcsw;
+			after.ru_nivcsw -= before.ru_nivcsw;
+			print_times(elapsed_seconds(&start, &end), &after);
+		}
+		return 0;
 	}
 
 	pids = malloc((size_t)cmd_count * sizeof(pid_t));
-	if (!pids) {
+	stages = calloc((size_t)cmd_count, sizeof(*stages));
+	if (options_get(OPT_PIN_STAGES))
+		cpus = malloc((size_t)cmd_count * sizeof(*cpus));
+	if (!pids || !stages || (options_get(OPT_PIN_STAGES) && !cpus)) {
 		error_print(__func__, "malloc", errno);
+		free(pids);
+		free(stages);
+		free(cpus);
 		return -1;
 	}
 
-	/* Block SIGCHLD while we fork and add the job (race prevention) */
-	sigchld_block(&prevmask);
+	/*
+	 * Classify every stage once. Background pipelines are a job of their
+	 * own: every stage forks.
+	 */
+	for (i = 0; i < cmd_count; i++) {
+		cmd = &pipeline->stages[i];
+		stages[i].kind = i ? builtin_classify(cmd) : kind;
+		stages[i].in_fd = stages[i].out_fd = -1;
+		stages[i].deferred = !background &&
+		                     (stages[i].kind & BUILTIN_FORKLESS) &&
+		                     (!(stages[i].kind & BUILTIN_READS_STDIN) ||
+		                      stdin_usable_in_shell(cmd, i == 0, in_shell));
+		in_shell += stages[i].deferred;
+	}
+
+	/*
+	 * A stage in the shell blocks while its pipe is full. A forked reader
+	 * downstream may stop (^Z in a pager) and the shell would never get
+	 * back to the prompt, so a builtin with a forked stage after it forks
+	 * too.
+	 */
+	for (i = cmd_count - 1, forked = 0; i >= 0; i--) {
+		if (stages[i].deferred && forked) {
+			stages[i].deferred = 0;
+			in_shell--;
+		}
+		forked |= !stages[i].deferred;
+	}
+	last_in_shell = stages[cmd_count - 1].deferred;
+
+	/* Stages that fork, in order, get consecutive CPUs */
+	if (cpus)
+		placement_assign(cpus, cmd_count - in_shell);
+
+	/* Placement is applied between fork() and exec() */
+	placed = cpus || options_get(OPT_NICE) || options_get(OPT_IONICE) != -1;
+
+	if (cmd_count > 1)
+		pipe_size = pipe_size_wanted();
+
+	/*
+	 * Children that exit before job_add() are not lost: their events stay
+	 * queued on the child descriptor until the next pipeline_reap().
+	 */
+	for (i = 0; i < cmd_count; i++) {
+		cmd = &pipeline->stages[i];
 
-	cmd = pipeline;
-	for (i = 0; i < cmd_count; i++, cmd = cmd->next) {
 		/* Create pipe if not the last command */
 		if (i < cmd_count - 1) {
 			if (pipe(pipe_fd) == -1) {
 				error_print(__func__, "pipe", errno);
 				goto fatal;
 			}
+
+			if (pipe_size)
+				pipe_eff = pipe_resize(pipe_fd[1], pipe_size);
+			else if (!pipe_eff && trace_enabled())
+				pipe_eff = fcntl(pipe_fd[1], F_GETPIPE_SZ);
+
+			/*
+			 * Pipe ends held open for builtin stages must not leak
+			 * into children, or their readers would never see EOF.
+			 */
+			if (in_shell &&
+			    (set_cloexec(pipe_fd[0]) || set_cloexec(pipe_fd[1]))) {
+				error_print(__func__, "fcntl", errno);
+				close(pipe_fd[0]);
+				close(pipe_fd[1]);
+				goto fatal;
+			}
 		}
 
-		pid = fork();
+		if (stages[i].deferred) {
+			stages[i].in_fd = prev_fd;
+			if (i < cmd_count - 1) {
+				stages[i].out_fd = pipe_fd[1];
+				prev_fd = pipe_fd[0];
+			} else {
+				prev_fd = -1;
+			}
+			continue;
+		}
+
+		/* Resolve in the parent so the hash table learns the result */
+		resolved = NULL;
+		if (!stages[i].kind && !pathcache_lookup(cmd->argv[0], path))
+			resolved = path;
+
+		pid = -1;
+#if USE_ZYGOTE
+		if (resolved && options_get(OPT_ZYGOTE))
+			pid = zygote_child(cmd, resolved, prev_fd,
+			                   (i < cmd_count - 1) ? pipe_fd : NULL,
+			                   pgid, cpus ? cpus[nproc] : -1);
+#endif
+#if USE_POSIX_SPAWN
+		if (pid == -1 && resolved && options_get(OPT_SPAWN) && !placed)
+			pid = spawn_child(cmd, resolved, prev_fd,
+			                  (i < cmd_count - 1) ? pipe_fd : NULL,
+			                  pgid, &spawn_code);
+		if (pid == SPAWN_FAILED) {
+			/* reported; the stage has no process, as if it exited at once */
+			if (prev_fd != -1)
+				close(prev_fd);
+			prev_fd = -1;
+			if (i < cmd_count - 1) {
+				close(pipe_fd[1]);
+				prev_fd = pipe_fd[0];
+			} else {
+				last_in_shell = 1;
+				last_code = spawn_code;
+			}
+			continue;
+		}
+#else
+		(void)placed;
+		(void)spawn_code;
+#endif
+		if (pid == -1)
+			pid = fork();
 		if (pid == -1) {
 			error_print(__func__, "fork", errno);
 			if (i < cmd_count - 1) {
@@ -848,35 +2390,52 @@ execute_pipeline(Command *pipeline)
 
 		if (pid == 0) {
 			/* Child */
-			sigchld_restore(&prevmask);
+			if (is_interactive()) {
+				if (pgid == 0)
+					pgid = getpid();
+				setpgid(0, pgid);
+			}
 
-			if (pgid == 0)
-				pgid = getpid();
-			setpgid(0, pgid);
+			/*
+			 * A builtin child never reaches execve(), so close-on-exec
+			 * does not drop the pipe ends held for deferred stages.
+			 */
+			for (int k = 0; k < i; k++) {
+				if (stages[k].in_fd != -1)
+					close(stages[k].in_fd);
+				if (stages[k].out_fd != -1)
+					close(stages[k].out_fd);
+			}
 
-			execute_child(cmd, prev_fd,
+			placement_apply(cpus ? cpus[nproc] : -1, options_get(OPT_NICE),
+			                options_get(OPT_IONICE));
+			execute_child(cmd, resolved, prev_fd,
 			              (i < cmd_count - 1) ? pipe_fd : NULL);
 			/* execute_child never returns */
 		}
 
 		/* Parent */
-		pids[i] = pid;
-		if (pgid == 0)
-			pgid = pid;
+		pids[nproc++] = pid;
 
 		/* Ensure child joins its process group (race-safe) */
-		if (setpgid(pid, pgid) == -1) {
-			if (errno != EACCES && errno != ESRCH)
-				error_print(__func__, "setpgid", errno);
+		if (is_interactive()) {
+			if (pgid == 0)
+				pgid = pid;
+
+			if (setpgid(pid, pgid) == -1) {
+				if (errno != EACCES && errno != ESRCH)
+					error_print(__func__, "setpgid", errno);
+			}
 		}
 
 		/* Give terminal to foreground job ASAP (avoid SIGTTIN races) */
-		if (!background && is_interactive() && i == 0)
+		if (!background && is_interactive() && nproc == 1)
 			tcsetpgrp(STDIN_FILENO, pgid);
 
 		/* Close previous pipe read end */
 		if (prev_fd != -1)
 			close(prev_fd);
+		prev_fd = -1;
 
 		/* Close write end, save read end for next command */
 		if (i < cmd_count - 1) {
@@ -887,58 +2446,99 @@ execute_pipeline(Command *pipeline)
 		last_pid = pid;
 	}
 
-	job = job_add(pgid, pids, cmd_count, last_pid, pipeline);
-	sigchld_restore(&prevmask);
+	if (nproc) {
+		job = job_add(pgid, pids, cpus, nproc, last_pid, pipeline, &start);
+		if (!job) {
+			exit_code = 1;
+			goto fatal;
+		}
 
-	if (!job) {
-		error_print(__func__, "too many jobs", 0);
-		exit_code = 1;
-		goto fatal_unblocked;
+		if (trace_enabled())
+			trace_printf("event=start jid=%d pgid=%d stages=%d background=%d "
+			             "pipe_size=%d cmd=%s",
+			             job->jid, (int)pgid, nproc, background, pipe_eff,
+			             job_cmdline(job));
 	}
 
 	if (background) {
-		printf("[%d] %d\n", job->jid, (int)job->pgid);
+		if (job && is_interactive())
+			printf("[%d] %d\n", job->jid, (int)job->pgid);
+		if (job)
+			job_detach(job);
 		exit_code = 0;
+		free(stages);
 		free(pids);
+		free(cpus);
 		return 0;
 	}
 
-	/* Foreground: wait for completion or stop */
-	wait_foreground(job);
+	/* Builtin stages, downstream first: their readers are all running */
+	launching = job;
+	for (i = cmd_count - 1; in_shell && i >= 0; i--) {
+		if (!stages[i].deferred)
+			continue;
 
-	/* Restore terminal to shell */
-	if (is_interactive())
-		tcsetpgrp(STDIN_FILENO, getpgrp());
+		run_builtin_in_shell(&pipeline->stages[i], stages[i].in_fd,
+		                     stages[i].out_fd);
+		if (i == cmd_count - 1)
+			last_code = exit_code;
 
-	/* Collect status for foreground job */
-	sigchld_block(&prevmask);
-	if (job->used && job->state == JOB_DONE) {
-		if (job->last_status_valid)
-			exit_code = status_to_exitcode(job->last_status);
-		else
+		if (stages[i].in_fd != -1)
+			close(stages[i].in_fd);
+		if (stages[i].out_fd != -1)
+			close(stages[i].out_fd);
+		stages[i].deferred = 0;
+	}
+	launching = NULL;
+
+	/* Foreground: wait for completion or stop */
+	if (job) {
+		wait_foreground(job);
+
+		/* Restore terminal to shell */
+		if (is_interactive())
+			tcsetpgrp(STDIN_FILENO, getpgrp());
+
+		/* Collect status for foreground job */
+		if (job->used && job->state == JOB_DONE) {
+			if (job->last_status_valid)
+				exit_code = status_to_exitcode(job->last_status);
+			else
+				exit_code = 0;
+			job_remove(job);
+		} else if (job->used && job->state == JOB_STOPPED) {
 			exit_code = 0;
-		job_remove(job);
-	} else if (job->used && job->state == JOB_STOPPED) {
-		exit_code = 0;
-		job->notified = 0;
+			job_dirty(job);
+			job_detach(job);
+		}
 	}
-	sigchld_restore(&prevmask);
 
+	/* The status of a pipeline is the one of its last stage */
+	if (last_in_shell)
+		exit_code = last_code;
+
+	free(stages);
 	free(pids);
+	free(cpus);
 	pipeline_notify_jobs();
 	return 0;
 
 fatal:
-	/* Parent fatal path while SIGCHLD is still blocked */
-	sigchld_restore(&prevmask);
-
-fatal_unblocked:
 	/* Best effort cleanup */
 	if (prev_fd != -1)
 		close(prev_fd);
 
+	for (i = 0; i < cmd_count; i++) {
+		if (!stages[i].deferred)
+			continue;
+		if (stages[i].in_fd != -1)
+			close(stages[i].in_fd);
+		if (stages[i].out_fd != -1)
+			close(stages[i].out_fd);
+	}
+
 	/* Reap any children we already started */
-	for (int k = 0; k < i; k++) {
+	for (int k = 0; k < nproc; k++) {
 		while (waitpid(pids[k], &status, 0) == -1) {
 			if (errno == EINTR)
 				continue;
@@ -946,7 +2546,581 @@ fatal_unblocked:
 		}
 	}
 
+	free(stages);
 	free(pids);
+	free(cpus);
+	return -1;
+}
+
+/**
+ * @brief Check whether a substituted line can run in the shell itself.
+ *
+ * Only when it cannot change shell state: every stage is an external
+ * command or a builtin that is forkless and not a parent builtin (echo,
+ * printf, pwd, test, ...), and nothing is left running in the background.
+ */
+static int
+capture_in_shell(const Pipeline *pipeline)
+{
+	if (pipeline->background)
+		return 0;
+
+	for (int i = 0; i < pipeline->nstages; i++) {
+		unsigned int flags = builtin_classify(&pipeline->stages[i]);
+
+		if ((flags & BUILTIN_FOUND) &&
+		    (!(flags & BUILTIN_FORKLESS) || (flags & BUILTIN_PARENT)))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Run a substituted line in a forked subshell writing into fd.
+ *
+ * SIGCHLD is held off until the subshell is waited for, so the
+ * self-pipe handler cannot reap it first. The subshell drops the job
+ * table and the zygote, whose commands would be children of the shell
+ * rather than of the subshell, takes a self-pipe of its own so neither
+ * process drains the other's SIGCHLD wakeups, and runs without job
+ * control.
+ *
+ * @return  0 once the subshell has finished, -1 if it could not be forked.
+ */
+static int
+capture_fork(Pipeline *pipeline, int fd)
+{
+	sigset_t set, old;
+	int status;
+	pid_t pid;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, &old);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid == -1) {
+		error_print(__func__, "fork", errno);
+		sigprocmask(SIG_SETMASK, &old, NULL);
+		return -1;
+	}
+
+	if (pid == 0) {
+		if (signal_child_reset())
+			_exit(1);
+		sigprocmask(SIG_SETMASK, &old, NULL);
+		if (dup2(fd, STDOUT_FILENO) == -1)
+			_exit(1);
+		interactive = 0;
+		jobs_forget();
+		zygote_stop();
+		options_set("zygote", 0);
+
+		execute_pipeline(pipeline);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(exit_code & 0xff);
+	}
+
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			status = 0;
+			break;
+		}
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	exit_code = status_to_exitcode(status);
+	return 0;
+}
+
+/**
+ * @brief Run a command line and capture its standard output.
+ *
+ * The output goes to a memfd, so no reader has to keep up while the
+ * command runs. A line that cannot change shell state runs in the shell
+ * with its stdout pointed at the memfd, so builtins write to it directly
+ * and external stages inherit it; any other line runs in a subshell.
+ */
+int
+pipeline_capture(char *line, char **out, size_t *len)
+{
+	Pipeline *pipeline;
+	struct stat st;
+	int fd;
+	int saved;
+	char *buf;
+	size_t off = 0;
+
+	*out = NULL;
+	*len = 0;
+
+	fd = memfd_create("capture", MFD_CLOEXEC);
+	if (fd == -1) {
+		error_print(__func__, "memfd_create", errno);
+		return -1;
+	}
+
+	pipeline = parser_parse(line);
+	if (pipeline && !capture_in_shell(pipeline)) {
+		int ret = capture_fork(pipeline, fd);
+
+		parser_free_pipeline(pipeline);
+		if (ret) {
+			close(fd);
+			return -1;
+		}
+	} else if (pipeline) {
+		fflush(stdout);
+		saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+		if (saved == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+			error_print(__func__, "dup2", errno);
+			if (saved != -1)
+				close(saved);
+			parser_free_pipeline(pipeline);
+			close(fd);
+			return -1;
+		}
+
+		execute_pipeline(pipeline);
+		parser_free_pipeline(pipeline);
+
+		fflush(stdout);
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+	}
+
+	if (fstat(fd, &st) == -1) {
+		error_print(__func__, "fstat", errno);
+		close(fd);
+		return -1;
+	}
+
+	buf = malloc((size_t)st.st_size + 1);
+	if (!buf) {
+		error_print(__func__, "malloc", errno);
+		close(fd);
+		return -1;
+	}
+
+	while (off < (size_t)st.st_size) {
+		ssize_t r = pread(fd, buf + off, (size_t)st.st_size - off, (off_t)off);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		off += (size_t)r;
+	}
+	close(fd);
+
+	buf[off] = '\0';
+	*out = buf;
+	*len = off;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                            Parallel Execution                             */
+/* ------------------------------------------------------------------------- */
+
+#define PAR_USAGE  "usage: parallel [-k] [-j jobs] command [arg ...] [::: item ...]"
+#define PAR_RDSIZE 4096
+
+/* Work items read from stdin, one per line. */
+typedef struct {
+	char *buf;
+	size_t len;              /* bytes in buf */
+	size_t pos;              /* start of the next line */
+	size_t cap;
+	int eof;
+} par_reader_t;
+
+/*
+ * Next non-empty line of stdin, NUL-terminated in place. The pointer is
+ * valid until the next call. Returns NULL at end of input or on error.
+ */
+static char*
+par_read_item(par_reader_t *r)
+{
+	if (!r->buf) {
+		r->buf = malloc(PAR_RDSIZE + 1);
+		if (!r->buf) {
+			error_print("parallel", "malloc", errno);
+			return NULL;
+		}
+		r->cap = PAR_RDSIZE + 1;
+	}
+
+	for (;;) {
+		char *line = r->buf + r->pos;
+		char *nl = memchr(line, '\n', r->len - r->pos);
+		ssize_t n;
+
+		if (nl || (r->eof && r->pos < r->len)) {
+			if (nl) {
+				*nl = '\0';
+				r->pos = (size_t)(nl - r->buf) + 1;
+			} else {
+				r->buf[r->len] = '\0';
+				r->pos = r->len;
+			}
+			if (!*line)
+				continue;
+			return line;
+		}
+		if (r->eof)
+			return NULL;
+
+		/* keep the partial line, make room behind it */
+		memmove(r->buf, line, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+		if (r->cap - r->len < PAR_RDSIZE + 1) {
+			char *nbuf = realloc(r->buf, r->cap + PAR_RDSIZE + 1);
+
+			if (!nbuf) {
+				error_print("parallel", "realloc", errno);
+				return NULL;
+			}
+			r->buf = nbuf;
+			r->cap += PAR_RDSIZE + 1;
+		}
+
+		n = read(STDIN_FILENO, r->buf + r->len, PAR_RDSIZE);
+		if (n < 0) {
+			if (errno != EINTR)
+				error_print("parallel", "read", errno);
+			return NULL;
+		}
+		if (n == 0)
+			r->eof = 1;
+		r->len += (size_t)n;
+	}
+}
+
+/*
+ * Copy of word with every "{}" replaced by item, allocated from a, or
+ * word itself if it has no "{}".
+ */
+static char*
+par_substitute(Arena *a, char *word, const char *item)
+{
+	size_t ilen = strlen(item);
+	size_t len = 0;
+	char *out, *o;
+	const char *s;
+	int hits = 0;
+
+	for (s = word; (s = strstr(s, "{}")); s += 2)
+		hits++;
+	if (!hits)
+		return word;
+
+	len = strlen(word) + (size_t)hits * ilen - (size_t)hits * 2;
+	out = arena_alloc(a, len + 1);
+	if (!out)
+		return NULL;
+
+	for (s = word, o = out; *s; ) {
+		if (s[0] == '{' && s[1] == '}') {
+			memcpy(o, item, ilen);
+			o += ilen;
+			s += 2;
+		} else {
+			*o++ = *s++;
+		}
+	}
+	*o = '\0';
+	return out;
+}
+
+/*
+ * Start the template for one item in a free worker slot. The command
+ * stays in the shell's process group, so ^C reaches it the same way it
+ * reaches the shell. Returns 0 once the item was started or failed to
+ * start (it then counts as failed), -1 on error.
+ */
+static int
+par_launch(Arena *a, char **tmpl, int ntmpl, const char *item, size_t seq,
+           int in_fd)
+{
+	Command c;
+	char path[PATH_MAX];
+	const char *resolved = NULL;
+	int out[2] = { -1, -1 };
+	int cpu = -1;
+	int slot;
+	int placed;
+	int braces = 0;
+	int spawn_code;
+	pid_t pid = -1;
+
+	memset(&c, 0, sizeof(c));
+	c.argv = arena_alloc(a, (size_t)(ntmpl + 2) * sizeof(*c.argv));
+	if (!c.argv)
+		goto nomem;
+
+	for (c.argc = 0; c.argc < ntmpl; c.argc++) {
+		c.argv[c.argc] = par_substitute(a, tmpl[c.argc], item);
+		if (!c.argv[c.argc])
+			goto nomem;
+		braces |= c.argv[c.argc] != tmpl[c.argc];
+	}
+	if (!braces)
+		c.argv[c.argc++] = (char *)item;
+	c.argv[c.argc] = NULL;
+
+	if (par->outputs) {
+		if (seq >= par->outputs_cap) {
+			size_t ncap = par->outputs_cap * 2;
+			par_output_t *nout = realloc(par->outputs, ncap * sizeof(*nout));
+
+			if (!nout) {
+				error_print("parallel", "realloc", errno);
+				return -1;
+			}
+			par->outputs = nout;
+			par->outputs_cap = ncap;
+		}
+		out[1] = memfd_create("parallel", MFD_CLOEXEC);
+		if (out[1] == -1) {
+			error_print("parallel", "memfd_create", errno);
+			return -1;
+		}
+		par->outputs[seq].fd = out[1];
+		par->outputs[seq].done = 0;
+	}
+
+	for (slot = 0; par->workers[slot].pid; slot++)
+		;
+
+	if (options_get(OPT_PIN_STAGES))
+		placement_assign(&cpu, 1);
+	placed = cpu != -1 || options_get(OPT_NICE) || options_get(OPT_IONICE) != -1;
+
+	if (!builtin_classify(&c) && !pathcache_lookup(c.argv[0], path))
+		resolved = path;
+
+#if USE_ZYGOTE
+	if (resolved && options_get(OPT_ZYGOTE))
+		pid = zygote_child(&c, resolved, in_fd, par->outputs ? out : NULL, -1, cpu);
+#endif
+#if USE_POSIX_SPAWN
+	if (pid == -1 && resolved && options_get(OPT_SPAWN) && !placed)
+		pid = spawn_child(&c, resolved, in_fd, par->outputs ? out : NULL, -1,
+		                  &spawn_code);
+	if (pid == SPAWN_FAILED) {
+		/* reported; the item failed without running */
+		par->failed++;
+		if (par->outputs)
+			par->outputs[seq].done = 1;
+		return 0;
+	}
+#else
+	(void)placed;
+	(void)spawn_code;
+#endif
+	if (pid == -1)
+		pid = fork();
+	if (pid == -1) {
+		/* the item failed; its -k slot is done so later output flows */
+		error_print("parallel", "fork", errno);
+		par->failed++;
+		if (par->outputs) {
+			close(out[1]);
+			par->outputs[seq].fd = -1;
+			par->outputs[seq].done = 1;
+		}
+		return 0;
+	}
+	if (pid == 0) {
+		placement_apply(cpu, options_get(OPT_NICE), options_get(OPT_IONICE));
+		execute_child(&c, resolved, in_fd, par->outputs ? out : NULL);
+	}
+
+	par->workers[slot].pid = pid;
+	par->workers[slot].seq = seq;
+	par->running++;
+	return 0;
+
+nomem:
+	error_print("parallel", "arena_alloc", errno);
 	return -1;
 }
 
+/*
+ * Write the held -k outputs that are next in item order.
+ */
+static int
+par_flush(size_t *next, size_t launched)
+{
+	int ret = 0;
+
+	for (; *next < launched && par->outputs[*next].done; (*next)++) {
+		int fd = par->outputs[*next].fd;
+
+		/* an item that never started has no output */
+		if (fd == -1)
+			continue;
+		if (!ret && (lseek(fd, 0, SEEK_SET) == -1 ||
+		             datamove_copy(fd, STDOUT_FILENO) == -1)) {
+			error_print("parallel", "write error", errno);
+			ret = -1;
+		}
+		close(fd);
+		par->outputs[*next].fd = -1;
+	}
+	return ret;
+}
+
+/**
+ * @brief Handle the builtin `parallel` command.
+ */
+int
+builtin_parallel(Command *cmd)
+{
+	par_state_t state;
+	par_reader_t reader;
+	Arena *arena;
+	char **tmpl;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int keep = 0;
+	int ntmpl;
+	int sep;
+	int next;
+	int from_stdin;
+	int in_fd = -1;
+	int broken = 0;
+	size_t launched = 0;
+	size_t next_out = 0;
+	int i;
+
+	for (i = 1; i < cmd->argc && cmd->argv[i][0] == '-'; i++) {
+		const char *a = cmd->argv[i];
+		char *end;
+
+		if (!strcmp(a, "--")) {
+			i++;
+			break;
+		}
+		if (!strcmp(a, "-k")) {
+			keep = 1;
+			continue;
+		}
+		if (strncmp(a, "-j", 2)) {
+			error_print("parallel", PAR_USAGE, 0);
+			exit_code = 2;
+			return -1;
+		}
+
+		a += 2;
+		if (!*a && ++i < cmd->argc)
+			a = cmd->argv[i];
+		errno = 0;
+		jobs = *a ? strtol(a, &end, 10) : 0;
+		if (!*a || *end || errno || jobs < 1 || jobs > INT_MAX) {
+			error_print("parallel", "invalid number of jobs", 0);
+			exit_code = 2;
+			return -1;
+		}
+	}
+
+	tmpl = cmd->argv + i;
+	for (sep = i; sep < cmd->argc && strcmp(cmd->argv[sep], ":::"); sep++)
+		;
+	ntmpl = sep - i;
+	if (ntmpl < 1) {
+		error_print("parallel", PAR_USAGE, 0);
+		exit_code = 2;
+		return -1;
+	}
+	if (jobs < 1)
+		jobs = 1;
+	from_stdin = sep == cmd->argc;
+	next = sep + 1;
+
+	memset(&state, 0, sizeof(state));
+	memset(&reader, 0, sizeof(reader));
+	state.nworkers = (int)jobs;
+	state.workers = calloc((size_t)jobs, sizeof(*state.workers));
+	if (keep) {
+		state.outputs_cap = 64;
+		state.outputs = malloc(state.outputs_cap * sizeof(*state.outputs));
+	}
+	arena = arena_create();
+	if (!state.workers || (keep && !state.outputs) || !arena) {
+		error_print("parallel", "malloc", errno);
+		free(state.workers);
+		free(state.outputs);
+		arena_destroy(arena);
+		exit_code = 1;
+		return -1;
+	}
+
+	/* Items from stdin: keep the commands from reading the rest of them */
+	if (from_stdin) {
+		in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (in_fd == -1)
+			error_print("parallel", "/dev/null", errno);
+	}
+
+	/* keep earlier output ahead of the commands' */
+	fflush(stdout);
+
+	par = &state;
+	for (;;) {
+		while (!state.interrupted && !broken &&
+		       state.running < state.nworkers) {
+			const char *item;
+
+			if (from_stdin)
+				item = par_read_item(&reader);
+			else
+				item = next < cmd->argc ? cmd->argv[next++] : NULL;
+			if (!item)
+				break;
+
+			if (par_launch(arena, tmpl, ntmpl, item, launched, in_fd) == -1) {
+				broken = 1;
+				break;
+			}
+			arena_reset(arena);
+			launched++;
+		}
+
+		if (!state.running)
+			break;
+
+		/* block for one exit, then collect everyone else who is done */
+		reap_children(0);
+		reap_children(WNOHANG);
+
+		if (keep && !broken && par_flush(&next_out, launched))
+			broken = 1;
+	}
+	if (keep)
+		par_flush(&next_out, launched);
+	par = NULL;
+
+	if (trace_enabled())
+		trace_printf("event=parallel jobs=%d items=%zu failed=%d cmd=%s",
+		             state.nworkers, launched, state.failed, tmpl[0]);
+
+	if (in_fd != -1)
+		close(in_fd);
+	free(reader.buf);
+	free(state.workers);
+	free(state.outputs);
+	arena_destroy(arena);
+
+	if (state.interrupted)
+		exit_code = 130;
+	else if (broken)
+		exit_code = 1;
+	else
+		exit_code = state.failed > 101 ? 101 : state.failed;
+	return exit_code ? -1 : 0;
+}
@@ -21,19 +21,136 @@
  * Single builtins without redirects run in the parent process
  * (required for cd, exit to affect shell state).
  *
- * @param pipeline  Linked list of commands.
+ * @param pipeline  Parsed pipeline.
  * @return          0 on success,
  *                  1 to signal shell should exit,
  *                 -1 on fatal error.
  */
-int execute_pipeline(Command *pipeline);
+int execute_pipeline(Pipeline *pipeline);
+
+/**
+ * @brief Run a command line and capture its standard output.
+ *
+ * Used for command substitution, which behaves like a subshell: a line
+ * that could change shell state (cd, set, export, a background job, ...)
+ * runs in a forked child, so its effects do not reach the shell. Lines of
+ * external commands and side-effect-free builtins run without forking.
+ *
+ * @param line  Writable command line; modified by parsing.
+ * @param out   Output: allocated, NUL-terminated output. Free with free().
+ * @param len   Output: its length in bytes (it may contain NUL bytes).
+ * @return      0 on success (whatever the command's status), -1 if the
+ *              output could not be captured.
+ */
+int pipeline_capture(char *line, char **out, size_t *len);
+
+/**
+ * @brief Serve as the zygote if this process was started as one.
+ *
+ * Must be called at the top of main() of every program linking the
+ * executor: the zygote is this same binary, exec'd in helper mode.
+ * Returns unless argv is the helper's command line.
+ *
+ * @param argc  Argument count of main().
+ * @param argv  Argument vector of main().
+ */
+void pipeline_zygote_helper(int argc, char *argv[]);
+
+/**
+ * @brief Reap children that changed state since the last call.
+ *
+ * Call when signal_child_fd() polls readable. Only updates the job
+ * table; nothing is printed.
+ */
+void pipeline_reap(void);
+
+/**
+ * @brief Check whether any job has a state change left to report.
+ *
+ * @return 1 if pipeline_notify_jobs() would print something, 0 otherwise.
+ */
+int pipeline_jobs_changed(void);
+
+/**
+ * @brief Number of jobs currently in the job table.
+ *
+ * Finished jobs count until pipeline_notify_jobs() removes them.
+ *
+ * @return Job count.
+ */
+int pipeline_job_count(void);
 
 /**
  * @brief Print notifications for background job status changes.
  *
- * Best called from the main loop right before printing the next prompt.
- * execute_pipeline() also calls it opportunistically.
+ * Reaps pending child events first. Best called from the main loop
+ * right before printing the next prompt, or as soon as a child event
+ * arrives while waiting for input. execute_pipeline() also calls it
+ * opportunistically.
  */
 void pipeline_notify_jobs(void);
 
+/*
+ * Job control builtins. Registered in the builtin table (builtin.c); they live here because
+ * they work on the job table or the reaper. Same return conventions as builtin_exec().
+ */
+
+/**
+ * @brief jobs [-l]: list jobs, with per-process details for -l.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on a usage error.
+ */
+int builtin_jobs(Command *cmd);
+
+/**
+ * @brief fg [%job]: continue a job in the foreground and wait for it.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on error.
+ */
+int builtin_fg(Command *cmd);
+
+/**
+ * @brief bg [%job]: continue a stopped job in the background.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 on success, -1 on error.
+ */
+int builtin_bg(Command *cmd);
+
+/**
+ * @brief wait [-n] [%job | pid ...]: wait for background jobs.
+ *
+ * Without operands, waits until no job is running. With operands, waits
+ * for each in turn; the status is the one of the last operand, 127 if
+ * it is not a job of this shell. -n returns as soon as any of the
+ * operands (any job, without operands) is done, with its status. A
+ * stopped job counts as done, with status 128 + the stop signal.
+ * Waited-for jobs that finished are removed from the job table. An
+ * interrupted wait (^C) sets 130.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0.
+ */
+int builtin_wait(Command *cmd);
+
+/**
+ * @brief parallel [-k] [-j jobs] command [arg ...] [::: item ...]: run
+ *        command once per item, at most jobs at a time.
+ *
+ * Items are the words after ":::", or else the non-empty lines of stdin
+ * (the commands then get /dev/null as stdin). Every "{}" in the
+ * template is replaced by the item; without one the item is appended
+ * as the last argument. jobs defaults to the number of online CPUs.
+ * With -k the output of each command is held back and written in item
+ * order. The commands are not jobs; exit_code is the number of failed
+ * items (at most 101), or 130 if one was killed by SIGINT, which also
+ * stops further items from starting.
+ *
+ * @param cmd  Command with argv and argc.
+ * @return     0 if every item succeeded, -1 otherwise.
+ */
+int builtin_parallel(Command *cmd);
+
 #endif /* PIPELINE_H */
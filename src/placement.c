@@ -0,0 +1,254 @@
+/**
+ * @file placement.c
+ * @brief Topology-ordered CPU assignment for pipeline stages.
+ *
+ * The CPUs the shell may run on are sorted once by (NUMA node, package,
+ * core, cpu) from sysfs, which puts SMT siblings next to each other and
+ * keeps every node contiguous. Pipelines take consecutive runs of that
+ * list from a rotating cursor.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* sched_setaffinity(), cpu_set_t */
+
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "placement.h"
+#include "error.h"
+
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+/* ioprio_set() has no libc wrapper */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_SHIFT 13
+
+typedef struct {
+	int cpu;
+	int node;
+	int package;
+	int core;
+} cpu_info;
+
+static cpu_info *topology = NULL;
+static int ncpus = 0;
+static int loaded = 0;       /* topology read (successfully or not) */
+static int cursor = 0;       /* next CPU to hand out */
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Read a single integer from a sysfs file.
+ *
+ * @return  The value, or fallback if the file is missing or malformed.
+ */
+static int
+read_int(const char *path, int fallback)
+{
+	FILE *f = fopen(path, "r");
+	int v;
+
+	if (!f)
+		return fallback;
+	if (fscanf(f, "%d", &v) != 1)
+		v = fallback;
+	fclose(f);
+	return v;
+}
+
+/**
+ * @brief Record node for every CPU in a sysfs cpulist ("0-3,8,10-11").
+ */
+static void
+parse_cpulist(const char *path, int node)
+{
+	FILE *f = fopen(path, "r");
+	int lo, hi;
+
+	if (!f)
+		return;
+
+	while (fscanf(f, "%d", &lo) == 1) {
+		int c = fgetc(f);
+
+		hi = lo;
+		if (c == '-') {
+			if (fscanf(f, "%d", &hi) != 1)
+				break;
+			c = fgetc(f);
+		}
+
+		for (int i = 0; i < ncpus; i++) {
+			if (topology[i].cpu >= lo && topology[i].cpu <= hi)
+				topology[i].node = node;
+		}
+
+		if (c != ',')
+			break;
+	}
+
+	fclose(f);
+}
+
+static int
+cpu_compare(const void *a, const void *b)
+{
+	const cpu_info *x = a;
+	const cpu_info *y = b;
+
+	if (x->node != y->node)
+		return x->node < y->node ? -1 : 1;
+	if (x->package != y->package)
+		return x->package < y->package ? -1 : 1;
+	if (x->core != y->core)
+		return x->core < y->core ? -1 : 1;
+	return (x->cpu > y->cpu) - (x->cpu < y->cpu);
+}
+
+/**
+ * @brief Index just past the run of CPUs on the node of topology[i].
+ */
+static int
+node_end(int i)
+{
+	int node = topology[i].node;
+
+	while (i < ncpus && topology[i].node == node)
+		i++;
+	return i;
+}
+
+/**
+ * @brief Build the sorted list of usable CPUs.
+ *
+ * @return  0 on success, -1 if the affinity mask cannot be read.
+ */
+static int
+topology_load(void)
+{
+	char path[128];
+	cpu_set_t set;
+	DIR *dir;
+	struct dirent *de;
+	int n = 0;
+
+	loaded = 1;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == -1)
+		return -1;
+
+	topology = calloc((size_t)CPU_COUNT(&set), sizeof(*topology));
+	if (!topology) {
+		error_print(__func__, "calloc", errno);
+		return -1;
+	}
+
+	for (int cpu = 0; cpu < CPU_SETSIZE && n < CPU_COUNT(&set); cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+
+		topology[n].cpu = cpu;
+		topology[n].node = 0;
+
+		snprintf(path, sizeof(path),
+		         SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+		topology[n].package = read_int(path, 0);
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+		topology[n].core = read_int(path, cpu);
+		n++;
+	}
+	ncpus = n;
+
+	/* without NUMA support everything stays on node 0 */
+	dir = opendir(SYSFS_NODE);
+	if (dir) {
+		while ((de = readdir(dir))) {
+			int node;
+
+			if (sscanf(de->d_name, "node%d", &node) != 1)
+				continue;
+			snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", node);
+			parse_cpulist(path, node);
+		}
+		closedir(dir);
+	}
+
+	qsort(topology, (size_t)ncpus, sizeof(*topology), cpu_compare);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Choose CPUs for the forked stages of a new pipeline.
+ */
+int
+placement_assign(int *cpus, int n)
+{
+	int start;
+
+	if (!loaded)
+		topology_load();
+
+	if (!ncpus) {
+		for (int i = 0; i < n; i++)
+			cpus[i] = -1;
+		return -1;
+	}
+
+	/* start on the next node rather than straddle two, if it fits there */
+	start = cursor % ncpus;
+	if (node_end(start) - start < n) {
+		int next = node_end(start) % ncpus;
+
+		if (node_end(next) - next >= n)
+			start = next;
+	}
+
+	for (int i = 0; i < n; i++)
+		cpus[i] = topology[(start + i) % ncpus].cpu;
+
+	cursor = start + n;
+	return 0;
+}
+
+/**
+ * Apply a placement to the calling process.
+ */
+void
+placement_apply(int cpu, int nice, int ioprio)
+{
+	if (cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1)
+			error_print(__func__, "sched_setaffinity", errno);
+	}
+
+	if (nice) {
+		int prio = getpriority(PRIO_PROCESS, 0);
+
+		if (setpriority(PRIO_PROCESS, 0, prio + nice) == -1)
+			error_print(__func__, "setpriority", errno);
+	}
+
+	if (ioprio >= 0 &&
+	    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+	            (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | ioprio) == -1)
+		error_print(__func__, "ioprio_set", errno);
+}
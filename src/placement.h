@@ -0,0 +1,45 @@
+/**
+ * @file placement.h
+ * @brief CPU placement and scheduling priority for pipeline stages.
+ *
+ * With `set -o pin-stages`, every forked stage of a pipeline is pinned
+ * to one CPU. Adjacent stages get adjacent CPUs in topology order (SMT
+ * siblings first, then the other cores of the same package and NUMA
+ * node), so data handed over through a pipe stays in a shared cache.
+ * Successive pipelines continue where the previous one stopped and a
+ * pipeline that fits in one node is not split across two.
+ *
+ * `set -o nice=N` and `set -o ionice=N` additionally lower the CPU and
+ * I/O priority of every stage.
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+/**
+ * @brief Choose CPUs for the forked stages of a new pipeline.
+ *
+ * The CPU topology and the shell's own affinity mask are read on first
+ * use; only CPUs the shell may run on are handed out.
+ *
+ * @param cpus  Output: one CPU number per stage.
+ * @param n     Number of stages.
+ * @return      0 on success, -1 if the topology is unknown (cpus are
+ *              all set to -1).
+ */
+int placement_assign(int *cpus, int n);
+
+/**
+ * @brief Apply a placement to the calling process.
+ *
+ * Runs in a forked child between fork() and exec(). Failures are
+ * reported but not fatal: the stage still runs, just unplaced.
+ *
+ * @param cpu     CPU to pin to, or -1 to keep the inherited affinity.
+ * @param nice    Nice increment, 0 to keep the inherited priority.
+ * @param ioprio  Best-effort I/O priority level (0-7), or -1 to keep
+ *                the inherited one.
+ */
+void placement_apply(int cpu, int nice, int ioprio);
+
+#endif /* PLACEMENT_H */
@@ -0,0 +1,254 @@
+/**
+ * @file prompt.c
+ * @brief Implementation of the cached interactive prompt.
+ *
+ * The static part of the prompt ("\nuser@host: cwd\n[") is rendered into
+ * a buffer once; printing only formats the exit code behind it and
+ * issues one write(). HOME, USER and the hostname are looked up again
+ * only after prompt_invalidate(), and the working directory is taken
+ * from cd instead of calling getcwd() before every prompt.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prompt.h"
+#include "error.h"
+
+#define PROMPT_MAX (2 * PATH_MAX)
+
+/* Set when HOME/USER/hostname must be looked up again. */
+static volatile sig_atomic_t stale = 1;
+
+/* Set when the cached pieces changed and the line must be re-rendered. */
+static int dirty = 1;
+
+static char *user = NULL;
+static char *home = NULL;
+static char hostname[HOST_NAME_MAX + 1];
+static char cwd[PATH_MAX];
+
+/* Rendered prompt; the first prefix_len bytes are the static part. */
+static char line[PROMPT_MAX];
+static size_t prefix_len = 0;
+
+/* Columns taken by the last line of the prompt printed last. */
+static size_t last_width = 0;
+
+/* The prompt printed last was the continuation prompt. */
+static int continuation = 0;
+
+#define CONTINUATION "> "
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Replace a cached string with a copy of a new value.
+ */
+static int
+prompt_store(char **dst, const char *src)
+{
+	char *copy = strdup(src);
+
+	if (!copy) {
+		error_print(__func__, "strdup", errno);
+		return -1;
+	}
+
+	free(*dst);
+	*dst = copy;
+	return 0;
+}
+
+/**
+ * @brief Look up HOME, USER, hostname and cwd again.
+ *
+ * @return  0 on success, -1 on failure (the cache stays stale).
+ */
+static int
+prompt_refresh(void)
+{
+	const char *env;
+
+	stale = 0;
+
+	env = getenv("HOME");
+	if (!env) {
+		error_print(__func__, "getenv \"HOME\"", errno);
+		goto fail;
+	}
+	if (prompt_store(&home, env))
+		goto fail;
+
+	env = getenv("USER");
+	if (!env) {
+		error_print(__func__, "getenv \"USER\"", errno);
+		goto fail;
+	}
+	if (prompt_store(&user, env))
+		goto fail;
+
+	if (gethostname(hostname, sizeof(hostname))) {
+		error_print(__func__, "gethostname", errno);
+		goto fail;
+	}
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	if (!getcwd(cwd, sizeof(cwd))) {
+		error_print(__func__, "getcwd", errno);
+		goto fail;
+	}
+
+	dirty = 1;
+	return 0;
+
+fail:
+	stale = 1;
+	return -1;
+}
+
+/**
+ * @brief Render the static part of the prompt into line.
+ *
+ * The current working directory is shortened by replacing the user's
+ * home directory prefix with '~'.
+ */
+static void
+prompt_render(void)
+{
+	size_t home_len = strlen(home);
+	int n;
+
+	/* Shorten home prefix to ~ */
+	if (!strncmp(cwd, home, home_len) &&
+	    (cwd[home_len] == '/' || cwd[home_len] == '\0')) {
+		n = snprintf(line, sizeof(line), "\n%s@%s: ~%s\n[",
+		             user, hostname, cwd + home_len);
+	} else {
+		n = snprintf(line, sizeof(line), "\n%s@%s: %s\n[",
+		             user, hostname, cwd);
+	}
+
+	/* leave room for the exit code suffix on truncation */
+	if (n < 0)
+		n = 0;
+	if ((size_t)n > sizeof(line) - 16)
+		n = (int)(sizeof(line) - 16);
+
+	prefix_len = (size_t)n;
+	dirty = 0;
+}
+
+/**
+ * @brief write() all of a prompt.
+ */
+static int
+prompt_write(const char *s, size_t len)
+{
+	size_t off = 0;
+
+	/* keep ordering with anything builtins left in the stdio buffer */
+	fflush(stdout);
+
+	while (off < len) {
+		ssize_t w = write(STDOUT_FILENO, s + off, len - off);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			error_print(__func__, "write", errno);
+			return -1;
+		}
+		off += (size_t)w;
+	}
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Print the prompt with a single write().
+ */
+int
+prompt_print(unsigned int code)
+{
+	size_t len;
+	int n;
+
+	if (stale && prompt_refresh())
+		return -1;
+	if (dirty)
+		prompt_render();
+
+	n = snprintf(line + prefix_len, sizeof(line) - prefix_len, "%u]-> ", code);
+	if (n < 0)
+		return -1;
+	len = prefix_len + (size_t)n;
+
+	/* the static part ends in "\n[": the exit code line is all ASCII */
+	last_width = 1 + (size_t)n;
+	continuation = 0;
+
+	return prompt_write(line, len);
+}
+
+/**
+ * @brief Print the continuation prompt.
+ */
+int
+prompt_print_continuation(void)
+{
+	last_width = sizeof(CONTINUATION) - 1;
+	continuation = 1;
+
+	return prompt_write(CONTINUATION, sizeof(CONTINUATION) - 1);
+}
+
+/**
+ * @brief Print the prompt printed last again.
+ */
+int
+prompt_reprint(unsigned int code)
+{
+	return continuation ? prompt_print_continuation() : prompt_print(code);
+}
+
+/**
+ * @brief Record a new working directory for the prompt.
+ */
+void
+prompt_set_cwd(const char *dir)
+{
+	snprintf(cwd, sizeof(cwd), "%s", dir);
+	dirty = 1;
+}
+
+/**
+ * @brief Force the prompt to be rebuilt before it is printed again.
+ */
+void
+prompt_invalidate(void)
+{
+	stale = 1;
+}
+
+/**
+ * @brief Width of the last line of the prompt.
+ */
+size_t
+prompt_width(void)
+{
+	return last_width;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file prompt.h
+ * @brief Interactive prompt rendering.
+ *
+ * The prompt has the form:
+ *     username@hostname: cwd
+ *     [exit_code]->
+ *
+ * Everything but the exit code is rendered once and cached. The cache
+ * is updated when the working directory changes (prompt_set_cwd()) and
+ * rebuilt after prompt_invalidate() (HOME/USER changes, SIGHUP).
+ */
+
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <stddef.h>
+
+/**
+ * @brief Print the prompt with a single write().
+ *
+ * @param code  Exit code of the previous command.
+ * @return      0 on success, -1 on failure.
+ */
+int prompt_print(unsigned int code);
+
+/**
+ * @brief Print the continuation prompt ("> ") for further input lines.
+ *
+ * @return  0 on success, -1 on failure.
+ */
+int prompt_print_continuation(void);
+
+/**
+ * @brief Print the prompt printed last again, for a redraw.
+ *
+ * @param code  Exit code of the previous command.
+ * @return      0 on success, -1 on failure.
+ */
+int prompt_reprint(unsigned int code);
+
+/**
+ * @brief Record a new working directory for the prompt.
+ *
+ * Called by cd, which already knows the directory it changed to.
+ *
+ * @param cwd  Absolute path of the new working directory.
+ */
+void prompt_set_cwd(const char *cwd);
+
+/**
+ * @brief Force the prompt to be rebuilt before it is printed again.
+ *
+ * Async-signal-safe: only sets a flag, so it may be called from a
+ * signal handler.
+ */
+void prompt_invalidate(void);
+
+/**
+ * @brief Width of the last line of the prompt printed last.
+ *
+ * The line editor starts the input after it.
+ *
+ * @return  Number of terminal columns.
+ */
+size_t prompt_width(void);
+
+#endif /* PROMPT_H */
@@ -0,0 +1,582 @@
+/**
+ * @file scriptcache.c
+ * @brief Compile cache for scripts.
+ *
+ * Cache file layout (all offsets from the start of the file):
+ *
+ *   cache_header        identity of the script, entry table offset
+ *   Pipeline blocks     one per pipeline, copied as the parser packed
+ *                       them (header, stages, argv arrays, strings)
+ *   char[]              text of the lines to parse again
+ *   cache_entry[]       one per non-blank line of the script
+ *
+ * Pointer fields hold offsets, 0 standing for NULL; loading rewrites
+ * them in the private mapping. Pipelines are stored as native structs,
+ * so the header carries the layout version and sizeof(Command), and a
+ * cache written by another build is simply not used. File names are the
+ * FNV-1a hash of the script's real path.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* realpath(), mkstemp() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scriptcache.h"
+#include "error.h"
+#include "trace.h"
+
+#define CACHE_MAGIC    "TSHCACHE"
+#define CACHE_VERSION  2
+#define CACHE_ALIGN    16      /* alignment of Pipeline blocks */
+#define FNV_BASIS      14695981039346656037u
+#define FNV_PRIME      1099511628211u
+
+enum {
+	ENTRY_COMMAND = 1,       /* offset of a Pipeline */
+	ENTRY_SOURCE  = 2        /* offset of a line to parse again */
+};
+
+/*
+ * Everything up to nentries identifies the script; a cache file is used
+ * only if that part matches byte for byte.
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t command_size;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t script_hash;    /* FNV-1a of the contents */
+	uint64_t home_hash;      /* FNV-1a of $HOME, 0 if unset */
+	uint64_t nentries;
+	uint64_t entries;
+	uint64_t length;         /* of the whole file */
+} cache_header;
+
+typedef struct {
+	uint64_t kind;
+	uint64_t off;
+} cache_entry;
+
+struct ScriptCache {
+	char *dir;
+	char *path;              /* cache file */
+	cache_header key;        /* header fields identifying the script */
+	int hit;
+
+	/* replay */
+	char *map;
+	size_t map_len;
+	const cache_entry *entries;
+	size_t nentries;
+	size_t next;
+
+	/* record */
+	char *data;
+	size_t len;
+	size_t cap;
+	cache_entry *rec;
+	size_t nrec;
+	size_t rec_cap;
+	int failed;              /* something could not be recorded */
+};
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+fnv1a(const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	uint64_t h = FNV_BASIS;
+
+	while (n--) {
+		h ^= *s++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static int
+is_blank_line(const char *s)
+{
+	while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+		s++;
+	return *s == '\0';
+}
+
+/**
+ * @brief Fill the identifying header fields from the script.
+ */
+static int
+cache_key(ScriptCache *sc, const char *script)
+{
+	const char *home = getenv("HOME");
+	struct stat st;
+	void *map = NULL;
+	int fd;
+
+	fd = open(script, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size > 0) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+
+	memset(&sc->key, 0, sizeof(sc->key));
+	memcpy(sc->key.magic, CACHE_MAGIC, sizeof(sc->key.magic));
+	sc->key.version = CACHE_VERSION;
+	sc->key.command_size = (uint32_t)sizeof(Command);
+	sc->key.dev = (uint64_t)st.st_dev;
+	sc->key.ino = (uint64_t)st.st_ino;
+	sc->key.size = (uint64_t)st.st_size;
+	sc->key.mtime_sec = (int64_t)st.st_mtim.tv_sec;
+	sc->key.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+	sc->key.script_hash = fnv1a(map, map ? (size_t)st.st_size : 0);
+	sc->key.home_hash = home ? fnv1a(home, strlen(home)) : 0;
+
+	if (map)
+		munmap(map, (size_t)st.st_size);
+	return 0;
+}
+
+/**
+ * @brief Address of n bytes at offset off of the mapping, or NULL.
+ */
+static void*
+cache_at(const ScriptCache *sc, uintptr_t off, size_t n, size_t align)
+{
+	if (!off || off % align || off > sc->map_len || n > sc->map_len - off)
+		return NULL;
+	return sc->map + off;
+}
+
+static char*
+cache_string(const ScriptCache *sc, uintptr_t off)
+{
+	if (!off || off >= sc->map_len ||
+	    !memchr(sc->map + off, '\0', sc->map_len - off))
+		return NULL;
+	return sc->map + off;
+}
+
+/**
+ * @brief Turn a stored offset into a pointer into the string table.
+ */
+static char*
+cache_table_string(const Pipeline *p, const char *table, uintptr_t off)
+{
+	uintptr_t first = (uintptr_t)p->strings;
+
+	if (off < first || off - first >= p->strings_len)
+		return NULL;
+	return (char *)table + (off - first);
+}
+
+/**
+ * @brief Turn the offsets of a stored pipeline into pointers.
+ *
+ * @return  The pipeline, or NULL if it is malformed.
+ */
+static Pipeline*
+cache_relocate(const ScriptCache *sc, uint64_t off)
+{
+	Pipeline *p = cache_at(sc, (uintptr_t)off, sizeof(Pipeline), CACHE_ALIGN);
+	Command *stages;
+	char *table;
+
+	if (!p || p->nstages < 1 || !p->strings_len)
+		return NULL;
+	stages = cache_at(sc, (uintptr_t)p->stages, (size_t)p->nstages * sizeof(Command),
+	                  sizeof(char *));
+	table = cache_at(sc, (uintptr_t)p->strings, p->strings_len, 1);
+	if (!stages || !table || table[p->strings_len - 1])
+		return NULL;
+
+	for (int s = 0; s < p->nstages; s++) {
+		Command *c = &stages[s];
+		char **argv;
+
+		if (c->argc < 1)
+			return NULL;
+		argv = cache_at(sc, (uintptr_t)c->argv, ((size_t)c->argc + 1) * sizeof(char *),
+		                sizeof(char *));
+		if (!argv || argv[c->argc])
+			return NULL;
+		for (int i = 0; i < c->argc; i++) {
+			if (!(argv[i] = cache_table_string(p, table, (uintptr_t)argv[i])))
+				return NULL;
+		}
+		c->argv = argv;
+
+		for (int r = 0; r < REDIR_COUNT; r++) {
+			if (c->redirect[r] &&
+			    !(c->redirect[r] = cache_table_string(p, table, (uintptr_t)c->redirect[r])))
+				return NULL;
+		}
+	}
+
+	p->stages = stages;
+	p->strings = table;
+	p->arena = NULL;
+	return p;
+}
+
+/**
+ * @brief Map and check the cache file; relocate every pipeline.
+ */
+static int
+cache_load(ScriptCache *sc)
+{
+	const cache_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(sc->path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(cache_header)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	sc->map = map;
+	sc->map_len = (size_t)st.st_size;
+	hdr = map;
+
+	if (memcmp(hdr, &sc->key, offsetof(cache_header, nentries)) ||
+	    hdr->length != sc->map_len || hdr->nentries > sc->map_len / sizeof(cache_entry))
+		goto fail;
+
+	sc->nentries = (size_t)hdr->nentries;
+	sc->entries = cache_at(sc, (uintptr_t)hdr->entries,
+	                       sc->nentries * sizeof(cache_entry), sizeof(uint64_t));
+	if (!sc->entries && sc->nentries)
+		goto fail;
+
+	for (size_t i = 0; i < sc->nentries; i++) {
+		const cache_entry *e = &sc->entries[i];
+
+		if (e->kind == ENTRY_COMMAND ? !cache_relocate(sc, e->off) :
+		    e->kind != ENTRY_SOURCE || !cache_string(sc, (uintptr_t)e->off))
+			goto fail;
+	}
+	return 0;
+
+fail:
+	munmap(sc->map, sc->map_len);
+	sc->map = NULL;
+	sc->map_len = 0;
+	sc->nentries = 0;
+	return -1;
+}
+
+/**
+ * @brief Append n bytes (zeros if src is NULL) to the recording.
+ *
+ * @return  Offset of the bytes, 0 once recording has failed.
+ */
+static size_t
+emit(ScriptCache *sc, const void *src, size_t n, size_t align)
+{
+	size_t off = (sc->len + align - 1) / align * align;
+
+	if (sc->failed)
+		return 0;
+
+	if (off + n > sc->cap) {
+		size_t ncap = sc->cap ? sc->cap : 4096;
+		char *nd;
+
+		while (off + n > ncap)
+			ncap *= 2;
+		nd = realloc(sc->data, ncap);
+		if (!nd) {
+			sc->failed = 1;
+			return 0;
+		}
+		sc->data = nd;
+		sc->cap = ncap;
+	}
+
+	memset(sc->data + sc->len, 0, off - sc->len);
+	if (src)
+		memcpy(sc->data + off, src, n);
+	else
+		memset(sc->data + off, 0, n);
+	sc->len = off + n;
+	return off;
+}
+
+static size_t
+emit_string(ScriptCache *sc, const char *s)
+{
+	return emit(sc, s, strlen(s) + 1, 1);
+}
+
+/**
+ * @brief Append a pipeline to the recording.
+ *
+ * The packed block is copied as is; its pointers, which all point into
+ * the block, are then rewritten as file offsets.
+ *
+ * @return  Offset of the Pipeline.
+ */
+static size_t
+emit_pipeline(ScriptCache *sc, const Pipeline *p)
+{
+	const char *start = (const char *)p;
+	size_t size = (size_t)(p->strings + p->strings_len - start);
+	size_t base = emit(sc, p, size, CACHE_ALIGN);
+	Pipeline *q;
+
+#define REBASE(ptr) ((uintptr_t)(base + (size_t)((const char *)(ptr) - start)))
+	if (sc->failed)
+		return 0;
+	q = (Pipeline *)(sc->data + base);
+
+	for (int s = 0; s < p->nstages; s++) {
+		const Command *c = &p->stages[s];
+		Command *qc = (Command *)(sc->data + REBASE(c));
+		char **qargv = (char **)(sc->data + REBASE(c->argv));
+
+		for (int k = 0; k < c->argc; k++)
+			qargv[k] = (char *)REBASE(c->argv[k]);
+		qc->argv = (char **)REBASE(c->argv);
+		for (int r = 0; r < REDIR_COUNT; r++)
+			qc->redirect[r] = c->redirect[r] ? (char *)REBASE(c->redirect[r]) : NULL;
+	}
+
+	q->stages = (Command *)REBASE(p->stages);
+	q->strings = (char *)REBASE(p->strings);
+	q->arena = NULL;
+#undef REBASE
+
+	return base;
+}
+
+/**
+ * @brief Write the whole buffer to a new file and move it into place.
+ */
+static int
+cache_write(ScriptCache *sc)
+{
+	char tmp[PATH_MAX];
+	size_t off = 0;
+	int fd;
+
+	if (mkdir(sc->dir, 0700) && errno != EEXIST)
+		return -1;
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", sc->path) >= (int)sizeof(tmp))
+		return -1;
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		return -1;
+
+	while (off < sc->len) {
+		ssize_t w = write(fd, sc->data + off, sc->len - off);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		off += (size_t)w;
+	}
+
+	if (close(fd) || off < sc->len || rename(tmp, sc->path)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Look up the cache of a script.
+ */
+ScriptCache*
+scriptcache_open(const char *script)
+{
+	const char *dir = getenv("TINYSHELL_SCRIPT_CACHE");
+	char real[PATH_MAX];
+	ScriptCache *sc;
+	size_t len;
+
+	if (!dir || !*dir || !realpath(script, real))
+		return NULL;
+
+	sc = calloc(1, sizeof(*sc));
+	if (!sc)
+		return NULL;
+
+	len = strlen(dir) + 1 + 16 + sizeof(".tsc");
+	sc->dir = strdup(dir);
+	sc->path = malloc(len);
+	if (!sc->dir || !sc->path || cache_key(sc, script)) {
+		scriptcache_close(sc);
+		return NULL;
+	}
+	snprintf(sc->path, len, "%s/%016" PRIx64 ".tsc", dir, fnv1a(real, strlen(real)));
+
+	sc->hit = !cache_load(sc);
+	if (!sc->hit)
+		emit(sc, NULL, sizeof(cache_header), CACHE_ALIGN);
+
+	if (trace_enabled())
+		trace_printf("event=scriptcache state=%s entries=%zu script=%s cache=%s",
+		             sc->hit ? "hit" : "miss", sc->nentries, script, sc->path);
+	return sc;
+}
+
+/**
+ * Check whether the cache can be replayed.
+ */
+int
+scriptcache_hit(const ScriptCache *sc)
+{
+	return sc && sc->hit;
+}
+
+/**
+ * Get the next line of a replayed script.
+ */
+int
+scriptcache_next(ScriptCache *sc, Pipeline **pipeline, char **source)
+{
+	const cache_entry *e;
+
+	if (sc->next >= sc->nentries)
+		return 0;
+
+	e = &sc->entries[sc->next++];
+	*pipeline = NULL;
+	*source = NULL;
+	if (e->kind == ENTRY_COMMAND)
+		*pipeline = (Pipeline *)(sc->map + e->off);
+	else
+		*source = sc->map + e->off;
+	return 1;
+}
+
+/**
+ * Record a line of the script.
+ */
+void
+scriptcache_add(ScriptCache *sc, const char *source, const Pipeline *pipeline)
+{
+	cache_entry e;
+
+	if (!sc || sc->hit || sc->failed)
+		return;
+
+	/* expanded words depend on the run: keep the text to parse again */
+	if (pipeline && !pipeline->expanded) {
+		e.kind = ENTRY_COMMAND;
+		e.off = emit_pipeline(sc, pipeline);
+	} else if (source) {
+		if (is_blank_line(source))
+			return;
+		e.kind = ENTRY_SOURCE;
+		e.off = emit_string(sc, source);
+	} else {
+		sc->failed = 1;
+	}
+	if (sc->failed)
+		return;
+
+	if (sc->nrec == sc->rec_cap) {
+		size_t ncap = sc->rec_cap ? sc->rec_cap * 2 : 256;
+		cache_entry *nr = realloc(sc->rec, ncap * sizeof(*nr));
+
+		if (!nr) {
+			sc->failed = 1;
+			return;
+		}
+		sc->rec = nr;
+		sc->rec_cap = ncap;
+	}
+	sc->rec[sc->nrec++] = e;
+}
+
+/**
+ * Write the recorded lines to the cache file.
+ */
+void
+scriptcache_store(ScriptCache *sc)
+{
+	cache_header hdr;
+	size_t entries;
+	int ok;
+
+	if (!sc || sc->hit || sc->failed)
+		return;
+
+	entries = emit(sc, sc->rec, sc->nrec * sizeof(cache_entry), sizeof(uint64_t));
+	if (sc->failed)
+		return;
+
+	hdr = sc->key;
+	hdr.nentries = sc->nrec;
+	hdr.entries = entries;
+	hdr.length = sc->len;
+	memcpy(sc->data, &hdr, sizeof(hdr));
+
+	ok = !cache_write(sc);
+	if (trace_enabled())
+		trace_printf("event=scriptcache state=%s entries=%zu bytes=%zu cache=%s",
+		             ok ? "stored" : "error", sc->nrec, sc->len, sc->path);
+
+	/* the same recording is never stored twice */
+	sc->failed = 1;
+}
+
+/**
+ * Release a cache.
+ */
+void
+scriptcache_close(ScriptCache *sc)
+{
+	if (!sc)
+		return;
+	if (sc->map)
+		munmap(sc->map, sc->map_len);
+	free(sc->data);
+	free(sc->rec);
+	free(sc->dir);
+	free(sc->path);
+	free(sc);
+}
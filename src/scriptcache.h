@@ -0,0 +1,86 @@
+/**
+ * @file scriptcache.h
+ * @brief Compile cache for scripts.
+ *
+ * When TINYSHELL_SCRIPT_CACHE names a directory, running a script
+ * records the parsed pipeline of every line and, once the script has
+ * run to its end (or to `exit`), stores them in a cache file there. The
+ * file holds the packed Pipeline blocks, pointers written as file
+ * offsets. A later run of the same, unchanged script maps the file,
+ * turns the offsets back into pointers in place and executes the
+ * pipelines without tokenizing a single line.
+ *
+ * A cache file is used only if the script has the same device, inode,
+ * size, modification time and content hash as when it was written, and
+ * $HOME (which tilde expansion bakes into the words) is unchanged.
+ */
+
+#ifndef SCRIPTCACHE_H
+#define SCRIPTCACHE_H
+
+#include "parser.h"
+
+typedef struct ScriptCache ScriptCache;
+
+/**
+ * @brief Look up the cache of a script.
+ *
+ * @param script  Path of the script.
+ * @return        A cache to replay (scriptcache_hit()) or to record
+ *                into, or NULL if caching is disabled or not possible.
+ */
+ScriptCache *scriptcache_open(const char *script);
+
+/**
+ * @brief Check whether the cache can be replayed.
+ *
+ * @param sc  Cache, or NULL.
+ * @return    1 if the script's pipelines come from the cache file.
+ */
+int scriptcache_hit(const ScriptCache *sc);
+
+/**
+ * @brief Get the next line of a replayed script.
+ *
+ * Lines that did not parse when the cache was written are kept as
+ * text, so parsing them again reports the same error at the same point.
+ * So are lines with a command substitution or a pattern, whose words
+ * depend on the run.
+ *
+ * @param sc        Cache being replayed.
+ * @param pipeline  Output: the pipeline, or NULL for a text line. Owned
+ *                  by the cache; parser_free_pipeline() leaves it alone.
+ * @param source    Output: the writable text line when *pipeline is NULL.
+ * @return          1 if a line was returned, 0 at the end of the script.
+ */
+int scriptcache_next(ScriptCache *sc, Pipeline **pipeline, char **source);
+
+/**
+ * @brief Record a line of the script.
+ *
+ * @param sc        Cache being recorded.
+ * @param source    The line as read, before parsing, or NULL if that
+ *                  text cannot reproduce the line (the script is then
+ *                  not cached unless the pipeline is stored).
+ * @param pipeline  Its pipeline, or NULL if it did not parse.
+ */
+void scriptcache_add(ScriptCache *sc, const char *source, const Pipeline *pipeline);
+
+/**
+ * @brief Write the recorded lines to the cache file.
+ *
+ * The file is written under a temporary name and renamed into place, so
+ * concurrent runs never see a partial cache.
+ *
+ * @param sc  Cache being recorded.
+ */
+void scriptcache_store(ScriptCache *sc);
+
+/**
+ * @brief Release a cache.
+ *
+ * @param sc  Cache, or NULL.
+ */
+void scriptcache_close(ScriptCache *sc);
+
+#endif /* SCRIPTCACHE_H */
@@ -12,27 +12,88 @@
  *   - Placing the shell in its own process group (interactive mode)
  *   - Transferring terminal control (tcsetpgrp) to foreground job PGIDs
  *   - Ignoring SIGTSTP/SIGTTIN/SIGTTOU in the shell
- *   - Installing a SIGCHLD handler to reap and record job state changes
+ *   - Turning SIGCHLD into a readable descriptor, so children are reaped
+ *     from the main loop instead of inside a signal handler
+ *   - Installing a SIGHUP handler that refreshes the cached prompt
+ *
+ * Child events:
+ *   On Linux SIGCHLD is blocked for the lifetime of the shell and read
+ *   through a signalfd. Elsewhere, or if signalfd() is unavailable at run
+ *   time, a self-pipe is used: the SIGCHLD handler reaps into a
+ *   single-producer/single-consumer ring of (pid, status, rusage) records
+ *   and writes one byte to wake the main loop, which takes the records
+ *   out with signal_child_wait(). A full ring leaves the remaining
+ *   children unreaped for the consumer to collect, so a burst of exits is
+ *   never lost. Either way the job table is never touched from signal
+ *   context, so it needs no masking around accesses.
  */
 
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* wait4() */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
 
 #include "signal_setup.h"
 #include "error.h"
+#include "prompt.h"
+
+/* Signals whose disposition children must reset to SIG_DFL before exec. */
+static const int child_default_signals[] = {
+	SIGINT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGHUP, SIGPIPE
+};
+
+#define NUM_CHILD_DEFAULT_SIGNALS \
+	(sizeof(child_default_signals) / sizeof(child_default_signals[0]))
+
+/* Readable when children changed state: signalfd or self-pipe read end. */
+static int child_fd = -1;
+
+/* Write end of the self-pipe, -1 when using signalfd. */
+static int child_pipe_wr = -1;
 
-/* Provided by pipeline.c (job-control module). */
-extern void jobs_sigchld_reap(void);
+/* Signal mask the shell started with; children get it back. */
+static sigset_t child_mask;
+
+/* Slots in the child event ring (one is kept free); a power of two */
+#define CHILD_RING_SIZE 64
+
+#define CHILD_WAIT_OPTIONS (WUNTRACED | WCONTINUED)
+
+/* A child status change reaped by the SIGCHLD handler. */
+typedef struct {
+	pid_t pid;
+	int status;
+	struct rusage ru;
+} child_event;
+
+/*
+ * Self-pipe fallback only. The handler is the sole producer and moves
+ * ring_head; the main loop is the sole consumer and moves ring_tail.
+ * Both run on the same thread, so volatile accesses in program order are
+ * all the ordering needed: a record is written before the index that
+ * publishes it.
+ */
+static volatile child_event child_ring[CHILD_RING_SIZE];
+static volatile sig_atomic_t ring_head = 0;
+static volatile sig_atomic_t ring_tail = 0;
+
+/* Set by the producer when it stopped reaping because the ring was full. */
+static volatile sig_atomic_t ring_full = 0;
 
 /**
  * @brief Empty signal handler for SIGINT.
  *
  * Does nothing, but having a handler (vs SIG_IGN) allows
- * blocking calls like fgets() to be interrupted.
+ * blocking calls like read() to be interrupted.
  */
 static void
 sigint_handler(int sig)
@@ -41,13 +102,86 @@ sigint_handler(int sig)
 }
 
 /**
- * @brief SIGCHLD handler: reap children and update job state.
+ * @brief SIGHUP handler: rebuild the cached prompt before the next line.
+ */
+static void
+sighup_handler(int sig)
+{
+	(void)sig;
+	prompt_invalidate();
+}
+
+/**
+ * @brief Reap children into the ring until none reports or it is full.
+ *
+ * Runs in the SIGCHLD handler, or in the consumer with SIGCHLD blocked,
+ * so there is only ever one producer.
+ *
+ * @return 0, or -1 with errno set (ECHILD: no children left).
+ */
+static int
+child_ring_fill(void)
+{
+	for (;;) {
+		int head = ring_head;
+		int next = (head + 1) & (CHILD_RING_SIZE - 1);
+		struct rusage ru;
+		int status;
+		pid_t pid;
+
+		if (next == ring_tail) {
+			/* the kernel keeps the rest until the ring drains */
+			ring_full = 1;
+			return 0;
+		}
+
+		pid = wait4(-1, &status, WNOHANG | CHILD_WAIT_OPTIONS, &ru);
+		if (pid <= 0)
+			return (int)pid;
+
+		child_ring[head].pid = pid;
+		child_ring[head].status = status;
+		child_ring[head].ru = ru;
+		ring_head = next;
+	}
+}
+
+/**
+ * @brief SIGCHLD handler for the self-pipe fallback: reap and wake the
+ * main loop.
  */
 static void
 sigchld_handler(int sig)
 {
+	int saved_errno = errno;
+	ssize_t n;
+
 	(void)sig;
-	jobs_sigchld_reap();
+	(void)child_ring_fill();
+	/* a full pipe already holds a pending wakeup */
+	n = write(child_pipe_wr, "", 1);
+	(void)n;
+	errno = saved_errno;
+}
+
+/**
+ * @brief Take the oldest record out of the ring.
+ *
+ * @return 1 if one was taken, 0 if the ring is empty.
+ */
+static int
+child_ring_take(pid_t *pid, int *status, struct rusage *ru)
+{
+	int tail = ring_tail;
+
+	if (tail == ring_head)
+		return 0;
+
+	*pid = child_ring[tail].pid;
+	*status = child_ring[tail].status;
+	*ru = child_ring[tail].ru;
+	ring_tail = (tail + 1) & (CHILD_RING_SIZE - 1);
+	return 1;
 }
 
 static int
@@ -71,33 +205,102 @@ install_ignore(int signum)
 	return install_handler(signum, SIG_IGN, 0);
 }
 
+static int
+set_nonblock_cloexec(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+		return -1;
+	return 0;
+}
+
 /**
- * @brief Set up signal handlers for the shell.
+ * @brief Create the self-pipe, both ends non-blocking and close-on-exec.
  */
-int
-signal_setup(void)
-{
-	/* Interactive job control is only relevant with a controlling terminal. */
-	if (isatty(STDIN_FILENO)) {
-		/* Put shell in its own process group. */
-		if (setpgid(0, 0) == -1) {
-			/* If already a process group leader, setpgid can fail with EPERM. */
-			if (errno != EPERM) {
-				error_print(__func__, "setpgid", errno);
-				return -1;
-			}
+static int
+open_self_pipe(void)
+{
+	int fds[2];
+
+	if (pipe(fds) == -1) {
+		error_print(__func__, "pipe", errno);
+		return -1;
+	}
+	if (set_nonblock_cloexec(fds[0]) || set_nonblock_cloexec(fds[1])) {
+		error_print(__func__, "fcntl", errno);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	child_fd = fds[0];
+	child_pipe_wr = fds[1];
+	return 0;
+}
+
+/**
+ * @brief Route SIGCHLD to child_fd, via signalfd or a self-pipe.
+ */
+static int
+setup_child_events(void)
+{
+	/* SIGCHLD itself is not blocked at startup; children must not inherit it */
+	sigprocmask(SIG_SETMASK, NULL, &child_mask);
+	sigdelset(&child_mask, SIGCHLD);
+
+#ifdef __linux__
+	{
+		sigset_t set;
+
+		sigemptyset(&set);
+		sigaddset(&set, SIGCHLD);
+		if (sigprocmask(SIG_BLOCK, &set, NULL) == 0) {
+			child_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+			if (child_fd != -1)
+				return 0;
+			/* e.g. seccomp-restricted sandbox: fall back to a pipe */
+			sigprocmask(SIG_SETMASK, &child_mask, NULL);
 		}
+	}
+#endif
+
+	if (open_self_pipe())
+		return -1;
 
-		/* Ensure the shell owns the terminal before entering the REPL. */
-		if (tcsetpgrp(STDIN_FILENO, getpgrp()) == -1) {
-			/* If this fails in your environment, the shell still works without
-			 * terminal control, but Ctrl-C/Ctrl-Z forwarding may be limited.
-			 */
-			error_print(__func__, "tcsetpgrp", errno);
-			/* Non-fatal: continue. */
+	if (install_handler(SIGCHLD, sigchld_handler, SA_RESTART) == -1) {
+		error_print(__func__, "sigaction SIGCHLD", errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Take terminal control and install interactive dispositions.
+ */
+static int
+setup_job_control(void)
+{
+	/* Put shell in its own process group. */
+	if (setpgid(0, 0) == -1) {
+		/* If already a process group leader, setpgid can fail with EPERM. */
+		if (errno != EPERM) {
+			error_print(__func__, "setpgid", errno);
+			return -1;
 		}
 	}
 
+	/* Ensure the shell owns the terminal before entering the REPL. */
+	if (tcsetpgrp(STDIN_FILENO, getpgrp()) == -1) {
+		/* If this fails in your environment, the shell still works without
+		 * terminal control, but Ctrl-C/Ctrl-Z forwarding may be limited.
+		 */
+		error_print(__func__, "tcsetpgrp", errno);
+		/* Non-fatal: continue. */
+	}
+
 	/* Shell should not stop when touching the terminal while a job runs. */
 	if (install_ignore(SIGTSTP) == -1) {
 		error_print(__func__, "sigaction SIGTSTP", errno);
@@ -112,18 +315,147 @@ signal_setup(void)
 		return -1;
 	}
 
-	/* Ctrl-C should interrupt fgets() but not kill the shell. */
+	/* Ctrl-C should interrupt reading a line but not kill the shell. */
 	if (install_handler(SIGINT, sigint_handler, 0) == -1) {
 		error_print(__func__, "sigaction SIGINT", errno);
 		return -1;
 	}
 
-	/* Reap child processes and track job states. */
+	/* SIGHUP refreshes the cached prompt (user, host, cwd). */
+	if (install_handler(SIGHUP, sighup_handler, SA_RESTART) == -1) {
+		error_print(__func__, "sigaction SIGHUP", errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Set up signal handlers for the shell.
+ */
+int
+signal_setup(int interactive)
+{
+	/*
+	 * Interactive job control is only relevant with a controlling terminal.
+	 * Non-interactive shells keep default terminal signal behavior.
+	 */
+	if (interactive && setup_job_control())
+		return -1;
+
+	/*
+	 * Builtins write into pipes from the shell process; a reader that
+	 * quits early must produce EPIPE there, not kill the shell.
+	 */
+	if (install_ignore(SIGPIPE) == -1) {
+		error_print(__func__, "sigaction SIGPIPE", errno);
+		return -1;
+	}
+
+	/* Child state changes are picked up by the main loop. */
+	return setup_child_events();
+}
+
+/**
+ * @brief Descriptor that becomes readable when a child changes state.
+ */
+int
+signal_child_fd(void)
+{
+	return child_fd;
+}
+
+/**
+ * @brief Consume pending child events.
+ */
+int
+signal_child_drain(void)
+{
+#ifdef __linux__
+	struct signalfd_siginfo si[8];
+#else
+	char si[64];
+#endif
+	int pending = 0;
+	ssize_t n;
+
+	while ((n = read(child_fd, si, sizeof(si))) > 0 ||
+	       (n == -1 && errno == EINTR))
+		pending |= n > 0;
+
+	return pending;
+}
+
+/**
+ * @brief Get the next child status change.
+ */
+pid_t
+signal_child_wait(int *status, struct rusage *ru, int block)
+{
+	sigset_t set, old;
+	pid_t pid = 0;
+	int none;
+
+	if (child_pipe_wr == -1)
+		return wait4(-1, status, (block ? 0 : WNOHANG) | CHILD_WAIT_OPTIONS, ru);
+
+	if (child_ring_take(&pid, status, ru))
+		return pid;
+	if (!ring_full && !block)
+		return 0;
+
+	/* refill from here, with the handler held off */
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, &old);
+	for (;;) {
+		ring_full = 0;
+		none = child_ring_fill() == -1 && errno == ECHILD;
+		if (child_ring_take(&pid, status, ru) || !block)
+			break;
+		if (none) {
+			pid = -1;
+			break;
+		}
+		/* the handler runs in here and fills the ring */
+		sigsuspend(&old);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	if (pid == -1)
+		errno = ECHILD;
+
+	return pid;
+}
+
+/**
+ * @brief Give a forked subshell child events of its own.
+ */
+int
+signal_child_reset(void)
+{
+	sigset_t set;
+
+	/* a signalfd reads the queue of the process reading it */
+	if (child_pipe_wr == -1) {
+		sigemptyset(&set);
+		sigaddset(&set, SIGCHLD);
+		return child_fd == -1 ? 0 : sigprocmask(SIG_BLOCK, &set, NULL);
+	}
+
+	close(child_fd);
+	close(child_pipe_wr);
+	child_fd = child_pipe_wr = -1;
+
+	/* the records are the parent's children */
+	ring_head = ring_tail = 0;
+	ring_full = 0;
+
+	if (open_self_pipe())
+		return -1;
 	if (install_handler(SIGCHLD, sigchld_handler, SA_RESTART) == -1) {
 		error_print(__func__, "sigaction SIGCHLD", errno);
 		return -1;
 	}
-
 	return 0;
 }
 
@@ -140,9 +472,29 @@ signal_restore_defaults(void)
 	sa.sa_flags = 0;
 
 	/* Ignore errors - we're in a child about to exec anyway */
-	sigaction(SIGINT, &sa, NULL);
-	sigaction(SIGTSTP, &sa, NULL);
-	sigaction(SIGTTIN, &sa, NULL);
-	sigaction(SIGTTOU, &sa, NULL);
-	sigaction(SIGCHLD, &sa, NULL);
+	for (size_t i = 0; i < NUM_CHILD_DEFAULT_SIGNALS; i++)
+		sigaction(child_default_signals[i], &sa, NULL);
+
+	/* SIGCHLD is blocked in the shell when using signalfd */
+	sigprocmask(SIG_SETMASK, &child_mask, NULL);
+}
+
+/**
+ * @brief Fill a set with the signals signal_restore_defaults() resets.
+ */
+void
+signal_default_set(sigset_t *set)
+{
+	sigemptyset(set);
+	for (size_t i = 0; i < NUM_CHILD_DEFAULT_SIGNALS; i++)
+		sigaddset(set, child_default_signals[i]);
+}
+
+/**
+ * @brief Get the signal mask children should start with.
+ */
+void
+signal_child_mask(sigset_t *mask)
+{
+	*mask = child_mask;
 }
@@ -3,11 +3,13 @@
  * @brief Signal handling interface for TinyShell.
  *
  * Sets up the shell's signal disposition for interactive use and job control:
- *   - SIGINT is handled (not ignored) so blocking reads (e.g., fgets) can be interrupted
+ *   - SIGINT is handled (not ignored) so blocking reads (e.g., read) can be interrupted
  *     without terminating the shell.
  *   - SIGTSTP/SIGTTIN/SIGTTOU are ignored in the shell to prevent it from being stopped
  *     when the terminal is controlled by foreground jobs.
- *   - SIGCHLD is handled to reap children and update job state.
+ *   - SIGCHLD is turned into a readable descriptor (signalfd, or a self-pipe
+ *     fallback) so the main loop can poll() it next to terminal input and
+ *     update the job table outside of signal context.
  *
  * Child processes should restore default signal handlers before exec().
  */
@@ -15,22 +17,102 @@
 #ifndef SIGNAL_SETUP_H
 #define SIGNAL_SETUP_H
 
+#include <signal.h>
+#include <sys/types.h>
+
+struct rusage;
+
 /**
  * @brief Set up signal handlers for the shell.
  *
  * Should be called once at startup, before entering the main loop.
+ * Terminal and job-control handling is only set up for interactive
+ * shells; scripts keep the default dispositions except for SIGCHLD,
+ * which is always routed to signal_child_fd().
  *
+ * @param interactive  Non-zero if the shell reads from a terminal.
  * @return 0 on success, -1 on failure.
  */
-int signal_setup(void);
+int signal_setup(int interactive);
+
+/**
+ * @brief Descriptor that becomes readable when a child changes state.
+ *
+ * Suitable for poll(). After it polls readable, call signal_child_drain()
+ * and then signal_child_wait() until no more children report.
+ *
+ * @return The descriptor (non-blocking, close-on-exec).
+ */
+int signal_child_fd(void);
+
+/**
+ * @brief Consume pending child events.
+ *
+ * Must be called before reaping, so that an event arriving while the
+ * caller reaps stays pending for the next round.
+ *
+ * @return 1 if any event was pending, 0 otherwise.
+ */
+int signal_child_drain(void);
+
+/**
+ * @brief Get the next child status change.
+ *
+ * With signalfd this is wait4() for any child, including stops and
+ * continues. In the self-pipe fallback the SIGCHLD handler has already
+ * reaped into a ring and the record is taken from there; children the
+ * full ring left behind are reaped here.
+ *
+ * @param status  Receives the wait status.
+ * @param ru      Receives the child's resource usage.
+ * @param block   Non-zero to wait until a child changes state.
+ * @return        The child's pid, 0 if none changed (block zero), or -1
+ *                with errno set (ECHILD: no children).
+ */
+pid_t signal_child_wait(int *status, struct rusage *ru, int block);
+
+/**
+ * @brief Give a forked subshell child events of its own.
+ *
+ * A child that goes on running commands as a shell (e.g. for a command
+ * substitution) must not share the self-pipe with its parent, or each
+ * would consume the other's wakeups, nor keep the parent's reaped
+ * records in the ring. Recreates the self-pipe, empties the ring and
+ * installs the SIGCHLD handler again; with a signalfd, only blocks
+ * SIGCHLD again. May follow signal_restore_defaults(). Call it with
+ * SIGCHLD blocked or at its default disposition.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int signal_child_reset(void);
 
 /**
  * @brief Restore default signal handlers for a child process.
  *
  * Should be called in the child after fork() and before exec(), so that
  * terminal-generated signals (SIGINT, SIGTSTP, etc.) affect the program
- * normally.
+ * normally. Also restores the signal mask the shell started with.
  */
 void signal_restore_defaults(void);
 
+/**
+ * @brief Fill a signal set with the signals reset by signal_restore_defaults().
+ *
+ * Used with POSIX_SPAWN_SETSIGDEF so spawned children get the same
+ * dispositions as forked ones.
+ *
+ * @param set  Signal set to fill.
+ */
+void signal_default_set(sigset_t *set);
+
+/**
+ * @brief Get the signal mask children should start with.
+ *
+ * Used with POSIX_SPAWN_SETSIGMASK; the shell itself may keep SIGCHLD
+ * blocked.
+ *
+ * @param mask  Receives the mask.
+ */
+void signal_child_mask(sigset_t *mask);
+
 #endif /* SIGNAL_SETUP_H */
@@ -0,0 +1,97 @@
+/**
+ * @file trace.c
+ * @brief Implementation of the TINYSHELL_TRACE log.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "error.h"
+
+#define TRACE_LINE_MAX 1024
+
+static int trace_fd = -1;
+
+/* Value of TINYSHELL_TRACE the log was opened for. */
+static char *trace_path = NULL;
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Check whether tracing is enabled.
+ */
+int
+trace_enabled(void)
+{
+	const char *path = getenv("TINYSHELL_TRACE");
+
+	if (!path || !*path) {
+		if (trace_fd != -1) {
+			close(trace_fd);
+			trace_fd = -1;
+		}
+		free(trace_path);
+		trace_path = NULL;
+		return 0;
+	}
+
+	if (trace_path && !strcmp(trace_path, path))
+		return trace_fd != -1;
+
+	if (trace_fd != -1)
+		close(trace_fd);
+	free(trace_path);
+
+	trace_path = strdup(path);
+	if (!trace_path) {
+		error_print(__func__, "strdup", errno);
+		trace_fd = -1;
+		return 0;
+	}
+
+	/* a failed open is reported once, until the variable changes */
+	trace_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (trace_fd == -1)
+		error_print("TINYSHELL_TRACE", strerror(errno), 0);
+
+	return trace_fd != -1;
+}
+
+/**
+ * @brief Append one formatted line to the trace log.
+ */
+void
+trace_printf(const char *fmt, ...)
+{
+	char line[TRACE_LINE_MAX];
+	va_list ap;
+	size_t len;
+	ssize_t w;
+	int n;
+
+	if (!trace_enabled())
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+
+	len = (size_t)n < sizeof(line) - 1 ? (size_t)n : sizeof(line) - 2;
+	line[len++] = '\n';
+
+	/* best effort: a full disk must not break command execution */
+	w = write(trace_fd, line, len);
+	(void)w;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file trace.h
+ * @brief Optional execution trace log.
+ *
+ * When the TINYSHELL_TRACE environment variable names a file, the shell
+ * appends one line per traced event to it, e.g. every reaped child with
+ * its timing and resource usage. Lines are space-separated key=value
+ * pairs, so the log can be filtered with standard text tools.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * @brief Check whether tracing is enabled.
+ *
+ * Follows changes of TINYSHELL_TRACE: the log is (re)opened when the
+ * variable changes and closed when it is unset or empty.
+ *
+ * @return 1 if trace_printf() will write, 0 otherwise.
+ */
+int trace_enabled(void);
+
+/**
+ * @brief Append one formatted line to the trace log.
+ *
+ * The line is written with a single write() so lines from concurrent
+ * shells sharing a log do not interleave. A newline is appended.
+ *
+ * @param fmt  printf-style format.
+ */
+void trace_printf(const char *fmt, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 1, 2)))
+#endif
+	;
+
+#endif /* TRACE_H */
@@ -0,0 +1,536 @@
+/**
+ * @file zygote.c
+ * @brief Implementation of the command launcher process.
+ *
+ * Protocol, over a SOCK_SEQPACKET socket pair:
+ *   - Request: a zygote_header followed by NUL-terminated strings (path,
+ *     argv, the redirection targets present, the environment), with
+ *     stdin, stdout, stderr and the working directory as SCM_RIGHTS.
+ *   - Reply: a zygote_reply with the pid of the new process or errno.
+ * One request is in flight at a time; the shell waits for the reply.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* clone flags, syscall(), MSG_CMSG_CLOEXEC */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "zygote.h"
+#include "error.h"
+#include "options.h"
+#include "signal_setup.h"
+
+#if USE_ZYGOTE
+#include <dirent.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+extern char **environ;
+
+/* Largest request; bigger command lines and environments use fork() */
+#define ZYGOTE_MSG_MAX (128 * 1024)
+
+/* stdin, stdout, stderr and the working directory */
+#define ZYGOTE_NFDS 4
+
+/* argv[1] of the helper; argv[2] is its socket descriptor */
+#define ZYGOTE_HELPER_ARG "--zygote-helper"
+
+typedef struct {
+	pid_t pgid;
+	int cpu;
+	int nice;
+	int ionice;
+	unsigned int append;
+	unsigned int redirs;    /* bit i: redirect[i] is in the strings */
+	int argc;
+	int envc;
+} zygote_header;
+
+typedef struct {
+	pid_t pid;              /* -1 on failure */
+	int err;                /* errno of the failure */
+} zygote_reply;
+
+typedef union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(ZYGOTE_NFDS * sizeof(int))];
+} zygote_control;
+
+/* Shell's end of the socket, -1 when the zygote is not running */
+static int zygote_sock = -1;
+
+/* Request being encoded */
+static char *msg_buf = NULL;
+static size_t msg_cap = 0;
+
+/* ------------------------------------------------------------------------- */
+/*                            Static Helper Functions                        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Make room for a request of need bytes in msg_buf.
+ */
+static int
+msg_reserve(size_t need)
+{
+	size_t ncap = msg_cap ? msg_cap : 4096;
+	char *nb;
+
+	if (need <= msg_cap)
+		return 0;
+	if (need > ZYGOTE_MSG_MAX) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	while (ncap < need)
+		ncap *= 2;
+	if (ncap > ZYGOTE_MSG_MAX)
+		ncap = ZYGOTE_MSG_MAX;
+	nb = realloc(msg_buf, ncap);
+	if (!nb)
+		return -1;
+	msg_buf = nb;
+	msg_cap = ncap;
+	return 0;
+}
+
+/**
+ * @brief Append a string and its NUL to the request at *off.
+ */
+static int
+msg_put(size_t *off, const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	if (msg_reserve(*off + len) == -1)
+		return -1;
+
+	memcpy(msg_buf + *off, s, len);
+	*off += len;
+	return 0;
+}
+
+/**
+ * @brief Build the request for l in msg_buf.
+ *
+ * @return Its length, or 0 if it could not be built.
+ */
+static size_t
+msg_encode(const zygote_launch *l)
+{
+	zygote_header h;
+	size_t off = sizeof(h);
+	Command *cmd = l->cmd;
+
+	memset(&h, 0, sizeof(h));
+	h.pgid = l->pgid;
+	h.cpu = l->cpu;
+	h.nice = l->nice;
+	h.ionice = l->ionice;
+	h.append = cmd->append;
+	h.argc = cmd->argc;
+
+	/* the header goes in front once the counts are known */
+	if (msg_reserve(off) == -1 || msg_put(&off, l->path) == -1)
+		return 0;
+	for (int i = 0; i < cmd->argc; i++) {
+		if (msg_put(&off, cmd->argv[i]) == -1)
+			return 0;
+	}
+	for (int i = 0; i < REDIR_COUNT; i++) {
+		if (!cmd->redirect[i])
+			continue;
+		if (msg_put(&off, cmd->redirect[i]) == -1)
+			return 0;
+		h.redirs |= 1u << i;
+	}
+	for (char **e = environ; *e; e++) {
+		if (msg_put(&off, *e) == -1)
+			return 0;
+		h.envc++;
+	}
+
+	memcpy(msg_buf, &h, sizeof(h));
+	return off;
+}
+
+#if USE_ZYGOTE
+/**
+ * @brief Take the next string of a request, or NULL past its end.
+ */
+static char *
+msg_take(char **p, const char *end)
+{
+	char *s = *p;
+	char *nul;
+
+	if (s >= end || !(nul = memchr(s, '\0', (size_t)(end - s))))
+		return NULL;
+	*p = nul + 1;
+	return s;
+}
+
+/**
+ * @brief Decode a request and create its process.
+ *
+ * Runs in the zygote. The process is cloned with CLONE_PARENT and no
+ * stack of its own, so it is a copy of the zygote, like after fork(),
+ * whose parent is the shell. libc's fork handlers do not run; the
+ * process only sets itself up and execs.
+ *
+ * @return The pid, or -1 with errno set.
+ */
+static pid_t
+zygote_clone(char *buf, size_t len, const int *fds, zygote_exec_fn exec)
+{
+	zygote_header h;
+	zygote_launch l;
+	Command cmd;
+	char **strs;
+	char *p = buf + sizeof(h);
+	const char *end = buf + len;
+	size_t nstrs;
+	int bad = 0;
+	pid_t pid;
+
+	if (len < sizeof(h)) {
+		errno = EPROTO;
+		return -1;
+	}
+	memcpy(&h, buf, sizeof(h));
+	if (h.argc < 1 || h.envc < 0 || (size_t)h.argc + (size_t)h.envc > len) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	/* argv and environ, each NULL-terminated, in one array */
+	nstrs = (size_t)h.argc + (size_t)h.envc + 2;
+	strs = malloc(nstrs * sizeof(*strs));
+	if (!strs)
+		return -1;
+
+	memset(&cmd, 0, sizeof(cmd));
+	memset(&l, 0, sizeof(l));
+	l.cmd = &cmd;
+	bad |= !(l.path = msg_take(&p, end));
+	cmd.argc = h.argc;
+	cmd.argv = strs;
+	cmd.append = h.append;
+	for (int i = 0; i < h.argc; i++)
+		bad |= !(strs[i] = msg_take(&p, end));
+	strs[h.argc] = NULL;
+	for (int i = 0; i < REDIR_COUNT; i++) {
+		if (h.redirs & (1u << i))
+			bad |= !(cmd.redirect[i] = msg_take(&p, end));
+	}
+	for (int i = 0; i < h.envc; i++)
+		bad |= !(strs[h.argc + 1 + i] = msg_take(&p, end));
+	strs[nstrs - 1] = NULL;
+
+	if (bad || (h.redirs >> REDIR_COUNT)) {
+		free(strs);
+		errno = EPROTO;
+		return -1;
+	}
+	l.cpu = h.cpu;
+	l.nice = h.nice;
+	l.ionice = h.ionice;
+
+	pid = (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+	if (pid == 0) {
+		for (int i = 0; i < 3; i++) {
+			if (dup2(fds[i], i) == -1)
+				_exit(1);
+		}
+		if (fchdir(fds[3]) == -1) {
+			error_print(cmd.argv[0], strerror(errno), 0);
+			_exit(126);
+		}
+		/* a leader that already exited takes the group with it; run anyway */
+		setpgid(0, h.pgid);
+		environ = strs + h.argc + 1;
+
+		exec(&l);
+		_exit(127);
+	}
+
+	free(strs);
+	return pid;
+}
+
+/**
+ * @brief Close every inherited descriptor above stderr but keep.
+ *
+ * The zygote may be forked in the middle of a pipeline; a pipe end it
+ * kept open would hold back EOF from that pipeline's reader.
+ */
+static void
+zygote_close_inherited(int keep)
+{
+	DIR *dp = opendir("/proc/self/fd");
+	struct dirent *de;
+
+	if (!dp)
+		return;
+
+	while ((de = readdir(dp))) {
+		int fd = atoi(de->d_name);
+
+		if (fd > STDERR_FILENO && fd != keep && fd != dirfd(dp))
+			close(fd);
+	}
+	closedir(dp);
+}
+
+/**
+ * @brief Serve launch requests until the shell closes its end.
+ */
+static void
+zygote_main(int sock, zygote_exec_fn exec)
+{
+	char *buf = malloc(ZYGOTE_MSG_MAX);
+
+	if (!buf)
+		_exit(1);
+
+	for (;;) {
+		zygote_control control;
+		zygote_reply reply;
+		struct iovec iov;
+		struct msghdr msg;
+		struct cmsghdr *c;
+		int fds[ZYGOTE_NFDS];
+		int nfds = 0;
+		ssize_t n;
+
+		iov.iov_base = buf;
+		iov.iov_len = ZYGOTE_MSG_MAX;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if (n == 0)
+			_exit(0);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			_exit(1);
+		}
+
+		for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+				nfds = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+				memcpy(fds, CMSG_DATA(c), (size_t)nfds * sizeof(int));
+				break;
+			}
+		}
+
+		if (nfds != ZYGOTE_NFDS || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+			reply.pid = -1;
+			reply.err = EPROTO;
+		} else {
+			reply.pid = zygote_clone(buf, (size_t)n, fds, exec);
+			reply.err = reply.pid == -1 ? errno : 0;
+		}
+		for (int i = 0; i < nfds; i++)
+			close(fds[i]);
+
+		while (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) == -1) {
+			if (errno != EINTR)
+				_exit(1);
+		}
+	}
+}
+#endif /* USE_ZYGOTE */
+
+/* ------------------------------------------------------------------------- */
+/*                              Public Interface                             */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Start the zygote.
+ */
+int
+zygote_start(void)
+{
+#if USE_ZYGOTE
+	char fdarg[16];
+	int sv[2];
+	pid_t pid;
+
+	if (zygote_sock != -1)
+		return 0;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+		error_print("zygote", "socketpair", errno);
+		return -1;
+	}
+
+	/* the zygote must not write out what the shell has buffered */
+	fflush(NULL);
+
+	pid = fork();
+	if (pid == -1) {
+		error_print("zygote", "fork", errno);
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		zygote_close_inherited(sv[1]);
+		/* out of the terminal's foreground group: ^C must not reach it */
+		setpgid(0, 0);
+		signal_restore_defaults();
+
+		/* a fresh image: nothing of the shell's memory is kept */
+		snprintf(fdarg, sizeof(fdarg), "%d", sv[1]);
+		if (fcntl(sv[1], F_SETFD, 0) == -1)
+			_exit(1);
+		execl("/proc/self/exe", "tinyshell", ZYGOTE_HELPER_ARG, fdarg, (char *)NULL);
+		error_print("zygote", "/proc/self/exe", errno);
+		_exit(127);
+	}
+
+	close(sv[1]);
+	zygote_sock = sv[0];
+	return 0;
+#else
+	error_print("zygote", "clone(CLONE_PARENT)", ENOSYS);
+	return -1;
+#endif
+}
+
+/**
+ * Serve as the zygote if this process was started as one.
+ */
+void
+zygote_helper(int argc, char *argv[], zygote_exec_fn exec)
+{
+#if USE_ZYGOTE
+	int type = 0;
+	socklen_t len = sizeof(type);
+	char *end;
+	long fd;
+
+	if (argc != 3 || strcmp(argv[1], ZYGOTE_HELPER_ARG))
+		return;
+
+	/* only the socket zygote_start() passes down: anything else is a
+	 * command line for main() to reject */
+	errno = 0;
+	fd = strtol(argv[2], &end, 10);
+	if (errno || end == argv[2] || *end || fd < 0 || fd > INT_MAX ||
+	    getsockopt((int)fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1 ||
+	    type != SOCK_SEQPACKET)
+		return;
+
+	/* exec'd through /proc/self/exe, the name would be "exe" */
+	prctl(PR_SET_NAME, "tinyshell-zyg", 0, 0, 0);
+	zygote_main((int)fd, exec);
+	_exit(0);
+#else
+	(void)argc;
+	(void)argv;
+	(void)exec;
+#endif
+}
+
+/**
+ * Check whether the zygote is running.
+ */
+int
+zygote_running(void)
+{
+	return zygote_sock != -1;
+}
+
+/**
+ * Launch a command through the zygote.
+ */
+pid_t
+zygote_spawn(const zygote_launch *l)
+{
+	zygote_control control;
+	zygote_reply reply;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *c;
+	int fds[ZYGOTE_NFDS];
+	size_t len;
+	ssize_t n;
+
+	if (zygote_sock == -1 || !(len = msg_encode(l)))
+		return -1;
+
+	fds[0] = l->fds[0];
+	fds[1] = l->fds[1];
+	fds[2] = l->fds[2];
+	fds[3] = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fds[3] == -1)
+		return -1;
+
+	iov.iov_base = msg_buf;
+	iov.iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+	while ((n = sendmsg(zygote_sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+		;
+	close(fds[3]);
+	if (n != (ssize_t)len) {
+		zygote_stop();
+		return -1;
+	}
+
+	while ((n = recv(zygote_sock, &reply, sizeof(reply), 0)) == -1 && errno == EINTR)
+		;
+	if (n != (ssize_t)sizeof(reply)) {
+		zygote_stop();
+		return -1;
+	}
+
+	if (reply.pid == -1) {
+		errno = reply.err;
+		return -1;
+	}
+	return reply.pid;
+}
+
+/**
+ * Shut the zygote down.
+ */
+void
+zygote_stop(void)
+{
+	if (zygote_sock == -1)
+		return;
+
+	close(zygote_sock);
+	zygote_sock = -1;
+}
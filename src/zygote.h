@@ -0,0 +1,108 @@
+/**
+ * @file zygote.h
+ * @brief Launcher process for external commands (`set -o zygote`).
+ *
+ * The zygote is a small helper: the shell forks and immediately execs
+ * its own binary (/proc/self/exe) in helper mode, so the zygote starts
+ * from a fresh image rather than a copy of the grown shell. The shell
+ * sends it each external command over a UNIX socket: the words,
+ * redirections and environment in one message, stdin, stdout, stderr and
+ * the working directory as descriptors. The zygote creates the process
+ * with clone(CLONE_PARENT), so the command is a child of the shell and is
+ * reaped and job-controlled like any other. The shell's heap, history,
+ * script cache, path cache and job table are never copied to launch a
+ * command.
+ *
+ * All the zygote inherits from the shell is what survives execve(): its
+ * end of the socket and stdin, stdout and stderr (every other descriptor
+ * is closed first), the environment and working directory at the time it
+ * started (each request brings the current ones), resource limits, the
+ * nice value, and the default signal dispositions and mask of a child.
+ * It runs in a process group of its own.
+ */
+
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <sys/types.h>
+
+#include "parser.h"
+
+/**
+ * @struct zygote_launch
+ * @brief An external command to launch.
+ */
+typedef struct {
+	Command *cmd;       /* Words and redirections */
+	const char *path;   /* Executable resolved by the shell */
+	int fds[3];         /* Become stdin, stdout and stderr */
+	pid_t pgid;         /* Process group to join, 0 for a new one */
+	int cpu;            /* CPU to pin to, or -1 */
+	int nice;           /* Nice increment, 0 for none */
+	int ionice;         /* Best-effort I/O priority level, or -1 */
+} zygote_launch;
+
+/**
+ * @brief Turn a launch into the command; runs in the new process.
+ *
+ * Called with fds already on 0, 1 and 2, the working directory and
+ * environment of the shell in place and the process group joined. Must
+ * not return.
+ *
+ * @param l  The launch, with fds no longer meaningful.
+ */
+typedef void (*zygote_exec_fn)(const zygote_launch *l);
+
+/**
+ * @brief Start the zygote.
+ *
+ * Forks and execs this program as the helper; see zygote_helper(). A
+ * helper that fails to exec exits, and zygote_spawn() then falls back.
+ *
+ * @return  0 on success, -1 on failure (reported).
+ */
+int zygote_start(void);
+
+/**
+ * @brief Serve as the zygote if this process was started as one.
+ *
+ * To be called at the top of main(), before any other setup. Returns
+ * right away unless argv is the helper's command line and names an
+ * inherited SOCK_SEQPACKET socket, so a stray `--zygote-helper N` still
+ * gets the usage error; otherwise serves launch requests and exits once
+ * the shell closes its end of the socket.
+ *
+ * @param argc  Argument count of main().
+ * @param argv  Argument vector of main().
+ * @param exec  Run by each launched process.
+ */
+void zygote_helper(int argc, char *argv[], zygote_exec_fn exec);
+
+/**
+ * @brief Check whether the zygote is running.
+ *
+ * @return 1 if zygote_spawn() can be used.
+ */
+int zygote_running(void);
+
+/**
+ * @brief Launch a command through the zygote.
+ *
+ * Failures are not reported; the caller falls back to its own launch
+ * path. A zygote that stopped answering is shut down, and the next
+ * zygote_start() forks a fresh one.
+ *
+ * @param l  The command and its process setup.
+ * @return   The pid of the new child of the shell, or -1.
+ */
+pid_t zygote_spawn(const zygote_launch *l);
+
+/**
+ * @brief Shut the zygote down.
+ *
+ * Closing its socket makes it exit; it is reaped like any other child.
+ * The next zygote_start() starts a fresh one.
+ */
+void zygote_stop(void);
+
+#endif /* ZYGOTE_H */
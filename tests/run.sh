@@ -0,0 +1,30 @@
+#!/bin/sh
+# Run every tests/*.tsh script through the shell and compare its output
+# with the matching .out file. Scripts named stdin-*.tsh are read from
+# stdin instead, redirected from the file, and pipe-*.tsh through a pipe.
+# Usage: tests/run.sh bin/tinyshell
+shell=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+cd "$(dirname "$0")" || exit 1
+
+# scripts that check an exit status run a nested shell through sh
+TINYSHELL=$shell
+export TINYSHELL
+
+run() {
+	case $1 in
+	stdin-*) "$shell" < "$1" ;;
+	pipe-*)  cat "$1" | "$shell" ;;
+	*)       "$shell" "$1" ;;
+	esac
+}
+
+failed=0
+for t in *.tsh; do
+	if run "$t" 2>&1 | cmp -s - "${t%.tsh}.out"; then
+		echo "PASS: $t"
+	else
+		echo "FAIL: $t"
+		failed=1
+	fi
+done
+exit $failed